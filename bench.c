@@ -0,0 +1,650 @@
+#include "budoux-c.h"
+#include "test_helpers.h"
+#include "tools.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  include <windows.h>
+#else
+#  include <time.h>
+#endif
+
+#ifdef __linux__
+#  include <linux/perf_event.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+// The built-in corpora repeat one paragraph per language until they reach this many code points. Real text can be
+// given with -c.
+#define BENCH_CORPUS_CODE_POINTS 100000
+#define BENCH_MAX_ITERATIONS 1000
+#define BENCH_INIT_THREADS 3
+
+static char const sample_ja[] = "私はその人を常に先生と呼んでいた。だからここでもただ先生と書くだけで本名は打ち明けない。"
+                                "これは世間を憚かる遠慮というよりも、その方が私にとって自然だからである。"
+                                "私はその人の記憶を呼び起すごとに、すぐ「先生」といいたくなる。筆を執っても心持は同じ事である。"
+                                "よそよそしい頭文字などはとても使う気にならない。";
+
+static char const sample_zh_hans[] = "今天早上下了一场小雨，街道上的行人比平时少了许多。"
+                                     "我在路边的小店里买了一杯热茶，坐在窗前看着外面的风景。"
+                                     "城市的节奏很快，但偶尔停下来，也能发现生活中许多美好的细节。";
+
+static char const sample_zh_hant[] = "今天早上下了一場小雨，街道上的行人比平時少了許多。"
+                                     "我在路邊的小店裡買了一杯熱茶，坐在窗前看著外面的風景。"
+                                     "城市的節奏很快，但偶爾停下來，也能發現生活中許多美好的細節。";
+
+static char const sample_th[] = "วันนี้อากาศดีมาก เราจึงตัดสินใจไปเดินเล่นที่สวนสาธารณะใกล้บ้าน "
+                                "มีเด็กๆ กำลังเล่นฟุตบอลอยู่ริมสนาม และมีผู้สูงอายุนั่งพูดคุยกันใต้ต้นไม้ใหญ่ "
+                                "บรรยากาศแบบนี้ทำให้รู้สึกผ่อนคลายและมีความสุข";
+
+struct language {
+  char const *name;
+  char const *json;
+  char const *sample;
+  struct budouxc *(*init_embedded)(struct budouxc_allocators const *const allocators, char *error128);
+};
+
+static struct language const languages[] = {
+    {"ja", "ja.json", sample_ja, budouxc_init_embedded_ja},
+    {"zh-hans", "zh-hans.json", sample_zh_hans, budouxc_init_embedded_zh_hans},
+    {"zh-hant", "zh-hant.json", sample_zh_hant, budouxc_init_embedded_zh_hant},
+    {"th", "th.json", sample_th, budouxc_init_embedded_th},
+};
+
+#define LANGUAGES (sizeof(languages) / sizeof(languages[0]))
+
+static uint64_t now_ns(void) {
+#ifdef _WIN32
+  LARGE_INTEGER freq;
+  LARGE_INTEGER counter;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)((double)counter.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// Hardware counters ----
+
+enum {
+  hw_cycles,
+  hw_instructions,
+  hw_cache_misses,
+  hw_branch_misses,
+  hw_count,
+};
+
+static char const *const hw_names[hw_count] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+
+struct hw_counters {
+  int fd[hw_count];
+};
+
+static void hw_init(struct hw_counters *const hw, bool const enable) {
+  for (size_t i = 0; i < hw_count; ++i) {
+    hw->fd[i] = -1;
+  }
+#ifdef __linux__
+  if (!enable) {
+    return;
+  }
+  static uint64_t const configs[hw_count] = {
+      PERF_COUNT_HW_CPU_CYCLES,
+      PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES,
+      PERF_COUNT_HW_BRANCH_MISSES,
+  };
+  for (size_t i = 0; i < hw_count; ++i) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = configs[i];
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    hw->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (hw->fd[i] < 0) {
+      fprintf(stderr, "hardware counter %s is not available\n", hw_names[i]);
+    }
+  }
+#else
+  if (enable) {
+    fprintf(stderr, "hardware counters are only available on Linux\n");
+  }
+#endif
+}
+
+static void hw_destroy(struct hw_counters *const hw) {
+#ifdef __linux__
+  for (size_t i = 0; i < hw_count; ++i) {
+    if (hw->fd[i] >= 0) {
+      close(hw->fd[i]);
+    }
+  }
+#else
+  (void)hw;
+#endif
+}
+
+static void hw_start(struct hw_counters const *const hw) {
+#ifdef __linux__
+  for (size_t i = 0; i < hw_count; ++i) {
+    if (hw->fd[i] >= 0) {
+      ioctl(hw->fd[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(hw->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+#else
+  (void)hw;
+#endif
+}
+
+// Stores UINT64_MAX for counters that are not available.
+static void hw_stop(struct hw_counters const *const hw, uint64_t *const values) {
+  for (size_t i = 0; i < hw_count; ++i) {
+    values[i] = UINT64_MAX;
+#ifdef __linux__
+    if (hw->fd[i] >= 0) {
+      ioctl(hw->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+      uint64_t v = 0;
+      if (read(hw->fd[i], &v, sizeof(v)) == (ssize_t)sizeof(v)) {
+        values[i] = v;
+      }
+    }
+#endif
+  }
+}
+
+// Corpus ----
+
+struct corpus {
+  char *utf8;
+  char16_t *utf16;
+  char32_t *utf32;
+  // Start offsets of each line in each encoding, followed by the end of the corpus.
+  size_t *lines8;
+  size_t *lines16;
+  size_t *lines32;
+  size_t lines;
+  size_t code_points;
+};
+
+static void corpus_destroy(struct corpus *const c) {
+  free(c->utf8);
+  free(c->utf16);
+  free(c->utf32);
+  free(c->lines8);
+  free(c->lines16);
+  free(c->lines32);
+  *c = (struct corpus){0};
+}
+
+// Takes ownership of utf8 and converts it to the other encodings. Empty lines and line breaks are dropped.
+static bool corpus_init(struct corpus *const c, char *const utf8, size_t const len) {
+  *c = (struct corpus){.utf8 = utf8};
+  if (!len) {
+    fprintf(stderr, "corpus is empty\n");
+    return false;
+  }
+  size_t lines = 1;
+  for (size_t i = 0; i < len; ++i) {
+    if (utf8[i] == '\n') {
+      ++lines;
+    }
+  }
+  c->utf16 = malloc(len * 2 * sizeof(char16_t));
+  c->utf32 = malloc(len * sizeof(char32_t));
+  c->lines8 = malloc((lines + 1) * sizeof(size_t));
+  c->lines16 = malloc((lines + 1) * sizeof(size_t));
+  c->lines32 = malloc((lines + 1) * sizeof(size_t));
+  if (!c->utf16 || !c->utf32 || !c->lines8 || !c->lines16 || !c->lines32) {
+    fprintf(stderr, "out of memory\n");
+    return false;
+  }
+  size_t n8 = 0;
+  size_t n16 = 0;
+  size_t n32 = 0;
+  for (size_t pos = 0; pos < len;) {
+    char const *const nl = memchr(utf8 + pos, '\n', len - pos);
+    size_t end = nl ? (size_t)(nl - utf8) : len;
+    size_t const next = end + 1;
+    if (end > pos && utf8[end - 1] == '\r') {
+      --end;
+    }
+    if (end == pos) {
+      pos = next;
+      continue;
+    }
+    c->lines8[c->lines] = n8;
+    c->lines16[c->lines] = n16;
+    c->lines32[c->lines] = n32;
+    ++c->lines;
+    while (pos < end) {
+      char32_t ch = 0;
+      size_t const n = decode_utf8((unsigned char const *)utf8 + pos, end - pos, &ch);
+      if (!n || ch == 0) {
+        fprintf(stderr, "corpus is not valid UTF-8 at byte %zu\n", pos);
+        return false;
+      }
+      memmove(utf8 + n8, utf8 + pos, n);
+      n8 += n;
+      pos += n;
+      c->utf32[n32++] = ch;
+      if (ch >= 0x10000) {
+        c->utf16[n16++] = (char16_t)(0xd800 | ((ch - 0x10000) >> 10));
+        c->utf16[n16++] = (char16_t)(0xdc00 | ((ch - 0x10000) & 0x3ff));
+      } else {
+        c->utf16[n16++] = (char16_t)ch;
+      }
+    }
+    pos = next;
+  }
+  c->lines8[c->lines] = n8;
+  c->lines16[c->lines] = n16;
+  c->lines32[c->lines] = n32;
+  c->code_points = n32;
+  if (!c->code_points) {
+    fprintf(stderr, "corpus is empty\n");
+    return false;
+  }
+  return true;
+}
+
+static bool corpus_init_sample(struct corpus *const c, char const *const sample) {
+  size_t const sample_len = strlen(sample);
+  size_t code_points = 0;
+  for (size_t i = 0; i < sample_len; ++i) {
+    if (((unsigned char)sample[i] & 0xc0) != 0x80) {
+      ++code_points;
+    }
+  }
+  size_t const repeat = (BENCH_CORPUS_CODE_POINTS + code_points - 1) / code_points;
+  char *const utf8 = malloc(repeat * (sample_len + 1));
+  if (!utf8) {
+    fprintf(stderr, "out of memory\n");
+    return false;
+  }
+  for (size_t i = 0; i < repeat; ++i) {
+    memcpy(utf8 + i * (sample_len + 1), sample, sample_len);
+    utf8[i * (sample_len + 1) + sample_len] = '\n';
+  }
+  return corpus_init(c, utf8, repeat * (sample_len + 1));
+}
+
+// Entry points ----
+
+struct run {
+  struct budouxc *model;
+  struct budouxc_parser *parser;
+  struct corpus const *corpus;
+  size_t line;
+  size_t pos;
+  size_t boundaries;
+  char error[128];
+};
+
+static bool run_utf8(struct run *const r) {
+  struct corpus const *const c = r->corpus;
+  struct budouxc_boundaries *const b = budouxc_parse_boundaries_utf8(
+      r->model, c->utf8 + c->lines8[r->line], c->lines8[r->line + 1] - c->lines8[r->line], r->error);
+  if (!b) {
+    return false;
+  }
+  r->boundaries += b->n;
+  budouxc_boundaries_destroy(r->model, b);
+  return true;
+}
+
+static bool run_utf16(struct run *const r) {
+  struct corpus const *const c = r->corpus;
+  struct budouxc_boundaries *const b = budouxc_parse_boundaries_utf16(
+      r->model, c->utf16 + c->lines16[r->line], c->lines16[r->line + 1] - c->lines16[r->line], r->error);
+  if (!b) {
+    return false;
+  }
+  r->boundaries += b->n;
+  budouxc_boundaries_destroy(r->model, b);
+  return true;
+}
+
+static bool run_utf32(struct run *const r) {
+  struct corpus const *const c = r->corpus;
+  struct budouxc_boundaries *const b = budouxc_parse_boundaries_utf32(
+      r->model, c->utf32 + c->lines32[r->line], c->lines32[r->line + 1] - c->lines32[r->line], r->error);
+  if (!b) {
+    return false;
+  }
+  r->boundaries += b->n;
+  budouxc_boundaries_destroy(r->model, b);
+  return true;
+}
+
+static bool run_parser_utf8(struct run *const r) {
+  struct corpus const *const c = r->corpus;
+  struct budouxc_boundaries const *const b = budouxc_parser_parse_utf8(
+      r->parser, c->utf8 + c->lines8[r->line], c->lines8[r->line + 1] - c->lines8[r->line], r->error);
+  if (!b) {
+    return false;
+  }
+  r->boundaries += b->n;
+  return true;
+}
+
+static char32_t get_char(void *userdata) {
+  struct run *const r = userdata;
+  if (r->pos == r->corpus->lines32[r->line + 1]) {
+    return 0;
+  }
+  return r->corpus->utf32[r->pos++];
+}
+
+static bool add_boundary(size_t const boundary, void *userdata) {
+  (void)boundary;
+  struct run *const r = userdata;
+  ++r->boundaries;
+  return true;
+}
+
+static bool run_callback(struct run *const r) {
+  r->pos = r->corpus->lines32[r->line];
+  return budouxc_parse_boundaries_callback(r->model, get_char, add_boundary, r);
+}
+
+static char32_t const *get_chars(size_t *const len, void *userdata) {
+  struct run *const r = userdata;
+  size_t const end = r->corpus->lines32[r->line + 1];
+  *len = end - r->pos;
+  char32_t const *const block = r->corpus->utf32 + r->pos;
+  r->pos = end;
+  return block;
+}
+
+static bool add_boundaries(size_t const *const boundaries, size_t const n, void *userdata) {
+  (void)boundaries;
+  struct run *const r = userdata;
+  r->boundaries += n;
+  return true;
+}
+
+static bool run_callback_block(struct run *const r) {
+  r->pos = r->corpus->lines32[r->line];
+  return budouxc_parse_boundaries_callback_block(r->model, get_chars, add_boundaries, r);
+}
+
+struct entry {
+  char const *name;
+  bool (*run)(struct run *const r);
+};
+
+static struct entry const entries[] = {
+    {"utf8", run_utf8},
+    {"utf16", run_utf16},
+    {"utf32", run_utf32},
+    {"parser_utf8", run_parser_utf8},
+    {"callback", run_callback},
+    {"callback_block", run_callback_block},
+};
+
+// Results ----
+
+static int compare_u64(void const *const a, void const *const b) {
+  uint64_t const x = *(uint64_t const *)a;
+  uint64_t const y = *(uint64_t const *)b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+struct timing {
+  uint64_t min;
+  uint64_t median;
+};
+
+static struct timing summarize(uint64_t *const ns, size_t const n) {
+  qsort(ns, n, sizeof(uint64_t), compare_u64);
+  return (struct timing){.min = ns[0], .median = ns[n / 2]};
+}
+
+// Each result is printed as one JSON object per line.
+static void print_hw(uint64_t const *const values, double const per) {
+  for (size_t i = 0; i < hw_count; ++i) {
+    if (values[i] != UINT64_MAX) {
+      printf(",\"%s_per_code_point\":%.4f", hw_names[i], (double)values[i] / per);
+    }
+  }
+}
+
+static bool bench_init(struct language const *const lang,
+                       char const *const model_dir,
+                       size_t const iterations,
+                       uint64_t *const ns) {
+  char path[4096];
+  if ((size_t)snprintf(path, sizeof(path), "%s/%s", model_dir, lang->json) >= sizeof(path)) {
+    fprintf(stderr, "model path is too long\n");
+    return false;
+  }
+  size_t json_len = 0;
+  char *const json = read_file(path, &json_len);
+  if (!json) {
+    fprintf(stderr, "failed to read %s\n", path);
+    return false;
+  }
+  bool ok = false;
+  char error[128] = {0};
+  // Each model is loaded on one thread, and with its maps built on multiple threads.
+  static struct {
+    char const *name;
+    size_t threads;
+  } const modes[] = {
+      {"init", 1},
+      {"init_parallel", BENCH_INIT_THREADS},
+  };
+  for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+    struct counter counter = {0};
+    struct budouxc_allocators const allocators = {
+        .fn_realloc = counting_realloc,
+        .fn_free = counting_free,
+        .user_data = &counter,
+    };
+    for (size_t i = 0; i < iterations; ++i) {
+      uint64_t const start = now_ns();
+      struct budouxc *const model = modes[m].threads > 1
+                                        ? budouxc_init_parallel(&allocators, json, json_len, modes[m].threads, error)
+                                        : budouxc_init(&allocators, json, json_len, error);
+      ns[i] = now_ns() - start;
+      if (!model) {
+        fprintf(stderr, "%s failed: %s\n", modes[m].threads > 1 ? "budouxc_init_parallel" : "budouxc_init", error);
+        goto cleanup;
+      }
+      budouxc_destroy(model);
+    }
+    struct timing const t = summarize(ns, iterations);
+    printf("{\"bench\":\"%s\",\"language\":\"%s\",\"iterations\":%zu,\"ns_min\":%llu,\"ns_median\":%llu,"
+           "\"peak_bytes\":%zu}\n",
+           modes[m].name,
+           lang->name,
+           iterations,
+           (unsigned long long)t.min,
+           (unsigned long long)t.median,
+           atomic_load(&counter.peak));
+  }
+  ok = true;
+cleanup:
+  free(json);
+  return ok;
+}
+
+static bool bench_init_embedded(struct language const *const lang, size_t const iterations, uint64_t *const ns) {
+  char error[128] = {0};
+  struct counter counter = {0};
+  struct budouxc_allocators const allocators = {
+      .fn_realloc = counting_realloc,
+      .fn_free = counting_free,
+      .user_data = &counter,
+  };
+  for (size_t i = 0; i < iterations; ++i) {
+    uint64_t const start = now_ns();
+    struct budouxc *const model = lang->init_embedded(&allocators, error);
+    ns[i] = now_ns() - start;
+    if (!model) {
+      fprintf(stderr, "budouxc_init_embedded failed: %s\n", error);
+      return false;
+    }
+    budouxc_destroy(model);
+  }
+  struct timing const t = summarize(ns, iterations);
+  printf("{\"bench\":\"init_embedded\",\"language\":\"%s\",\"iterations\":%zu,\"ns_min\":%llu,\"ns_median\":%llu,"
+         "\"peak_bytes\":%zu}\n",
+         lang->name,
+         iterations,
+         (unsigned long long)t.min,
+         (unsigned long long)t.median,
+         atomic_load(&counter.peak));
+  return true;
+}
+
+static bool bench_parse(struct language const *const lang,
+                        struct corpus const *const corpus,
+                        struct hw_counters const *const hw,
+                        size_t const iterations,
+                        uint64_t *const ns) {
+  bool ok = false;
+  struct counter counter = {0};
+  struct budouxc_allocators const allocators = {
+      .fn_realloc = counting_realloc,
+      .fn_free = counting_free,
+      .user_data = &counter,
+  };
+  struct run r = {.corpus = corpus};
+  r.model = lang->init_embedded(&allocators, r.error);
+  if (!r.model) {
+    fprintf(stderr, "budouxc_init_embedded failed: %s\n", r.error);
+    goto cleanup;
+  }
+  r.parser = budouxc_parser_init(r.model, r.error);
+  if (!r.parser) {
+    fprintf(stderr, "budouxc_parser_init failed: %s\n", r.error);
+    goto cleanup;
+  }
+  for (size_t e = 0; e < sizeof(entries) / sizeof(entries[0]); ++e) {
+    uint64_t hw_values[hw_count];
+    counter_reset_peak(&counter);
+    size_t const base = atomic_load(&counter.current);
+    hw_start(hw);
+    for (size_t i = 0; i < iterations; ++i) {
+      r.boundaries = 0;
+      uint64_t const start = now_ns();
+      for (r.line = 0; r.line < corpus->lines; ++r.line) {
+        if (!entries[e].run(&r)) {
+          fprintf(stderr, "%s failed: %s\n", entries[e].name, r.error);
+          goto cleanup;
+        }
+      }
+      ns[i] = now_ns() - start;
+    }
+    hw_stop(hw, hw_values);
+    struct timing const t = summarize(ns, iterations);
+    printf("{\"bench\":\"parse\",\"language\":\"%s\",\"entry\":\"%s\",\"iterations\":%zu,\"code_points\":%zu,"
+           "\"boundaries\":%zu,\"ns_per_code_point_min\":%.4f,\"ns_per_code_point_median\":%.4f,\"peak_bytes\":%zu",
+           lang->name,
+           entries[e].name,
+           iterations,
+           corpus->code_points,
+           r.boundaries,
+           (double)t.min / (double)corpus->code_points,
+           (double)t.median / (double)corpus->code_points,
+           atomic_load(&counter.peak) - base);
+    print_hw(hw_values, (double)corpus->code_points * (double)iterations);
+    printf("}\n");
+  }
+  ok = true;
+cleanup:
+  budouxc_parser_destroy(r.parser);
+  budouxc_destroy(r.model);
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  char const *model_dir = NULL;
+#ifdef BUDOUXC_BENCH_MODEL_DIR
+  model_dir = BUDOUXC_BENCH_MODEL_DIR;
+#endif
+  char const *corpus_paths[LANGUAGES] = {0};
+  size_t iterations = 10;
+  bool perf = false;
+  bool usage = false;
+  for (int i = 1; i < argc && !usage; ++i) {
+    if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+      model_dir = argv[++i];
+    } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      char *end = NULL;
+      unsigned long long const v = strtoull(argv[++i], &end, 10);
+      usage = *end != '\0' || v < 1 || v > BENCH_MAX_ITERATIONS;
+      iterations = (size_t)v;
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      char const *const arg = argv[++i];
+      char const *const eq = strchr(arg, '=');
+      size_t const name_len = eq ? (size_t)(eq - arg) : 0;
+      usage = true;
+      for (size_t j = 0; eq && j < LANGUAGES; ++j) {
+        if (strlen(languages[j].name) == name_len && memcmp(languages[j].name, arg, name_len) == 0) {
+          corpus_paths[j] = eq + 1;
+          usage = false;
+        }
+      }
+    } else if (strcmp(argv[i], "-p") == 0) {
+      perf = true;
+    } else {
+      usage = true;
+    }
+  }
+  if (usage) {
+    fprintf(stderr, "usage: budouxc_bench [-m <model dir>] [-c <language>=<corpus>]... [-n <iterations>] [-p]\n");
+    fprintf(stderr, "  -m <model dir>          directory with ja.json, zh-hans.json, zh-hant.json and th.json\n");
+    fprintf(stderr, "  -c <language>=<corpus>  UTF-8 text with one sentence per line instead of the built-in one\n");
+    fprintf(stderr, "  -n <iterations>         number of runs of each benchmark, up to %d\n", BENCH_MAX_ITERATIONS);
+    fprintf(stderr, "  -p                      read hardware counters through perf_event on Linux\n");
+    fprintf(stderr, "Results are printed as one JSON object per line.\n");
+    return 1;
+  }
+
+  int ret = 1;
+  uint64_t ns[BENCH_MAX_ITERATIONS];
+  struct hw_counters hw;
+  hw_init(&hw, perf);
+  for (size_t i = 0; i < LANGUAGES; ++i) {
+    struct language const *const lang = &languages[i];
+    struct corpus corpus = {0};
+    bool ok = false;
+    if (corpus_paths[i]) {
+      size_t len = 0;
+      char *const utf8 = read_file(corpus_paths[i], &len);
+      if (!utf8) {
+        fprintf(stderr, "failed to read %s\n", corpus_paths[i]);
+        goto cleanup;
+      }
+      ok = corpus_init(&corpus, utf8, len);
+    } else {
+      ok = corpus_init_sample(&corpus, lang->sample);
+    }
+    ok = ok && (!model_dir || bench_init(lang, model_dir, iterations, ns)) &&
+         bench_init_embedded(lang, iterations, ns) && bench_parse(lang, &corpus, &hw, iterations, ns);
+    corpus_destroy(&corpus);
+    if (!ok) {
+      goto cleanup;
+    }
+  }
+  ret = 0;
+cleanup:
+  hw_destroy(&hw);
+  return ret;
+}
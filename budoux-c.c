@@ -6,115 +6,549 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(BUDOUXC_COUNT_LOOKUPS) || defined(BUDOUXC_INSTRUMENT) || defined(__wasi__)
+#  include <stdatomic.h>
+#endif
+
+#if defined(BUDOUXC_INSTRUMENT) && !defined(_WIN32)
+#  include <time.h>
+#endif
+
+#if defined(_WIN32)
+#  define WIN32_LEAN_AND_MEAN
+#  include <windows.h>
+#elif !defined(__wasi__)
+#  include <fcntl.h>
+#  include <pthread.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
 // Unicode related functions ----
 
-static inline size_t first_byte_to_len(int const ch) {
-  if (ch <= 0x7f) {
+// utf8_decode converts UTF-8 a block at a time wherever the input allows it. A SIMD block is taken when it is all
+// ASCII, or a run of 3-byte or 2-byte sequences, which covers CJK, kana, Thai, Cyrillic and Greek text. The code points
+// of a block are checked for overlong and surrogate forms after decoding, and a block that is not accepted goes
+// through the scalar path one sequence at a time, so invalid input is rejected exactly as before.
+// x86 picks AVX2 or SSE4.1 blocks at runtime through cpuid. NEON is part of the AArch64 baseline, and simd128 is used
+// when WebAssembly is built with it. Other targets only take ASCII runs a block at a time.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#  include <immintrin.h>
+#  if defined(_MSC_VER)
+#    include <intrin.h>
+#  endif
+#  if defined(__GNUC__) || defined(__clang__)
+#    define SIMD_TARGET(isa) __attribute__((target(isa)))
+#  else
+#    define SIMD_TARGET(isa)
+#  endif
+#  define UTF8_SIMD_X86
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#  include <arm_neon.h>
+#  define UTF8_SIMD_NEON
+#elif defined(__wasm_simd128__)
+#  include <wasm_simd128.h>
+#  define UTF8_SIMD_WASM
+#endif
+
+// The block functions and utf8_sequence are inlined into each decoder, so that the loop keeps its constants in
+// registers and compiles for the instruction set of the decoder.
+#if defined(__GNUC__) || defined(__clang__)
+#  define ALWAYS_INLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#  define ALWAYS_INLINE __forceinline
+#else
+#  define ALWAYS_INLINE inline
+#endif
+
+static inline bool u8later(uint8_t const ch) { return (ch & 0xc0) == 0x80; }
+
+static inline bool invalid_codepoint(char32_t const ch) { return ch > 0x10ffff || (0xd800 <= ch && ch < 0xe000); }
+
+// Decodes the sequence at the start of src into *codepoint. Returns its length, or 0 if it is invalid or truncated.
+static ALWAYS_INLINE size_t utf8_sequence(uint8_t const *const src, size_t const len, char32_t *const codepoint) {
+  uint8_t const b0 = src[0];
+  char32_t ch = 0;
+  size_t ch_len = 0;
+  if (b0 < 0x80) {
+    *codepoint = b0;
     return 1;
+  } else if ((b0 & 0xe0) == 0xc0) {
+    ch_len = 2;
+    if (ch_len > len || !u8later(src[1]) || !(b0 & 0x1e)) {
+      return 0;
+    }
+    ch = ((char32_t)(b0 & 0x1f) << 6) | (src[1] & 0x3f);
+  } else if ((b0 & 0xf0) == 0xe0) {
+    ch_len = 3;
+    if (ch_len > len || !u8later(src[1]) || !u8later(src[2]) || (b0 == 0xe0 && !(src[1] & 0x20))) {
+      return 0;
+    }
+    ch = ((char32_t)(b0 & 0x0f) << 12) | ((char32_t)(src[1] & 0x3f) << 6) | (char32_t)(src[2] & 0x3f);
+  } else if ((b0 & 0xf8) == 0xf0) {
+    ch_len = 4;
+    if (ch_len > len || !u8later(src[1]) || !u8later(src[2]) || !u8later(src[3]) ||
+        (b0 & 0x07) + (src[1] & 0x30) == 0) {
+      return 0;
+    }
+    ch = ((char32_t)(b0 & 0x07) << 18) | ((char32_t)(src[1] & 0x3f) << 12) | ((char32_t)(src[2] & 0x3f) << 6) |
+         (char32_t)(src[3] & 0x3f);
+  } else {
+    return 0;
   }
-  if ((ch & 0xe0) == 0xc0) {
-    return 2;
+  if (invalid_codepoint(ch)) {
+    return 0;
   }
-  if ((ch & 0xf0) == 0xe0) {
-    return 3;
+  *codepoint = ch;
+  return ch_len;
+}
+
+#if !defined(UTF8_SIMD_NEON) && !defined(UTF8_SIMD_WASM)
+// The scalar decoder finds ASCII runs a block at a time. SSE2 is part of the x86-64 baseline; other targets test 8
+// bytes at once.
+#  if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define ASCII_BLOCK_SIZE 16
+static inline bool ascii_block(uint8_t const *const p) {
+  return _mm_movemask_epi8(_mm_loadu_si128((__m128i const *)(void const *)p)) == 0;
+}
+#  else
+#    define ASCII_BLOCK_SIZE 8
+static inline bool ascii_block(uint8_t const *const p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return (v & UINT64_C(0x8080808080808080)) == 0;
+}
+#  endif
+
+// Returns the number of leading ASCII bytes in src.
+static inline size_t ascii_prefix(uint8_t const *const src, size_t const len) {
+  size_t i = 0;
+  while (i + ASCII_BLOCK_SIZE <= len && ascii_block(src + i)) {
+    i += ASCII_BLOCK_SIZE;
   }
-  if ((ch & 0xf8) == 0xf0) {
-    return 4;
+  while (i < len && src[i] < 0x80) {
+    ++i;
   }
-  return 0;
+  return i;
 }
 
-static inline bool u8later(int const ch) { return (ch & 0xc0) == 0x80; }
+// Decodes src from *pos into at most dest_len code points, storing the byte offset of each code point into offsets
+// unless it is NULL. Stops at the end of src or when dest is full, and advances *pos past the decoded bytes.
+// Returns the number of decoded code points, or SIZE_MAX if src contains an invalid or truncated sequence.
+static size_t utf8_decode_scalar(char32_t *const dest,
+                                 size_t *const offsets,
+                                 size_t const dest_len,
+                                 uint8_t const *const src,
+                                 size_t const src_len,
+                                 size_t *const pos) {
+  size_t n = 0;
+  size_t i = *pos;
+  while (n < dest_len && i < src_len) {
+    if (src[i] < 0x80) {
+      size_t const rest = dest_len - n < src_len - i ? dest_len - n : src_len - i;
+      size_t const run = ascii_prefix(src + i, rest);
+      for (size_t k = 0; k < run; ++k) {
+        dest[n + k] = src[i + k];
+      }
+      if (offsets) {
+        for (size_t k = 0; k < run; ++k) {
+          offsets[n + k] = i + k;
+        }
+      }
+      n += run;
+      i += run;
+      continue;
+    }
+    size_t const ch_len = utf8_sequence(src + i, src_len - i, dest + n);
+    if (!ch_len) {
+      return SIZE_MAX;
+    }
+    if (offsets) {
+      offsets[n] = i;
+    }
+    ++n;
+    i += ch_len;
+  }
+  *pos = i;
+  return n;
+}
+#endif
 
-static inline bool invalid_codepoint(char32_t const ch) { return ch > 0x10ffff || (0xd800 <= ch && ch < 0xe000); }
+#if defined(UTF8_SIMD_X86) || defined(UTF8_SIMD_NEON) || defined(UTF8_SIMD_WASM)
+// The shuffles move four 3-byte sequences from the first 12 bytes of a block, or eight 2-byte sequences from 16 bytes,
+// into 32-bit lanes, last byte first. An index of 0x80 gives a zero byte on every instruction set used here. Each lane
+// is then checked for the lead and continuation bits and for overlong and surrogate forms, and a block is taken up to
+// its first lane that fails.
+static uint8_t const utf8_shuffle3[16] = {2, 1, 0, 0x80, 5, 4, 3, 0x80, 8, 7, 6, 0x80, 11, 10, 9, 0x80};
+static uint8_t const utf8_shuffle2[2][16] = {
+    {1, 0, 0x80, 0x80, 3, 2, 0x80, 0x80, 5, 4, 0x80, 0x80, 7, 6, 0x80, 0x80},
+    {9, 8, 0x80, 0x80, 11, 10, 0x80, 0x80, 13, 12, 0x80, 0x80, 15, 14, 0x80, 0x80},
+};
 
-static size_t
-utf8to32(char32_t *dest, size_t *byte_indices, size_t const dest_len, char const *const src, size_t const src_len) {
-  if (!src || !src_len) {
-    return 0;
+// Returns the number of consecutive set bits from bit 0.
+static inline size_t trailing_ones(uint64_t bits) {
+  static uint8_t const nibble[16] = {0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0, 4};
+  size_t n = 0;
+  while ((bits & 0xf) == 0xf) {
+    n += 4;
+    bits >>= 4;
   }
-  char32_t const *const dest_end = dest + dest_len;
-  uint8_t const *const u8 = (uint8_t const *)src;
-  size_t i = 0;
-  while (i < src_len) {
-    size_t const ch_len = first_byte_to_len(u8[i]);
-    if (!ch_len || i + ch_len > src_len) {
-      return 0;
-    }
-    char32_t codepoint = 0;
-    switch (ch_len) {
-    case 1:
-      codepoint = u8[i];
-      break;
-    case 2:
-      if (!u8later(u8[i + 1])) {
-        return 0;
-      }
-      if (!(u8[i] & 0x1e)) {
-        return 0;
-      }
-      codepoint = ((char32_t)(u8[i] & 0x1f) << 6) | (u8[i + 1] & 0x3f);
-      break;
-    case 3:
-      if (!u8later(u8[i + 1]) || !u8later(u8[i + 2])) {
-        return 0;
-      }
-      if ((u8[i] == 0xe0) && !(u8[i + 1] & 0x20)) {
-        return 0;
-      }
-      codepoint = ((char32_t)(u8[i] & 0x0f) << 12) | ((char32_t)(u8[i + 1] & 0x3f) << 6) | (char32_t)(u8[i + 2] & 0x3f);
-      break;
-    case 4:
-      if (!u8later(u8[i + 1]) || !u8later(u8[i + 2]) || !u8later(u8[i + 3])) {
-        return 0;
-      }
-      if ((u8[i] & 0x07) + (u8[i + 1] & 0x30) == 0) {
-        return 0;
-      }
-      codepoint = ((char32_t)(u8[i] & 0x07) << 18) | ((char32_t)(u8[i + 1] & 0x3f) << 12) |
-                  ((char32_t)(u8[i + 2] & 0x3f) << 6) | (char32_t)(u8[i + 3] & 0x3f);
-      break;
+  return n + nibble[bits & 0xf];
+}
+
+// A block function decodes the code points at the start of src into dest, which has room for room code points, and
+// returns how many it decoded with the byte length of each in *step. It may write past the decoded code points, up to
+// room. It returns 0 when the sequence at src does not start a block it accepts, and that sequence is left to
+// utf8_sequence. A block is only tried when the next sequence has the same length, so that a lone space or digit
+// between words does not cost a block.
+// IMPL_UTF8_DECODE builds a decoder around a block function, with the same contract as utf8_decode_scalar.
+#  define IMPL_UTF8_DECODE(attr, name, block)                                                                          \
+    attr static size_t name(char32_t *const dest,                                                                      \
+                            size_t *const offsets,                                                                     \
+                            size_t const dest_len,                                                                     \
+                            uint8_t const *const src,                                                                  \
+                            size_t const src_len,                                                                      \
+                            size_t *const pos) {                                                                       \
+      size_t n = 0;                                                                                                    \
+      size_t i = *pos;                                                                                                 \
+      while (n < dest_len && i < src_len) {                                                                            \
+        size_t step = 0;                                                                                               \
+        size_t k = block(dest + n, dest_len - n, src + i, src_len - i, &step);                                         \
+        if (!k) {                                                                                                      \
+          k = 1;                                                                                                       \
+          step = utf8_sequence(src + i, src_len - i, dest + n);                                                        \
+          if (!step) {                                                                                                 \
+            return SIZE_MAX;                                                                                           \
+          }                                                                                                            \
+        }                                                                                                              \
+        if (offsets) {                                                                                                 \
+          for (size_t j = 0; j < k; ++j) {                                                                             \
+            offsets[n + j] = i + j * step;                                                                             \
+          }                                                                                                            \
+        }                                                                                                              \
+        n += k;                                                                                                        \
+        i += k * step;                                                                                                 \
+      }                                                                                                                \
+      *pos = i;                                                                                                        \
+      return n;                                                                                                        \
     }
-    if (invalid_codepoint(codepoint)) {
-      return 0;
+#endif
+
+#if defined(UTF8_SIMD_X86)
+#  define LOAD128(p) _mm_loadu_si128((__m128i const *)(void const *)(p))
+#  define STORE128(p, v) _mm_storeu_si128((__m128i *)(void *)(p), (v))
+#  define LOAD256(p) _mm256_loadu_si256((__m256i const *)(void const *)(p))
+#  define STORE256(p, v) _mm256_storeu_si256((__m256i *)(void *)(p), (v))
+
+SIMD_TARGET("sse4.1")
+static ALWAYS_INLINE size_t utf8_block_sse41(
+    char32_t *const dest, size_t const room, uint8_t const *const src, size_t const len, size_t *const step) {
+  if (len < 16 || room < 16) {
+    return 0;
+  }
+  __m128i const v = LOAD128(src);
+  __m128i const low6 = _mm_set1_epi32(0x3f);
+  uint8_t const b0 = src[0];
+  if (b0 < 0x80 && src[1] < 0x80) {
+    STORE128(dest, _mm_cvtepu8_epi32(v));
+    STORE128(dest + 4, _mm_cvtepu8_epi32(_mm_srli_si128(v, 4)));
+    STORE128(dest + 8, _mm_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+    STORE128(dest + 12, _mm_cvtepu8_epi32(_mm_srli_si128(v, 12)));
+    unsigned const ascii = (unsigned)~_mm_movemask_epi8(v) & 0xffff;
+    *step = 1;
+    return ascii == 0xffff ? 16 : trailing_ones(ascii);
+  }
+  if ((b0 & 0xf0) == 0xe0 && (src[3] & 0xf0) == 0xe0) {
+    __m128i const t = _mm_shuffle_epi8(v, LOAD128(utf8_shuffle3));
+    __m128i const form = _mm_cmpeq_epi32(_mm_and_si128(t, _mm_set1_epi32(0xf0c0c0)), _mm_set1_epi32(0xe08080));
+    __m128i const cp =
+        _mm_or_si128(_mm_or_si128(_mm_and_si128(t, low6), _mm_srli_epi32(_mm_and_si128(t, _mm_set1_epi32(0x3f00)), 2)),
+                     _mm_srli_epi32(_mm_and_si128(t, _mm_set1_epi32(0x0f0000)), 4));
+    __m128i const surrogate = _mm_cmpeq_epi32(_mm_and_si128(cp, _mm_set1_epi32(0xf800)), _mm_set1_epi32(0xd800));
+    __m128i const bad = _mm_or_si128(_mm_cmplt_epi32(cp, _mm_set1_epi32(0x800)), surrogate);
+    STORE128(dest, cp);
+    unsigned const ok = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_andnot_si128(bad, form)));
+    *step = 3;
+    return ok == 0xf ? 4 : trailing_ones(ok);
+  }
+  if ((b0 & 0xe0) == 0xc0 && (src[2] & 0xe0) == 0xc0) {
+    __m128i const lo = _mm_shuffle_epi8(v, LOAD128(utf8_shuffle2[0]));
+    __m128i const hi = _mm_shuffle_epi8(v, LOAD128(utf8_shuffle2[1]));
+    __m128i const form_mask = _mm_set1_epi32(0xe0c0);
+    __m128i const form_bits = _mm_set1_epi32(0xc080);
+    __m128i const lo_cp =
+        _mm_or_si128(_mm_and_si128(lo, low6), _mm_srli_epi32(_mm_and_si128(lo, _mm_set1_epi32(0x1f00)), 2));
+    __m128i const hi_cp =
+        _mm_or_si128(_mm_and_si128(hi, low6), _mm_srli_epi32(_mm_and_si128(hi, _mm_set1_epi32(0x1f00)), 2));
+    __m128i const lo_ok = _mm_andnot_si128(_mm_cmplt_epi32(lo_cp, _mm_set1_epi32(0x80)),
+                                           _mm_cmpeq_epi32(_mm_and_si128(lo, form_mask), form_bits));
+    __m128i const hi_ok = _mm_andnot_si128(_mm_cmplt_epi32(hi_cp, _mm_set1_epi32(0x80)),
+                                           _mm_cmpeq_epi32(_mm_and_si128(hi, form_mask), form_bits));
+    STORE128(dest, lo_cp);
+    STORE128(dest + 4, hi_cp);
+    unsigned const ok =
+        (unsigned)_mm_movemask_ps(_mm_castsi128_ps(lo_ok)) | (unsigned)_mm_movemask_ps(_mm_castsi128_ps(hi_ok)) << 4;
+    *step = 2;
+    return ok == 0xff ? 8 : trailing_ones(ok);
+  }
+  return 0;
+}
+
+// AVX2 takes 32 bytes at a time, with the 3-byte sequences of the upper 128-bit lane loaded from 12 bytes in, and
+// leaves the end of the input to the SSE4.1 block.
+SIMD_TARGET("avx2")
+static ALWAYS_INLINE size_t utf8_block_avx2(
+    char32_t *const dest, size_t const room, uint8_t const *const src, size_t const len, size_t *const step) {
+  if (len < 32 || room < 32) {
+    return utf8_block_sse41(dest, room, src, len, step);
+  }
+  __m256i const v = LOAD256(src);
+  __m256i const low6 = _mm256_set1_epi32(0x3f);
+  uint8_t const b0 = src[0];
+  if (b0 < 0x80 && src[1] < 0x80) {
+    for (size_t k = 0; k < 32; k += 8) {
+      STORE256(dest + k, _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i const *)(void const *)(src + k))));
     }
-    if (dest_len) {
-      if (dest == dest_end) {
-        return 0;
-      }
-      *dest = codepoint;
-      if (byte_indices) {
-        *byte_indices++ = i;
+    uint32_t const ascii = ~(uint32_t)_mm256_movemask_epi8(v);
+    *step = 1;
+    return ascii == UINT32_MAX ? 32 : trailing_ones(ascii);
+  }
+  if ((b0 & 0xf0) == 0xe0 && (src[3] & 0xf0) == 0xe0) {
+    __m256i const v3 = _mm256_inserti128_si256(v, LOAD128(src + 12), 1);
+    __m256i const t = _mm256_shuffle_epi8(v3, _mm256_broadcastsi128_si256(LOAD128(utf8_shuffle3)));
+    __m256i const form =
+        _mm256_cmpeq_epi32(_mm256_and_si256(t, _mm256_set1_epi32(0xf0c0c0)), _mm256_set1_epi32(0xe08080));
+    __m256i const cp = _mm256_or_si256(
+        _mm256_or_si256(_mm256_and_si256(t, low6),
+                        _mm256_srli_epi32(_mm256_and_si256(t, _mm256_set1_epi32(0x3f00)), 2)),
+        _mm256_srli_epi32(_mm256_and_si256(t, _mm256_set1_epi32(0x0f0000)), 4));
+    __m256i const surrogate =
+        _mm256_cmpeq_epi32(_mm256_and_si256(cp, _mm256_set1_epi32(0xf800)), _mm256_set1_epi32(0xd800));
+    __m256i const bad = _mm256_or_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(0x800), cp), surrogate);
+    STORE256(dest, cp);
+    unsigned const ok = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_andnot_si256(bad, form)));
+    *step = 3;
+    return ok == 0xff ? 8 : trailing_ones(ok);
+  }
+  if ((b0 & 0xe0) == 0xc0 && (src[2] & 0xe0) == 0xc0) {
+    __m256i const lo = _mm256_shuffle_epi8(v, _mm256_broadcastsi128_si256(LOAD128(utf8_shuffle2[0])));
+    __m256i const hi = _mm256_shuffle_epi8(v, _mm256_broadcastsi128_si256(LOAD128(utf8_shuffle2[1])));
+    __m256i const form_mask = _mm256_set1_epi32(0xe0c0);
+    __m256i const form_bits = _mm256_set1_epi32(0xc080);
+    __m256i const lo_cp = _mm256_or_si256(_mm256_and_si256(lo, low6),
+                                          _mm256_srli_epi32(_mm256_and_si256(lo, _mm256_set1_epi32(0x1f00)), 2));
+    __m256i const hi_cp = _mm256_or_si256(_mm256_and_si256(hi, low6),
+                                          _mm256_srli_epi32(_mm256_and_si256(hi, _mm256_set1_epi32(0x1f00)), 2));
+    __m256i const lo_ok = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(0x80), lo_cp),
+                                              _mm256_cmpeq_epi32(_mm256_and_si256(lo, form_mask), form_bits));
+    __m256i const hi_ok = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_set1_epi32(0x80), hi_cp),
+                                              _mm256_cmpeq_epi32(_mm256_and_si256(hi, form_mask), form_bits));
+    // Each 128-bit lane holds code points 0-3 and 8-11 in lo, and 4-7 and 12-15 in hi.
+    STORE256(dest, _mm256_permute2x128_si256(lo_cp, hi_cp, 0x20));
+    STORE256(dest + 8, _mm256_permute2x128_si256(lo_cp, hi_cp, 0x31));
+    unsigned const lo_bits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(lo_ok));
+    unsigned const hi_bits = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(hi_ok));
+    unsigned const ok = (lo_bits & 0xf) | (hi_bits & 0xf) << 4 | (lo_bits & 0xf0) << 4 | (hi_bits & 0xf0) << 8;
+    *step = 2;
+    return ok == 0xffff ? 16 : trailing_ones(ok);
+  }
+  return 0;
+}
+
+IMPL_UTF8_DECODE(SIMD_TARGET("sse4.1"), utf8_decode_sse41, utf8_block_sse41)
+IMPL_UTF8_DECODE(SIMD_TARGET("avx2"), utf8_decode_avx2, utf8_block_avx2)
+
+enum simd_level {
+  simd_level_none,
+  simd_level_sse41,
+  simd_level_avx2,
+};
+
+static enum simd_level cpu_simd_level(void) {
+#  if defined(_MSC_VER)
+  static LONG volatile cached = -1;
+  LONG level = cached;
+  if (level < 0) {
+    int r[4];
+    __cpuid(r, 0);
+    int const max_leaf = r[0];
+    __cpuid(r, 1);
+    level = simd_level_none;
+    if (r[2] & (1 << 19)) {
+      level = simd_level_sse41;
+      // AVX2 also needs the OS to save the YMM registers.
+      bool const ymm = (r[2] & (1 << 27)) && (r[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+      if (ymm && max_leaf >= 7) {
+        __cpuidex(r, 7, 0);
+        if (r[1] & (1 << 5)) {
+          level = simd_level_avx2;
+        }
       }
     }
-    ++dest;
-    i += ch_len;
+    InterlockedExchange(&cached, level);
   }
-  return dest_len ? i : (size_t)(dest - dest_end);
+  return (enum simd_level)level;
+#  else
+  if (__builtin_cpu_supports("avx2")) {
+    return simd_level_avx2;
+  }
+  return __builtin_cpu_supports("sse4.1") ? simd_level_sse41 : simd_level_none;
+#  endif
 }
 
-// Allocator wrappers ----
+static size_t utf8_decode(char32_t *const dest,
+                          size_t *const offsets,
+                          size_t const dest_len,
+                          uint8_t const *const src,
+                          size_t const src_len,
+                          size_t *const pos) {
+  switch (cpu_simd_level()) {
+  case simd_level_avx2:
+    return utf8_decode_avx2(dest, offsets, dest_len, src, src_len, pos);
+  case simd_level_sse41:
+    return utf8_decode_sse41(dest, offsets, dest_len, src, src_len, pos);
+  case simd_level_none:
+    break;
+  }
+  return utf8_decode_scalar(dest, offsets, dest_len, src, src_len, pos);
+}
+#elif defined(UTF8_SIMD_NEON)
+static inline unsigned lane_bits(uint32x4_t const lanes) {
+  static uint32_t const bits[4] = {1, 2, 4, 8};
+  return vaddvq_u32(vandq_u32(lanes, vld1q_u32(bits)));
+}
 
-static void *hm_realloc(void *ptr, size_t size, void *user_data) {
-  struct budouxc_allocators const *const allocators = user_data;
-  return allocators->fn_realloc(ptr, size, allocators->user_data);
+static ALWAYS_INLINE size_t utf8_block_neon(
+    char32_t *const dest, size_t const room, uint8_t const *const src, size_t const len, size_t *const step) {
+  if (len < 16 || room < 16) {
+    return 0;
+  }
+  uint32_t *const out = (uint32_t *)(void *)dest;
+  uint8x16_t const v = vld1q_u8(src);
+  uint32x4_t const low6 = vdupq_n_u32(0x3f);
+  uint8_t const b0 = src[0];
+  if (b0 < 0x80 && src[1] < 0x80) {
+    uint16x8_t const lo = vmovl_u8(vget_low_u8(v));
+    uint16x8_t const hi = vmovl_high_u8(v);
+    vst1q_u32(out, vmovl_u16(vget_low_u16(lo)));
+    vst1q_u32(out + 4, vmovl_high_u16(lo));
+    vst1q_u32(out + 8, vmovl_u16(vget_low_u16(hi)));
+    vst1q_u32(out + 12, vmovl_high_u16(hi));
+    // Narrowing the byte mask leaves a nibble per byte.
+    uint8x8_t const ascii = vshrn_n_u16(vreinterpretq_u16_u8(vcltq_u8(v, vdupq_n_u8(0x80))), 4);
+    uint64_t const nibbles = vget_lane_u64(vreinterpret_u64_u8(ascii), 0);
+    *step = 1;
+    return nibbles == UINT64_MAX ? 16 : trailing_ones(nibbles) / 4;
+  }
+  if ((b0 & 0xf0) == 0xe0 && (src[3] & 0xf0) == 0xe0) {
+    uint32x4_t const t = vreinterpretq_u32_u8(vqtbl1q_u8(v, vld1q_u8(utf8_shuffle3)));
+    uint32x4_t const form = vceqq_u32(vandq_u32(t, vdupq_n_u32(0xf0c0c0)), vdupq_n_u32(0xe08080));
+    uint32x4_t const cp = vorrq_u32(vorrq_u32(vandq_u32(t, low6), vshrq_n_u32(vandq_u32(t, vdupq_n_u32(0x3f00)), 2)),
+                                    vshrq_n_u32(vandq_u32(t, vdupq_n_u32(0x0f0000)), 4));
+    uint32x4_t const surrogate = vceqq_u32(vandq_u32(cp, vdupq_n_u32(0xf800)), vdupq_n_u32(0xd800));
+    uint32x4_t const bad = vorrq_u32(vcltq_u32(cp, vdupq_n_u32(0x800)), surrogate);
+    vst1q_u32(out, cp);
+    unsigned const ok = lane_bits(vbicq_u32(form, bad));
+    *step = 3;
+    return ok == 0xf ? 4 : trailing_ones(ok);
+  }
+  if ((b0 & 0xe0) == 0xc0 && (src[2] & 0xe0) == 0xc0) {
+    uint32x4_t const lo = vreinterpretq_u32_u8(vqtbl1q_u8(v, vld1q_u8(utf8_shuffle2[0])));
+    uint32x4_t const hi = vreinterpretq_u32_u8(vqtbl1q_u8(v, vld1q_u8(utf8_shuffle2[1])));
+    uint32x4_t const form_mask = vdupq_n_u32(0xe0c0);
+    uint32x4_t const form_bits = vdupq_n_u32(0xc080);
+    uint32x4_t const lo_cp = vorrq_u32(vandq_u32(lo, low6), vshrq_n_u32(vandq_u32(lo, vdupq_n_u32(0x1f00)), 2));
+    uint32x4_t const hi_cp = vorrq_u32(vandq_u32(hi, low6), vshrq_n_u32(vandq_u32(hi, vdupq_n_u32(0x1f00)), 2));
+    uint32x4_t const lo_ok =
+        vbicq_u32(vceqq_u32(vandq_u32(lo, form_mask), form_bits), vcltq_u32(lo_cp, vdupq_n_u32(0x80)));
+    uint32x4_t const hi_ok =
+        vbicq_u32(vceqq_u32(vandq_u32(hi, form_mask), form_bits), vcltq_u32(hi_cp, vdupq_n_u32(0x80)));
+    vst1q_u32(out, lo_cp);
+    vst1q_u32(out + 4, hi_cp);
+    unsigned const ok = lane_bits(lo_ok) | lane_bits(hi_ok) << 4;
+    *step = 2;
+    return ok == 0xff ? 8 : trailing_ones(ok);
+  }
+  return 0;
 }
 
-static void hm_free(void *ptr, void *user_data) {
-  struct budouxc_allocators const *const allocators = user_data;
-  allocators->fn_free(ptr, allocators->user_data);
+IMPL_UTF8_DECODE(, utf8_decode, utf8_block_neon)
+#elif defined(UTF8_SIMD_WASM)
+static ALWAYS_INLINE size_t utf8_block_simd128(
+    char32_t *const dest, size_t const room, uint8_t const *const src, size_t const len, size_t *const step) {
+  if (len < 16 || room < 16) {
+    return 0;
+  }
+  v128_t const v = wasm_v128_load(src);
+  v128_t const low6 = wasm_i32x4_splat(0x3f);
+  uint8_t const b0 = src[0];
+  if (b0 < 0x80 && src[1] < 0x80) {
+    v128_t const lo = wasm_u16x8_extend_low_u8x16(v);
+    v128_t const hi = wasm_u16x8_extend_high_u8x16(v);
+    wasm_v128_store(dest, wasm_u32x4_extend_low_u16x8(lo));
+    wasm_v128_store(dest + 4, wasm_u32x4_extend_high_u16x8(lo));
+    wasm_v128_store(dest + 8, wasm_u32x4_extend_low_u16x8(hi));
+    wasm_v128_store(dest + 12, wasm_u32x4_extend_high_u16x8(hi));
+    uint32_t const ascii = ~wasm_i8x16_bitmask(v) & 0xffff;
+    *step = 1;
+    return ascii == 0xffff ? 16 : trailing_ones(ascii);
+  }
+  if ((b0 & 0xf0) == 0xe0 && (src[3] & 0xf0) == 0xe0) {
+    v128_t const t = wasm_i8x16_swizzle(v, wasm_v128_load(utf8_shuffle3));
+    v128_t const form = wasm_i32x4_eq(wasm_v128_and(t, wasm_i32x4_splat(0xf0c0c0)), wasm_i32x4_splat(0xe08080));
+    v128_t const cp = wasm_v128_or(
+        wasm_v128_or(wasm_v128_and(t, low6), wasm_u32x4_shr(wasm_v128_and(t, wasm_i32x4_splat(0x3f00)), 2)),
+        wasm_u32x4_shr(wasm_v128_and(t, wasm_i32x4_splat(0x0f0000)), 4));
+    v128_t const surrogate = wasm_i32x4_eq(wasm_v128_and(cp, wasm_i32x4_splat(0xf800)), wasm_i32x4_splat(0xd800));
+    v128_t const bad = wasm_v128_or(wasm_u32x4_lt(cp, wasm_i32x4_splat(0x800)), surrogate);
+    wasm_v128_store(dest, cp);
+    uint32_t const ok = wasm_i32x4_bitmask(wasm_v128_andnot(form, bad));
+    *step = 3;
+    return ok == 0xf ? 4 : trailing_ones(ok);
+  }
+  if ((b0 & 0xe0) == 0xc0 && (src[2] & 0xe0) == 0xc0) {
+    v128_t const lo = wasm_i8x16_swizzle(v, wasm_v128_load(utf8_shuffle2[0]));
+    v128_t const hi = wasm_i8x16_swizzle(v, wasm_v128_load(utf8_shuffle2[1]));
+    v128_t const form_mask = wasm_i32x4_splat(0xe0c0);
+    v128_t const form_bits = wasm_i32x4_splat(0xc080);
+    v128_t const lo_cp =
+        wasm_v128_or(wasm_v128_and(lo, low6), wasm_u32x4_shr(wasm_v128_and(lo, wasm_i32x4_splat(0x1f00)), 2));
+    v128_t const hi_cp =
+        wasm_v128_or(wasm_v128_and(hi, low6), wasm_u32x4_shr(wasm_v128_and(hi, wasm_i32x4_splat(0x1f00)), 2));
+    v128_t const lo_ok = wasm_v128_andnot(wasm_i32x4_eq(wasm_v128_and(lo, form_mask), form_bits),
+                                          wasm_u32x4_lt(lo_cp, wasm_i32x4_splat(0x80)));
+    v128_t const hi_ok = wasm_v128_andnot(wasm_i32x4_eq(wasm_v128_and(hi, form_mask), form_bits),
+                                          wasm_u32x4_lt(hi_cp, wasm_i32x4_splat(0x80)));
+    wasm_v128_store(dest, lo_cp);
+    wasm_v128_store(dest + 4, hi_cp);
+    uint32_t const ok = wasm_i32x4_bitmask(lo_ok) | wasm_i32x4_bitmask(hi_ok) << 4;
+    *step = 2;
+    return ok == 0xff ? 8 : trailing_ones(ok);
+  }
+  return 0;
 }
 
-static void *json_alloc(size_t size, int zero, void *user_data) {
+IMPL_UTF8_DECODE(, utf8_decode, utf8_block_simd128)
+#else
+static inline size_t utf8_decode(char32_t *const dest,
+                                 size_t *const offsets,
+                                 size_t const dest_len,
+                                 uint8_t const *const src,
+                                 size_t const src_len,
+                                 size_t *const pos) {
+  return utf8_decode_scalar(dest, offsets, dest_len, src, src_len, pos);
+}
+#endif
+
+// Allocator wrappers ----
+
+static void *hm_realloc(void *ptr, size_t size, void *user_data) {
   struct budouxc_allocators const *const allocators = user_data;
-  void *ptr = allocators->fn_realloc(NULL, size, allocators->user_data);
-  if (ptr && zero) {
-    memset(ptr, 0, size);
-  }
-  return ptr;
+  return allocators->fn_realloc(ptr, size, allocators->user_data);
 }
 
-static void json_free(void *ptr, void *user_data) {
+static void hm_free(void *ptr, void *user_data) {
   struct budouxc_allocators const *const allocators = user_data;
   allocators->fn_free(ptr, allocators->user_data);
 }
@@ -128,495 +562,4306 @@ static void free_default(void *ptr, void *user_data) {
   free(ptr);
 }
 
-#ifdef __GNUC__
-#  ifndef __has_warning
-#    define __has_warning(x) 0
-#  endif
-#  pragma GCC diagnostic push
-#  if __has_warning("-Wreserved-macro-identifier")
-#    pragma GCC diagnostic ignored "-Wreserved-macro-identifier"
-#  endif
-#  if __has_warning("-Wreserved-identifier")
-#    pragma GCC diagnostic ignored "-Wreserved-identifier"
-#  endif
-#  if __has_warning("-Wreserved-id-macro")
-#    pragma GCC diagnostic ignored "-Wreserved-id-macro"
-#  endif
-#endif // __GNUC__
-
-#include <json.h>
+// An arena collects the scratch memory of one call, such as the work lists of the batch and parallel parsers, and
+// releases all of it in arena_destroy.
 
-#ifdef __GNUC__
-#  pragma GCC diagnostic pop
-#endif // __GNUC__
+struct arena_block {
+  struct arena_block *prev;
+  max_align_t data[];
+};
 
-#include <hashmap.h>
+struct arena {
+  struct budouxc_allocators const *allocators;
+  struct arena_block *head;
+};
 
-#define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
-#define FLOAT_TYPE float
+static struct arena arena_new(struct budouxc_allocators const *const allocators) {
+  return (struct arena){
+      .allocators = allocators,
+  };
+}
 
-struct unigram {
-  char32_t key[1];
-  int32_t value;
-};
+static void *arena_alloc(struct arena *const a, size_t const size) {
+  struct arena_block *const b =
+      a->allocators->fn_realloc(NULL, sizeof(struct arena_block) + size, a->allocators->user_data);
+  if (!b) {
+    return NULL;
+  }
+  b->prev = a->head;
+  a->head = b;
+  return b->data;
+}
 
-struct bigram {
-  char32_t key[2];
-  int32_t value;
-};
+static void arena_destroy(struct arena *const a) {
+  for (struct arena_block *b = a->head; b;) {
+    struct arena_block *const prev = b->prev;
+    a->allocators->fn_free(b, a->allocators->user_data);
+    b = prev;
+  }
+  a->head = NULL;
+}
 
-struct trigram {
-  char32_t key[3];
-  int32_t value;
-};
+// File mapping ----
 
-struct budouxc {
-  struct budouxc_allocators allocators;
-  struct hashmap *uni[6];
-  struct hashmap *bi[3];
-  struct hashmap *tri[4];
-  int32_t sum;
-};
+#if defined(_WIN32)
 
-#define IMPL_BUILD_MAP(typ)                                                                                            \
-  static int typ##_compare(void const *const a, void const *const b, void *const udata) {                              \
-    (void)udata;                                                                                                       \
-    struct typ const *const aa = a;                                                                                    \
-    struct typ const *const bb = b;                                                                                    \
-    return memcmp(&aa->key, &bb->key, sizeof(aa->key));                                                                \
-  }                                                                                                                    \
-  static uint64_t typ##_hash(void const *const item, uint64_t const seed0, uint64_t const seed1, void *const udata) {  \
-    (void)udata;                                                                                                       \
-    struct typ const *const i = item;                                                                                  \
-    return hashmap_sip(&i->key, sizeof(i->key), seed0, seed1);                                                         \
-  }                                                                                                                    \
-  static struct hashmap *build_##typ##_map(                                                                            \
-      json_value const *const obj, struct budouxc_allocators *const allocators, char *const error128) {                \
-    struct typ g = {0};                                                                                                \
-    struct hashmap *map = NULL;                                                                                        \
-    size_t const n = ARRAY_SIZE(g.key);                                                                                \
-    map = hashmap_new_with_allocator(                                                                                  \
-        hm_realloc, hm_free, sizeof(struct typ), 0, 0, 0, typ##_hash, typ##_compare, NULL, allocators);                \
-    for (unsigned int i = 0, len = obj->u.object.length; i < len; ++i) {                                               \
-      if (obj->u.object.values[i].value->type != json_integer) {                                                       \
-        strcpy(error128, "Invalid JSON structure");                                                                    \
-        goto failed;                                                                                                   \
-      }                                                                                                                \
-      size_t const written =                                                                                           \
-          utf8to32(&g.key[0], NULL, n, obj->u.object.values[i].name, obj->u.object.values[i].name_length);             \
-      if (written < n) {                                                                                               \
-        if (!written) {                                                                                                \
-          sprintf(error128, "Failed to convert to codepoint(s): %s", obj->u.object.values[i].name);                    \
-          goto failed;                                                                                                 \
-        }                                                                                                              \
-        memset((&g.key[0]) + written, 0, (n - written) * sizeof(g.key[0]));                                            \
-      }                                                                                                                \
-      g.value = (int32_t)(obj->u.object.values[i].value->u.integer);                                                   \
-      if (hashmap_set(map, &g) == NULL && hashmap_oom(map)) {                                                          \
-        strcpy(error128, "Out of memory");                                                                             \
-        goto failed;                                                                                                   \
-      }                                                                                                                \
-    }                                                                                                                  \
-    return map;                                                                                                        \
-  failed:                                                                                                              \
-    hashmap_free(map);                                                                                                 \
-    return false;                                                                                                      \
-  }                                                                                                                    \
-  static struct hashmap *build_##typ##_map(                                                                            \
-      json_value const *const obj, struct budouxc_allocators *const allocators, char *const error128)
+static void *map_file(char const *const path,
+                      size_t *const size,
+                      struct budouxc_allocators const *const allocators,
+                      char *const error128) {
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = NULL;
+  void *ptr = NULL;
+  int const wlen = MultiByteToWideChar(CP_UTF8, 0, path, -1, NULL, 0);
+  wchar_t *const wpath =
+      wlen > 0 ? allocators->fn_realloc(NULL, (size_t)wlen * sizeof(wchar_t), allocators->user_data) : NULL;
+  if (!wpath || MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, wlen) != wlen) {
+    strcpy(error128, "Invalid path");
+    goto cleanup;
+  }
+  file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) {
+    sprintf(error128, "Failed to open %.96s", path);
+    goto cleanup;
+  }
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart <= 0 || (uint64_t)file_size.QuadPart > SIZE_MAX) {
+    strcpy(error128, "Failed to get file size");
+    goto cleanup;
+  }
+  mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (!mapping) {
+    strcpy(error128, "Failed to map file");
+    goto cleanup;
+  }
+  ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!ptr) {
+    strcpy(error128, "Failed to map file");
+    goto cleanup;
+  }
+  *size = (size_t)file_size.QuadPart;
+cleanup:
+  if (mapping) {
+    CloseHandle(mapping);
+  }
+  if (file != INVALID_HANDLE_VALUE) {
+    CloseHandle(file);
+  }
+  if (wpath) {
+    allocators->fn_free(wpath, allocators->user_data);
+  }
+  return ptr;
+}
 
-IMPL_BUILD_MAP(unigram);
-IMPL_BUILD_MAP(bigram);
-IMPL_BUILD_MAP(trigram);
+static void unmap_file(void *const ptr, size_t const size, struct budouxc_allocators const *const allocators) {
+  (void)size;
+  (void)allocators;
+  UnmapViewOfFile(ptr);
+}
 
-#undef IMPL_BUILD_MAP
+#elif defined(__wasi__)
 
-void BUDOUXC_DECLSPEC budouxc_destroy(struct budouxc *const model) {
-  if (!model) {
-    return;
+// WASI has no mmap, so the file is read into memory instead.
+static void *map_file(char const *const path,
+                      size_t *const size,
+                      struct budouxc_allocators const *const allocators,
+                      char *const error128) {
+  void *ptr = NULL;
+  FILE *const f = fopen(path, "rb");
+  if (!f) {
+    sprintf(error128, "Failed to open %.96s", path);
+    return NULL;
   }
-  for (size_t i = 0; i < ARRAY_SIZE(model->uni); ++i) {
-    hashmap_free(model->uni[i]);
-    model->uni[i] = NULL;
+  long len = 0;
+  if (fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) <= 0 || fseek(f, 0, SEEK_SET) != 0) {
+    strcpy(error128, "Failed to get file size");
+    goto cleanup;
   }
-  for (size_t i = 0; i < ARRAY_SIZE(model->bi); ++i) {
-    hashmap_free(model->bi[i]);
-    model->bi[i] = NULL;
+  ptr = allocators->fn_realloc(NULL, (size_t)len, allocators->user_data);
+  if (!ptr) {
+    strcpy(error128, "Out of memory");
+    goto cleanup;
   }
-  for (size_t i = 0; i < ARRAY_SIZE(model->tri); ++i) {
-    hashmap_free(model->tri[i]);
-    model->tri[i] = NULL;
+  if (fread(ptr, 1, (size_t)len, f) != (size_t)len) {
+    strcpy(error128, "Failed to read file");
+    allocators->fn_free(ptr, allocators->user_data);
+    ptr = NULL;
+    goto cleanup;
   }
-  model->allocators.fn_free(model, model->allocators.user_data);
+  *size = (size_t)len;
+cleanup:
+  fclose(f);
+  return ptr;
 }
 
-struct budouxc *BUDOUXC_DECLSPEC budouxc_init(struct budouxc_allocators const *const allocators,
-                                              char const *const json,
-                                              size_t const json_len,
-                                              char *error128) {
-  struct budouxc *model = NULL;
-  json_value *root = NULL;
-
-  struct budouxc_allocators a = allocators ? *allocators
-                                           : (struct budouxc_allocators){
-                                                 .fn_realloc = realloc_default,
-                                                 .fn_free = free_default,
-                                             };
-  json_settings settings = {
-      .mem_alloc = json_alloc,
-      .mem_free = json_free,
-      .user_data = &a,
-  };
+static void unmap_file(void *const ptr, size_t const size, struct budouxc_allocators const *const allocators) {
+  (void)size;
+  allocators->fn_free(ptr, allocators->user_data);
+}
 
-  if (!json || !json_len) {
-    strcpy(error128, "Invalid arguments");
+#else
+
+static void *map_file(char const *const path,
+                      size_t *const size,
+                      struct budouxc_allocators const *const allocators,
+                      char *const error128) {
+  (void)allocators;
+  void *ptr = NULL;
+  int const fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    sprintf(error128, "Failed to open %.96s", path);
     return NULL;
   }
+  struct stat st;
+  if (fstat(fd, &st) == -1 || st.st_size <= 0) {
+    strcpy(error128, "Failed to get file size");
+    goto cleanup;
+  }
+  ptr = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (ptr == MAP_FAILED) {
+    ptr = NULL;
+    strcpy(error128, "Failed to map file");
+    goto cleanup;
+  }
+  *size = (size_t)st.st_size;
+cleanup:
+  close(fd);
+  return ptr;
+}
 
-  model = a.fn_realloc(NULL, sizeof(struct budouxc), a.user_data);
-  if (!model) {
+static void unmap_file(void *const ptr, size_t const size, struct budouxc_allocators const *const allocators) {
+  (void)allocators;
+  munmap(ptr, size);
+}
+
+#endif
+
+// Threads ----
+
+// Work is split by parallel_for into one contiguous range of items per worker. A worker takes items from the front of
+// its own range, and once it runs dry it steals the back half of the largest remaining range, so that uneven items do
+// not leave threads idle. Workers are started by the hooks registered with budouxc_set_thread_hooks if there are any,
+// and by the threads of the platform otherwise. WASI has no threads of its own, so without hooks everything runs on the
+// calling thread there, and the locks spin on an atomic flag in case the hooks run tasks on WASI threads.
+
+#if defined(_WIN32)
+
+typedef SRWLOCK mutex;
+#  define MUTEX_INITIALIZER SRWLOCK_INIT
+static void mutex_init(mutex *const m) { InitializeSRWLock(m); }
+static void mutex_exit(mutex *const m) { (void)m; }
+static void mutex_lock(mutex *const m) { AcquireSRWLockExclusive(m); }
+static void mutex_unlock(mutex *const m) { ReleaseSRWLockExclusive(m); }
+
+typedef HANDLE thread;
+struct thread_start {
+  void (*fn)(void *arg);
+  void *arg;
+};
+static DWORD WINAPI thread_main(LPVOID param) {
+  struct thread_start const *const ts = param;
+  ts->fn(ts->arg);
+  return 0;
+}
+static bool thread_create(thread *const t, struct thread_start *const ts) {
+  *t = CreateThread(NULL, 0, thread_main, ts, 0, NULL);
+  return *t != NULL;
+}
+static void thread_join(thread const t) {
+  WaitForSingleObject(t, INFINITE);
+  CloseHandle(t);
+}
+
+#elif defined(__wasi__)
+
+#  define BUDOUXC_NO_THREADS
+
+typedef atomic_flag mutex;
+#  define MUTEX_INITIALIZER ATOMIC_FLAG_INIT
+static void mutex_init(mutex *const m) { atomic_flag_clear(m); }
+static void mutex_exit(mutex *const m) { (void)m; }
+static void mutex_lock(mutex *const m) {
+  while (atomic_flag_test_and_set_explicit(m, memory_order_acquire)) {
+  }
+}
+static void mutex_unlock(mutex *const m) { atomic_flag_clear_explicit(m, memory_order_release); }
+
+#else
+
+typedef pthread_mutex_t mutex;
+#  define MUTEX_INITIALIZER PTHREAD_MUTEX_INITIALIZER
+static void mutex_init(mutex *const m) { pthread_mutex_init(m, NULL); }
+static void mutex_exit(mutex *const m) { pthread_mutex_destroy(m); }
+static void mutex_lock(mutex *const m) { pthread_mutex_lock(m); }
+static void mutex_unlock(mutex *const m) { pthread_mutex_unlock(m); }
+
+typedef pthread_t thread;
+struct thread_start {
+  void (*fn)(void *arg);
+  void *arg;
+};
+static void *thread_main(void *param) {
+  struct thread_start const *const ts = param;
+  ts->fn(ts->arg);
+  return NULL;
+}
+static bool thread_create(thread *const t, struct thread_start *const ts) {
+  return pthread_create(t, NULL, thread_main, ts) == 0;
+}
+static void thread_join(thread const t) { pthread_join(t, NULL); }
+
+#endif
+
+static struct budouxc_thread_hooks thread_hooks;
+
+// Returns how many of the requested threads can be started, which is only the calling thread on a platform without
+// threads unless hooks are registered.
+static size_t usable_threads(size_t const threads) {
+#ifdef BUDOUXC_NO_THREADS
+  if (!thread_hooks.spawn) {
+    return 1;
+  }
+#endif
+  return threads;
+}
+
+struct work_range {
+  mutex mtx;
+  size_t begin;
+  size_t end;
+};
+
+struct parallel_job {
+  struct work_range *ranges;
+  size_t workers;
+  bool (*fn)(void *ctx, size_t worker, size_t item);
+  void *ctx;
+  // Copied when the job starts, so that every worker is joined by the hooks that spawned it.
+  struct budouxc_thread_hooks hooks;
+};
+
+struct parallel_worker {
+  struct parallel_job *job;
+  size_t id;
+  bool failed;
+  bool started;
+  void *task;
+#ifndef BUDOUXC_NO_THREADS
+  struct thread_start start;
+  thread th;
+#endif
+};
+
+static bool work_range_pop(struct work_range *const r, size_t *const item) {
+  mutex_lock(&r->mtx);
+  bool const ok = r->begin < r->end;
+  if (ok) {
+    *item = r->begin++;
+  }
+  mutex_unlock(&r->mtx);
+  return ok;
+}
+
+static bool work_range_steal(struct parallel_job *const job, size_t const self) {
+  for (;;) {
+    size_t victim = SIZE_MAX;
+    size_t most = 0;
+    for (size_t i = 0; i < job->workers; ++i) {
+      struct work_range *const r = &job->ranges[i];
+      mutex_lock(&r->mtx);
+      size_t const remaining = r->end - r->begin;
+      mutex_unlock(&r->mtx);
+      if (i != self && remaining > most) {
+        most = remaining;
+        victim = i;
+      }
+    }
+    if (victim == SIZE_MAX) {
+      return false;
+    }
+    struct work_range *const r = &job->ranges[victim];
+    mutex_lock(&r->mtx);
+    size_t const begin = r->begin + (r->end - r->begin) / 2;
+    size_t const end = r->end;
+    r->end = begin;
+    mutex_unlock(&r->mtx);
+    if (begin < end) {
+      struct work_range *const own = &job->ranges[self];
+      mutex_lock(&own->mtx);
+      own->begin = begin;
+      own->end = end;
+      mutex_unlock(&own->mtx);
+      return true;
+    }
+    // The victim finished in the meantime, so look again.
+  }
+}
+
+static void parallel_worker_run(void *arg) {
+  struct parallel_worker *const w = arg;
+  struct parallel_job *const job = w->job;
+  size_t item;
+  do {
+    while (work_range_pop(&job->ranges[w->id], &item)) {
+      if (!job->fn(job->ctx, w->id, item)) {
+        w->failed = true;
+        return;
+      }
+    }
+  } while (work_range_steal(job, w->id));
+}
+
+static bool parallel_worker_start(struct parallel_worker *const w) {
+  struct budouxc_thread_hooks const *const hooks = &w->job->hooks;
+  if (hooks->spawn) {
+    w->task = hooks->spawn(parallel_worker_run, w, hooks->userdata);
+    return w->task != NULL;
+  }
+#ifdef BUDOUXC_NO_THREADS
+  return false;
+#else
+  w->start = (struct thread_start){
+      .fn = parallel_worker_run,
+      .arg = w,
+  };
+  return thread_create(&w->th, &w->start);
+#endif
+}
+
+static void parallel_worker_join(struct parallel_worker *const w) {
+  struct budouxc_thread_hooks const *const hooks = &w->job->hooks;
+  if (hooks->spawn) {
+    hooks->join(w->task, hooks->userdata);
+    return;
+  }
+#ifndef BUDOUXC_NO_THREADS
+  thread_join(w->th);
+#endif
+}
+
+// Calls fn once for every item in [0, n) on up to `threads` threads including the calling thread. fn receives the index
+// of the worker running it, which is below the returned worker count, so that it can keep per-worker state.
+// Returns false if any call to fn failed. If a thread cannot be created, its items are stolen by the others.
+// The state of the workers is allocated from scratch, which the caller releases.
+static bool parallel_for(struct arena *const scratch,
+                         size_t const n,
+                         size_t threads,
+                         bool (*fn)(void *ctx, size_t worker, size_t item),
+                         void *const ctx,
+                         char *const error128) {
+  threads = usable_threads(threads);
+  if (threads > n) {
+    threads = n;
+  }
+  if (threads <= 1) {
+    for (size_t i = 0; i < n; ++i) {
+      if (!fn(ctx, 0, i)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  struct work_range *const ranges =
+      arena_alloc(scratch, threads * (sizeof(struct work_range) + sizeof(struct parallel_worker)));
+  if (!ranges) {
+    strcpy(error128, "Out of memory");
+    return false;
+  }
+  struct parallel_worker *const workers = (void *)(ranges + threads);
+  struct parallel_job job = {
+      .ranges = ranges,
+      .workers = threads,
+      .fn = fn,
+      .ctx = ctx,
+      .hooks = thread_hooks,
+  };
+  for (size_t i = 0; i < threads; ++i) {
+    mutex_init(&ranges[i].mtx);
+    ranges[i].begin = n * i / threads;
+    ranges[i].end = n * (i + 1) / threads;
+    workers[i] = (struct parallel_worker){
+        .job = &job,
+        .id = i,
+    };
+  }
+  for (size_t i = 1; i < threads; ++i) {
+    workers[i].started = parallel_worker_start(&workers[i]);
+  }
+  parallel_worker_run(&workers[0]);
+  bool ok = !workers[0].failed;
+  for (size_t i = 1; i < threads; ++i) {
+    if (workers[i].started) {
+      parallel_worker_join(&workers[i]);
+    }
+    ok = ok && !workers[i].failed;
+  }
+  for (size_t i = 0; i < threads; ++i) {
+    mutex_exit(&ranges[i].mtx);
+  }
+  return ok;
+}
+
+bool BUDOUXC_DECLSPEC budouxc_set_thread_hooks(struct budouxc_thread_hooks const *const hooks) {
+  if (hooks && !hooks->spawn != !hooks->join) {
+    return false;
+  }
+  thread_hooks = hooks ? *hooks : (struct budouxc_thread_hooks){0};
+  return true;
+}
+
+// Instrumentation ----
+
+// Building with BUDOUXC_INSTRUMENT times the phases of model initialization and every parse call into process-wide
+// histograms, and passes each measurement to the registered sink. Otherwise instrument_now returns 0 and the other
+// functions do nothing, so that the calls compile away.
+
+#ifdef BUDOUXC_INSTRUMENT
+
+struct histogram {
+  atomic_ullong count;
+  atomic_ullong sum;
+  atomic_ullong buckets[BUDOUXC_HISTOGRAM_BUCKETS];
+};
+
+static struct histogram instrument_init_phases[budouxc_init_phases];
+static struct histogram instrument_latency[budouxc_entry_points];
+static struct histogram instrument_cost[budouxc_entry_points];
+static struct budouxc_instrument_sink instrument_sink;
+
+static void histogram_add(struct histogram *const h, uint64_t const v) {
+  size_t bucket = 0;
+  for (uint64_t x = v; x && bucket < BUDOUXC_HISTOGRAM_BUCKETS - 1; x >>= 1) {
+    ++bucket;
+  }
+  atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->sum, v, memory_order_relaxed);
+  atomic_fetch_add_explicit(&h->buckets[bucket], 1, memory_order_relaxed);
+}
+
+static uint64_t histogram_read(atomic_ullong *const v, bool const reset) {
+  return reset ? atomic_exchange_explicit(v, 0, memory_order_relaxed) : atomic_load_explicit(v, memory_order_relaxed);
+}
+
+static void histogram_copy(struct budouxc_histogram *const dest, struct histogram *const h, bool const reset) {
+  dest->count = histogram_read(&h->count, reset);
+  dest->sum = histogram_read(&h->sum, reset);
+  for (size_t i = 0; i < BUDOUXC_HISTOGRAM_BUCKETS; ++i) {
+    dest->buckets[i] = histogram_read(&h->buckets[i], reset);
+  }
+}
+
+#  ifdef _WIN32
+// The frequency of the performance counter is fixed at boot, so it is queried once. Threads that race to query it
+// store the same value.
+static atomic_ullong instrument_frequency;
+#  endif
+
+#endif
+
+static inline uint64_t instrument_now(void) {
+#if !defined(BUDOUXC_INSTRUMENT)
+  return 0;
+#elif defined(_WIN32)
+  uint64_t f = atomic_load_explicit(&instrument_frequency, memory_order_relaxed);
+  if (!f) {
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    f = (uint64_t)freq.QuadPart;
+    atomic_store_explicit(&instrument_frequency, f, memory_order_relaxed);
+  }
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  uint64_t const n = (uint64_t)now.QuadPart;
+  return n / f * UINT64_C(1000000000) + n % f * UINT64_C(1000000000) / f;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline uint64_t instrument_since(uint64_t const start) {
+#ifdef BUDOUXC_INSTRUMENT
+  return instrument_now() - start;
+#else
+  (void)start;
+  return 0;
+#endif
+}
+
+static inline void instrument_init_phase(enum budouxc_init_phase const phase, uint64_t const ns) {
+#ifdef BUDOUXC_INSTRUMENT
+  histogram_add(&instrument_init_phases[phase], ns);
+  if (instrument_sink.init_phase) {
+    instrument_sink.init_phase(phase, ns, instrument_sink.userdata);
+  }
+#else
+  (void)phase;
+  (void)ns;
+#endif
+}
+
+static inline void
+instrument_parse(enum budouxc_entry_point const entry_point, uint64_t const start, size_t const code_points) {
+#ifdef BUDOUXC_INSTRUMENT
+  uint64_t const ns = instrument_since(start);
+  histogram_add(&instrument_latency[entry_point], ns);
+  if (code_points) {
+    histogram_add(&instrument_cost[entry_point], ns * 1000 / code_points);
+  }
+  if (instrument_sink.parse) {
+    instrument_sink.parse(entry_point, ns, code_points, instrument_sink.userdata);
+  }
+#else
+  (void)entry_point;
+  (void)start;
+  (void)code_points;
+#endif
+}
+
+// The UTF-8 variant counts code points, which is only worth doing when they are recorded.
+static inline void instrument_parse_utf8(enum budouxc_entry_point const entry_point,
+                                         uint64_t const start,
+                                         char const *const sentence,
+                                         size_t const sentence_len) {
+#ifdef BUDOUXC_INSTRUMENT
+  size_t code_points = 0;
+  for (size_t i = 0; i < sentence_len; ++i) {
+    if (((uint8_t)sentence[i] & 0xc0) != 0x80) {
+      ++code_points;
+    }
+  }
+  instrument_parse(entry_point, start, code_points);
+#else
+  (void)entry_point;
+  (void)start;
+  (void)sentence;
+  (void)sentence_len;
+#endif
+}
+
+static inline void instrument_parse_utf16(enum budouxc_entry_point const entry_point,
+                                          uint64_t const start,
+                                          char16_t const *const sentence,
+                                          size_t const sentence_len) {
+  (void)sentence;
+  instrument_parse(entry_point, start, sentence_len);
+}
+
+static inline void instrument_parse_utf32(enum budouxc_entry_point const entry_point,
+                                          uint64_t const start,
+                                          char32_t const *const sentence,
+                                          size_t const sentence_len) {
+  (void)sentence;
+  instrument_parse(entry_point, start, sentence_len);
+}
+
+bool BUDOUXC_DECLSPEC budouxc_instrument_set_sink(struct budouxc_instrument_sink const *const sink) {
+#ifdef BUDOUXC_INSTRUMENT
+  instrument_sink = sink ? *sink : (struct budouxc_instrument_sink){0};
+  return true;
+#else
+  (void)sink;
+  return false;
+#endif
+}
+
+bool BUDOUXC_DECLSPEC budouxc_instrument_snapshot(struct budouxc_instrument_snapshot *const snapshot,
+                                                  bool const reset) {
+  if (!snapshot) {
+    return false;
+  }
+  *snapshot = (struct budouxc_instrument_snapshot){0};
+#ifdef BUDOUXC_INSTRUMENT
+  for (size_t i = 0; i < budouxc_init_phases; ++i) {
+    histogram_copy(&snapshot->init_phases[i], &instrument_init_phases[i], reset);
+  }
+  for (size_t i = 0; i < budouxc_entry_points; ++i) {
+    histogram_copy(&snapshot->latency[i], &instrument_latency[i], reset);
+    histogram_copy(&snapshot->cost[i], &instrument_cost[i], reset);
+  }
+  return true;
+#else
+  (void)reset;
+  return false;
+#endif
+}
+
+#include <hashmap.h>
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(a[0]))
+#define FLOAT_TYPE float
+
+// Each n-gram is stored once together with the weights of all of its slots, so that a single lookup per character
+// serves every position the n-gram appears at.
+#define UNIGRAM_SLOTS 6
+#define BIGRAM_SLOTS 3
+#define TRIGRAM_SLOTS 4
+
+struct unigram {
+  char32_t key[1];
+  int32_t values[UNIGRAM_SLOTS];
+};
+
+struct bigram {
+  char32_t key[2];
+  int32_t values[BIGRAM_SLOTS];
+};
+
+struct trigram {
+  char32_t key[3];
+  int32_t values[TRIGRAM_SLOTS];
+};
+
+// Character map ----
+
+// Every code point that appears in a model key gets a dense ID starting from 1. ID 0 is reserved for characters that
+// appear in no key at all, so that n-grams containing them can be skipped without probing any table.
+// The map is a two-level page table: an index of 256-character pages, followed by the pages themselves. Page 0 maps
+// everything to CHAR_ID_OOV and is shared by all pages that contain no model character.
+
+#define CODEPOINT_MAX ((char32_t)0x10ffff)
+#define CHAR_ID_OOV 0
+#define CHAR_ID_BITS 16
+#define CHAR_ID_MAX UINT16_MAX
+#define CHARMAP_PAGE_BITS 8
+#define CHARMAP_PAGE_SIZE ((size_t)1 << CHARMAP_PAGE_BITS)
+#define CHARMAP_INDEX_SIZE (((size_t)CODEPOINT_MAX + 1) >> CHARMAP_PAGE_BITS)
+
+struct charmap {
+  uint16_t const *index;
+  uint16_t const *pages;
+};
+
+static inline uint16_t charmap_get(struct charmap const *const cm, char32_t const ch) {
+  if (ch > CODEPOINT_MAX) {
+    return CHAR_ID_OOV;
+  }
+  return cm->pages[((size_t)cm->index[ch >> CHARMAP_PAGE_BITS] << CHARMAP_PAGE_BITS) | (ch & (CHARMAP_PAGE_SIZE - 1))];
+}
+
+static size_t charmap_size(size_t const pages) {
+  size_t const size = (CHARMAP_INDEX_SIZE + pages * CHARMAP_PAGE_SIZE) * sizeof(uint16_t);
+  return (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+static void charmap_attach(struct charmap *const cm, void const *const ptr) {
+  uint16_t const *const index = ptr;
+  *cm = (struct charmap){
+      .index = index,
+      .pages = index + CHARMAP_INDEX_SIZE,
+  };
+}
+
+// Frozen lookup tables ----
+
+// hashmap.c is only used while building the model. Once all weights are known, each map is frozen into a read-only
+// open-addressing table keyed by packed character IDs so that the parse loop can probe it without hashing callbacks.
+
+// Packed keys use at most 48 bits, so this value never collides with a real key.
+#define FTABLE_EMPTY_KEY UINT64_MAX
+
+struct ftable {
+  uint64_t const *keys;
+  int32_t const *values;
+  size_t mask;
+  unsigned int shift;
+  unsigned int width;
+};
+
+// Returned for n-grams that are not in the model. It is as wide as the widest record.
+static int32_t const zero_record[UNIGRAM_SLOTS] = {0};
+
+static inline uint64_t pack_key(struct charmap const *const cm, char32_t const *const key, size_t const n) {
+  uint64_t k = 0;
+  for (size_t i = 0; i < n; ++i) {
+    k = (k << CHAR_ID_BITS) | charmap_get(cm, key[i]);
+  }
+  return k;
+}
+
+static inline size_t ftable_hash(uint64_t const key, unsigned int const shift) {
+  return (size_t)((key * UINT64_C(0x9e3779b97f4a7c15)) >> shift);
+}
+
+static inline int32_t const *ftable_get(struct ftable const *const t, uint64_t const key) {
+  for (size_t i = ftable_hash(key, t->shift);; i = (i + 1) & t->mask) {
+    uint64_t const k = t->keys[i];
+    if (k == key) {
+      return t->values + i * t->width;
+    }
+    if (k == FTABLE_EMPTY_KEY) {
+      return zero_record;
+    }
+  }
+}
+
+// A table occupies 2^bits keys followed by 2^bits records of width values each.
+static unsigned int ftable_bits(size_t const n) {
+  // Keep the load factor at or below 50% so that probe sequences stay short.
+  unsigned int bits = 2;
+  while (((size_t)1 << bits) < n * 2) {
+    ++bits;
+  }
+  return bits;
+}
+
+static size_t ftable_size(unsigned int const bits, unsigned int const width) {
+  return ((size_t)1 << bits) * (sizeof(uint64_t) + sizeof(int32_t) * width);
+}
+
+static void ftable_clear(void *const ptr, unsigned int const bits) {
+  uint64_t *const keys = ptr;
+  for (size_t i = 0, cap = (size_t)1 << bits; i < cap; ++i) {
+    keys[i] = FTABLE_EMPTY_KEY;
+  }
+}
+
+static void ftable_insert(void *const ptr,
+                          unsigned int const bits,
+                          unsigned int const width,
+                          uint64_t const key,
+                          int32_t const *const values) {
+  size_t const mask = ((size_t)1 << bits) - 1;
+  uint64_t *const keys = ptr;
+  int32_t *const records = (void *)(keys + mask + 1);
+  size_t i = ftable_hash(key, 64 - bits);
+  while (keys[i] != FTABLE_EMPTY_KEY) {
+    i = (i + 1) & mask;
+  }
+  keys[i] = key;
+  memcpy(records + i * width, values, sizeof(int32_t) * width);
+}
+
+static void
+ftable_attach(struct ftable *const t, void const *const ptr, unsigned int const bits, unsigned int const width) {
+  size_t const cap = (size_t)1 << bits;
+  uint64_t const *const keys = ptr;
+  *t = (struct ftable){
+      .keys = keys,
+      .values = (void const *)(keys + cap),
+      .mask = cap - 1,
+      .shift = 64 - bits,
+      .width = width,
+  };
+}
+
+// Lookups stop at the first empty slot, so a table without one would make a lookup of a missing key loop forever.
+static bool ftable_has_empty(struct ftable const *const t) {
+  for (size_t i = 0; i <= t->mask; ++i) {
+    if (t->keys[i] == FTABLE_EMPTY_KEY) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Compact tables ----
+
+// A compact model trades exactness for size. Its keys pack character IDs with only as many bits as the largest ID
+// needs, into the narrowest of 16, 32 or 64 bits that holds a whole n-gram, and its records hold 16-bit weights. Each
+// table scales its weights by the smallest power of two that makes the largest one fit, and rounds them to the nearest
+// multiple of that scale. The tables are also filled up to a higher load factor.
+// Key 0 marks an empty slot, since ID 0 is never part of a key.
+
+struct ctable {
+  void const *keys;
+  int16_t const *values;
+  size_t mask;
+  unsigned int shift;
+  unsigned int width;
+  unsigned int key_size;
+  unsigned int value_shift;
+};
+
+#define CTABLE_VALUE_SHIFT_MAX 16
+
+#define IMPL_CTABLE_FIND(bits)                                                                                         \
+  static inline size_t ctable_find##bits(struct ctable const *const t, uint##bits##_t const key) {                     \
+    uint##bits##_t const *const keys = t->keys;                                                                        \
+    for (size_t i = ftable_hash(key, t->shift);; i = (i + 1) & t->mask) {                                              \
+      if (keys[i] == key) {                                                                                            \
+        return i;                                                                                                      \
+      }                                                                                                                \
+      if (keys[i] == 0) {                                                                                              \
+        return SIZE_MAX;                                                                                               \
+      }                                                                                                                \
+    }                                                                                                                  \
+  }                                                                                                                    \
+  static inline size_t ctable_find##bits(struct ctable const *const t, uint##bits##_t const key)
+
+IMPL_CTABLE_FIND(16);
+IMPL_CTABLE_FIND(32);
+IMPL_CTABLE_FIND(64);
+
+#undef IMPL_CTABLE_FIND
+
+// Records are scaled back into dest, which must be as wide as the table's records.
+static inline int32_t const *ctable_get(struct ctable const *const t, uint64_t const key, int32_t *const dest) {
+  size_t i;
+  switch (t->key_size) {
+  case sizeof(uint16_t):
+    i = ctable_find16(t, (uint16_t)key);
+    break;
+  case sizeof(uint32_t):
+    i = ctable_find32(t, (uint32_t)key);
+    break;
+  default:
+    i = ctable_find64(t, key);
+    break;
+  }
+  if (i == SIZE_MAX) {
+    return zero_record;
+  }
+  int16_t const *const r = t->values + i * t->width;
+  int32_t const scale = (int32_t)1 << t->value_shift;
+  for (size_t j = 0; j < t->width; ++j) {
+    dest[j] = (int32_t)r[j] * scale;
+  }
+  return dest;
+}
+
+static unsigned int ctable_bits(size_t const n) {
+  // Keep the load factor at or below 75%, which still leaves an empty slot to end every probe sequence.
+  unsigned int bits = 2;
+  while (((size_t)3 << bits) < n * 4) {
+    ++bits;
+  }
+  return bits;
+}
+
+static size_t ctable_keys_size(unsigned int const bits, unsigned int const key_size) {
+  size_t const size = ((size_t)1 << bits) * key_size;
+  return (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+static size_t ctable_size(unsigned int const bits, unsigned int const width, unsigned int const key_size) {
+  size_t const size = ((size_t)1 << bits) * sizeof(int16_t) * width;
+  return ctable_keys_size(bits, key_size) + ((size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1));
+}
+
+// Rounds v / 2^shift to the nearest integer.
+static int64_t round_shift(int32_t const v, unsigned int const shift) {
+  int64_t const scale = (int64_t)1 << shift;
+  int64_t const x = (int64_t)v + scale / 2;
+  return x >= 0 ? x / scale : -((scale - 1 - x) / scale);
+}
+
+static int16_t quantize(int32_t const v, unsigned int const shift) {
+  int64_t const q = round_shift(v, shift);
+  return (int16_t)(q > INT16_MAX ? INT16_MAX : q < INT16_MIN ? INT16_MIN : q);
+}
+
+// Finds the smallest shift that fits every weight from min to max. Weights only saturate beyond the largest shift.
+static unsigned int quantize_shift(int32_t const min, int32_t const max) {
+  unsigned int shift = 0;
+  while (shift < CTABLE_VALUE_SHIFT_MAX &&
+         (round_shift(max, shift) > INT16_MAX || round_shift(min, shift) < INT16_MIN)) {
+    ++shift;
+  }
+  return shift;
+}
+
+static void ctable_insert(void *const ptr,
+                          unsigned int const bits,
+                          unsigned int const width,
+                          unsigned int const key_size,
+                          unsigned int const value_shift,
+                          uint64_t const key,
+                          int32_t const *const values) {
+  size_t const mask = ((size_t)1 << bits) - 1;
+  int16_t *const records = (void *)((uint8_t *)ptr + ctable_keys_size(bits, key_size));
+  size_t i = ftable_hash(key, 64 - bits);
+  switch (key_size) {
+  case sizeof(uint16_t):
+    for (uint16_t *const keys = ptr; keys[i]; i = (i + 1) & mask) {
+    }
+    ((uint16_t *)ptr)[i] = (uint16_t)key;
+    break;
+  case sizeof(uint32_t):
+    for (uint32_t *const keys = ptr; keys[i]; i = (i + 1) & mask) {
+    }
+    ((uint32_t *)ptr)[i] = (uint32_t)key;
+    break;
+  default:
+    for (uint64_t *const keys = ptr; keys[i]; i = (i + 1) & mask) {
+    }
+    ((uint64_t *)ptr)[i] = key;
+    break;
+  }
+  for (size_t j = 0; j < width; ++j) {
+    records[i * width + j] = quantize(values[j], value_shift);
+  }
+}
+
+static void ctable_attach(struct ctable *const t,
+                          void const *const ptr,
+                          unsigned int const bits,
+                          unsigned int const width,
+                          unsigned int const key_size,
+                          unsigned int const value_shift) {
+  size_t const cap = (size_t)1 << bits;
+  *t = (struct ctable){
+      .keys = ptr,
+      .values = (void const *)((uint8_t const *)ptr + ctable_keys_size(bits, key_size)),
+      .mask = cap - 1,
+      .shift = 64 - bits,
+      .width = width,
+      .key_size = key_size,
+      .value_shift = value_shift,
+  };
+}
+
+static bool ctable_has_empty(struct ctable const *const t) {
+  for (size_t i = 0; i <= t->mask; ++i) {
+    bool empty;
+    switch (t->key_size) {
+    case sizeof(uint16_t):
+      empty = ((uint16_t const *)t->keys)[i] == 0;
+      break;
+    case sizeof(uint32_t):
+      empty = ((uint32_t const *)t->keys)[i] == 0;
+      break;
+    default:
+      empty = ((uint64_t const *)t->keys)[i] == 0;
+      break;
+    }
+    if (empty) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Binary model format ----
+
+// A binary model is a header followed by the character map and the frozen unigram, bigram and trigram tables. Their
+// records hold the UW1-UW6, BW1-BW3 and TW1-TW4 weights respectively. All offsets are relative to the start of the
+// header, so the same bytes can be used from any address as long as it is 8-byte aligned.
+// Integers are stored in native byte order; byte_order lets a loader reject a file written on a different architecture.
+// A compact model has BINARY_FLAG_COMPACT set and holds compact tables whose keys pack IDs of id_bits each.
+
+#define BINARY_MAGIC "BDXC"
+#define BINARY_VERSION 4
+#define BINARY_BYTE_ORDER UINT32_C(0x01020304)
+#define BINARY_TABLES 3
+#define BINARY_FLAG_COMPACT UINT32_C(0x1)
+
+struct binary_table {
+  uint64_t offset;
+  uint32_t bits;
+  uint32_t width;
+  uint32_t key_size;
+  uint32_t value_shift;
+};
+
+struct binary_charmap {
+  uint64_t offset;
+  uint32_t pages;
+  uint32_t ids;
+};
+
+struct binary_header {
+  char magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  int32_t sum;
+  uint64_t size;
+  uint32_t flags;
+  uint32_t id_bits;
+  struct binary_charmap charmap;
+  struct binary_table tables[BINARY_TABLES];
+};
+
+enum storage {
+  storage_owned,
+  storage_borrowed,
+  storage_mapped,
+};
+
+#ifdef BUDOUXC_COUNT_LOOKUPS
+// Building with BUDOUXC_COUNT_LOOKUPS makes every lookup count itself in the model, for budouxc_model_stats. All
+// threads using the model share the counters, so they are updated with relaxed atomics.
+struct lookup_counts {
+  atomic_ullong hits;
+  atomic_ullong misses;
+  atomic_ullong skipped;
+};
+#endif
+
+// Shared models are keyed by two hashes of their JSON and its length, or by an ID with a length of 0 for the embedded
+// models, which no JSON can have.
+struct shared_key {
+  uint64_t hash[2];
+  size_t len;
+};
+
+struct budouxc {
+  struct budouxc_allocators allocators;
+  struct charmap chars;
+  struct ftable uni;
+  struct ftable bi;
+  struct ftable tri;
+  bool compact;
+  unsigned int id_bits;
+  struct ctable cuni;
+  struct ctable cbi;
+  struct ctable ctri;
+  int32_t sum;
+  enum storage storage;
+  void *storage_ptr;
+  size_t storage_size;
+  void const *binary;
+  size_t binary_size;
+#ifdef BUDOUXC_COUNT_LOOKUPS
+  // Parsing only has a const model, so the counters are reached through a pointer to the model's own storage.
+  struct lookup_counts *counts;
+  struct lookup_counts counts_storage[BINARY_TABLES];
+#endif
+  // Set once before a model is shared, so it can be read without holding shared_lock. The other fields of a shared
+  // model are guarded by it.
+  bool shared;
+  struct shared_key shared_key;
+  size_t shared_refs;
+  struct budouxc *shared_next;
+};
+
+static bool attach_binary(struct budouxc *const model, void const *const ptr, size_t const len, char *const error128) {
+  static unsigned int const widths[BINARY_TABLES] = {UNIGRAM_SLOTS, BIGRAM_SLOTS, TRIGRAM_SLOTS};
+  struct binary_header const *const h = ptr;
+  if (len < sizeof(struct binary_header)) {
+    strcpy(error128, "Binary model is too short");
+    return false;
+  }
+  if ((uintptr_t)ptr % sizeof(uint64_t)) {
+    strcpy(error128, "Binary model is not aligned to 8 bytes");
+    return false;
+  }
+  if (memcmp(h->magic, BINARY_MAGIC, sizeof(h->magic)) != 0) {
+    strcpy(error128, "Not a binary model");
+    return false;
+  }
+  if (h->byte_order != BINARY_BYTE_ORDER) {
+    strcpy(error128, "Binary model byte order mismatch");
+    return false;
+  }
+  if (h->version != BINARY_VERSION) {
+    sprintf(error128, "Unsupported binary model version %u", (unsigned int)h->version);
+    return false;
+  }
+  if (h->size > len) {
+    strcpy(error128, "Binary model is truncated");
+    return false;
+  }
+  bool const compact = (h->flags & BINARY_FLAG_COMPACT) != 0;
+  if ((h->flags & ~BINARY_FLAG_COMPACT) ||
+      (compact ? h->id_bits < 1 || h->id_bits > CHAR_ID_BITS : h->id_bits != CHAR_ID_BITS)) {
+    strcpy(error128, "Broken binary model header");
+    return false;
+  }
+  for (size_t i = 0; i < BINARY_TABLES; ++i) {
+    struct binary_table const *const bt = &h->tables[i];
+    // Table i is keyed by n-grams of i + 1 characters.
+    bool const keys_valid = compact ? (bt->key_size == sizeof(uint16_t) || bt->key_size == sizeof(uint32_t) ||
+                                       bt->key_size == sizeof(uint64_t)) &&
+                                          (i + 1) * h->id_bits <= bt->key_size * 8 &&
+                                          bt->value_shift <= CTABLE_VALUE_SHIFT_MAX
+                                    : bt->key_size == sizeof(uint64_t) && bt->value_shift == 0;
+    if (!keys_valid || bt->bits < 2 || bt->bits >= sizeof(size_t) * 8 - 6 || bt->width != widths[i] ||
+        bt->offset % sizeof(uint64_t) || bt->offset < sizeof(struct binary_header) || bt->offset > h->size ||
+        (compact ? ctable_size(bt->bits, bt->width, bt->key_size) : ftable_size(bt->bits, bt->width)) >
+            h->size - bt->offset) {
+      sprintf(error128, "Broken binary model table #%zu", i);
+      return false;
+    }
+  }
+  struct binary_charmap const *const bc = &h->charmap;
+  if (bc->pages < 1 || bc->pages > CHARMAP_INDEX_SIZE + 1 || bc->offset % sizeof(uint64_t) ||
+      bc->offset < sizeof(struct binary_header) || bc->offset > h->size ||
+      charmap_size(bc->pages) > h->size - bc->offset || (uint64_t)bc->ids >> h->id_bits) {
+    strcpy(error128, "Broken binary model character map");
+    return false;
+  }
+  uint8_t const *const base = ptr;
+  charmap_attach(&model->chars, base + bc->offset);
+  // The pages are only read through the index, so checking the index is enough to keep lookups in bounds.
+  for (size_t i = 0; i < CHARMAP_INDEX_SIZE; ++i) {
+    if (model->chars.index[i] >= bc->pages) {
+      strcpy(error128, "Broken binary model character map");
+      return false;
+    }
+  }
+  if (compact) {
+    struct ctable *const tables[BINARY_TABLES] = {&model->cuni, &model->cbi, &model->ctri};
+    for (size_t i = 0; i < BINARY_TABLES; ++i) {
+      struct binary_table const *const bt = &h->tables[i];
+      ctable_attach(tables[i], base + bt->offset, bt->bits, bt->width, bt->key_size, bt->value_shift);
+      if (!ctable_has_empty(tables[i])) {
+        sprintf(error128, "Broken binary model table #%zu", i);
+        return false;
+      }
+    }
+  } else {
+    struct ftable *const tables[BINARY_TABLES] = {&model->uni, &model->bi, &model->tri};
+    for (size_t i = 0; i < BINARY_TABLES; ++i) {
+      struct binary_table const *const bt = &h->tables[i];
+      ftable_attach(tables[i], base + bt->offset, bt->bits, bt->width);
+      if (!ftable_has_empty(tables[i])) {
+        sprintf(error128, "Broken binary model table #%zu", i);
+        return false;
+      }
+    }
+  }
+  model->compact = compact;
+  model->id_bits = h->id_bits;
+  model->sum = h->sum;
+  model->binary = ptr;
+  model->binary_size = (size_t)h->size;
+  return true;
+}
+
+// Model JSON reader ----
+
+// A JSON model is read straight into the maps, without first parsing it into a tree of values. Only the root object and
+// the weight objects in it are interpreted; any other value is checked for syntax and skipped. Syntax errors are
+// reported with the line and column where they were found.
+
+#define JSON_DEPTH_MAX 64
+
+struct json_reader {
+  char const *begin;
+  char const *pos;
+  char const *end;
+  char *error128;
+};
+
+enum json_member {
+  json_member_next,
+  json_member_end,
+  json_member_failed,
+};
+
+static void json_error(struct json_reader const *const r, char const *const message) {
+  size_t line = 1;
+  size_t column = 1;
+  for (char const *p = r->begin; p < r->pos; ++p) {
+    if (*p == '\n') {
+      ++line;
+      column = 1;
+    } else if (!u8later((uint8_t)*p)) {
+      ++column;
+    }
+  }
+  snprintf(r->error128, 128, "%zu:%zu: %s", line, column, message);
+}
+
+static void json_unexpected(struct json_reader const *const r) {
+  char message[32];
+  if (r->pos == r->end) {
+    strcpy(message, "Unexpected end of JSON");
+  } else if (0x20 < (uint8_t)*r->pos && (uint8_t)*r->pos < 0x7f) {
+    sprintf(message, "Unexpected `%c`", *r->pos);
+  } else {
+    sprintf(message, "Unexpected byte 0x%02x", (unsigned int)(uint8_t)*r->pos);
+  }
+  json_error(r, message);
+}
+
+static void json_skip_space(struct json_reader *const r) {
+  while (r->pos < r->end && (*r->pos == ' ' || *r->pos == '\t' || *r->pos == '\n' || *r->pos == '\r')) {
+    ++r->pos;
+  }
+}
+
+static bool json_peek(struct json_reader *const r, char const ch) {
+  json_skip_space(r);
+  return r->pos < r->end && *r->pos == ch;
+}
+
+static bool json_expect(struct json_reader *const r, char const ch) {
+  if (!json_peek(r, ch)) {
+    json_unexpected(r);
+    return false;
+  }
+  ++r->pos;
+  return true;
+}
+
+static bool json_hex4(struct json_reader *const r, char32_t *const v) {
+  *v = 0;
+  for (size_t i = 0; i < 4; ++i, ++r->pos) {
+    if (r->pos == r->end) {
+      json_unexpected(r);
+      return false;
+    }
+    char const ch = *r->pos;
+    if ('0' <= ch && ch <= '9') {
+      *v = (*v << 4) | (char32_t)(ch - '0');
+    } else if ('a' <= (ch | 0x20) && (ch | 0x20) <= 'f') {
+      *v = (*v << 4) | (char32_t)((ch | 0x20) - 'a' + 10);
+    } else {
+      json_unexpected(r);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Reads the string at r->pos into at most cap code points of dest. *len receives the number of code points in the
+// whole string, which exceeds cap if it did not fit. Invalid UTF-8 and unpaired surrogates clear *valid instead of
+// failing, so that the caller can report them in its own words.
+static bool json_read_string(
+    struct json_reader *const r, char32_t *const dest, size_t const cap, size_t *const len, bool *const valid) {
+  size_t n = 0;
+  *valid = true;
+  ++r->pos;
+  for (;;) {
+    if (r->pos == r->end || (uint8_t)*r->pos < 0x20) {
+      json_unexpected(r);
+      return false;
+    }
+    char32_t ch = (uint8_t)*r->pos;
+    if (ch == '"') {
+      ++r->pos;
+      break;
+    }
+    if (ch >= 0x80) {
+      // Keys are a few characters long, which is too short for a SIMD block to pay for the dispatch of utf8_decode.
+      size_t seq_len = utf8_sequence((uint8_t const *)r->pos, (size_t)(r->end - r->pos), &ch);
+      if (!seq_len) {
+        *valid = false;
+        seq_len = 1;
+      }
+      r->pos += seq_len;
+    } else if (ch != '\\') {
+      ++r->pos;
+    } else {
+      ++r->pos;
+      char const escape = r->pos < r->end ? *r->pos : '\0';
+      switch (escape) {
+      case '"':
+      case '\\':
+      case '/':
+        ch = (char32_t)escape;
+        break;
+      case 'b':
+        ch = '\b';
+        break;
+      case 'f':
+        ch = '\f';
+        break;
+      case 'n':
+        ch = '\n';
+        break;
+      case 'r':
+        ch = '\r';
+        break;
+      case 't':
+        ch = '\t';
+        break;
+      case 'u':
+        ++r->pos;
+        if (!json_hex4(r, &ch)) {
+          return false;
+        }
+        if (0xd800 <= ch && ch < 0xdc00 && r->end - r->pos >= 2 && r->pos[0] == '\\' && r->pos[1] == 'u') {
+          char32_t low = 0;
+          r->pos += 2;
+          if (!json_hex4(r, &low)) {
+            return false;
+          }
+          if (0xdc00 <= low && low < 0xe000) {
+            ch = 0x10000 + ((ch - 0xd800) << 10) + (low - 0xdc00);
+          } else {
+            *valid = false;
+          }
+        }
+        if (invalid_codepoint(ch)) {
+          *valid = false;
+        }
+        --r->pos;
+        break;
+      default:
+        json_unexpected(r);
+        return false;
+      }
+      ++r->pos;
+    }
+    if (n < cap) {
+      dest[n] = ch;
+    }
+    ++n;
+  }
+  *len = n;
+  return true;
+}
+
+// Reads a number. *integer is set unless it has a fraction or an exponent, or does not fit in int64_t.
+static bool json_read_number(struct json_reader *const r, int64_t *const value, bool *const integer) {
+  bool const negative = r->pos < r->end && *r->pos == '-';
+  if (negative) {
+    ++r->pos;
+  }
+  if (r->pos == r->end || *r->pos < '0' || '9' < *r->pos) {
+    json_unexpected(r);
+    return false;
+  }
+  uint64_t magnitude = 0;
+  bool fits = true;
+  if (*r->pos == '0') {
+    ++r->pos;
+  } else {
+    for (; r->pos < r->end && '0' <= *r->pos && *r->pos <= '9'; ++r->pos) {
+      unsigned int const digit = (unsigned int)(*r->pos - '0');
+      fits = fits && magnitude <= (UINT64_MAX - digit) / 10;
+      magnitude = magnitude * 10 + digit;
+    }
+  }
+  bool whole = true;
+  if (r->pos < r->end && *r->pos == '.') {
+    whole = false;
+    ++r->pos;
+    if (r->pos == r->end || *r->pos < '0' || '9' < *r->pos) {
+      json_unexpected(r);
+      return false;
+    }
+    while (r->pos < r->end && '0' <= *r->pos && *r->pos <= '9') {
+      ++r->pos;
+    }
+  }
+  if (r->pos < r->end && (*r->pos == 'e' || *r->pos == 'E')) {
+    whole = false;
+    ++r->pos;
+    if (r->pos < r->end && (*r->pos == '+' || *r->pos == '-')) {
+      ++r->pos;
+    }
+    if (r->pos == r->end || *r->pos < '0' || '9' < *r->pos) {
+      json_unexpected(r);
+      return false;
+    }
+    while (r->pos < r->end && '0' <= *r->pos && *r->pos <= '9') {
+      ++r->pos;
+    }
+  }
+  fits = fits && magnitude <= (negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX);
+  *integer = whole && fits;
+  *value = !*integer ? 0 : negative ? (int64_t)(0 - magnitude) : (int64_t)magnitude;
+  return true;
+}
+
+// Moves to the name of the next member of an object whose opening brace has been read, or past its closing brace.
+static enum json_member json_next_member(struct json_reader *const r, bool *const first) {
+  if (json_peek(r, '}')) {
+    ++r->pos;
+    return json_member_end;
+  }
+  if (!*first && !json_expect(r, ',')) {
+    return json_member_failed;
+  }
+  *first = false;
+  if (!json_peek(r, '"')) {
+    json_unexpected(r);
+    return json_member_failed;
+  }
+  return json_member_next;
+}
+
+static bool json_skip_literal(struct json_reader *const r, char const *const literal) {
+  for (char const *p = literal; *p; ++p, ++r->pos) {
+    if (r->pos == r->end || *r->pos != *p) {
+      json_unexpected(r);
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool json_skip_value(struct json_reader *const r, unsigned int const depth) {
+  size_t len = 0;
+  bool valid = true;
+  int64_t value = 0;
+  bool integer = false;
+  json_skip_space(r);
+  if (r->pos == r->end) {
+    json_unexpected(r);
+    return false;
+  }
+  switch (*r->pos) {
+  case '"':
+    return json_read_string(r, NULL, 0, &len, &valid);
+  case 't':
+    return json_skip_literal(r, "true");
+  case 'f':
+    return json_skip_literal(r, "false");
+  case 'n':
+    return json_skip_literal(r, "null");
+  case '{':
+  case '[':
+    break;
+  default:
+    return json_read_number(r, &value, &integer);
+  }
+  if (depth == JSON_DEPTH_MAX) {
+    json_error(r, "Too deeply nested");
+    return false;
+  }
+  if (*r->pos++ == '[') {
+    if (json_peek(r, ']')) {
+      ++r->pos;
+      return true;
+    }
+    for (;;) {
+      if (!json_skip_value(r, depth + 1)) {
+        return false;
+      }
+      if (!json_peek(r, ',')) {
+        return json_expect(r, ']');
+      }
+      ++r->pos;
+    }
+  }
+  bool first = true;
+  for (;;) {
+    switch (json_next_member(r, &first)) {
+    case json_member_next:
+      break;
+    case json_member_end:
+      return true;
+    case json_member_failed:
+      return false;
+    }
+    if (!json_read_string(r, NULL, 0, &len, &valid) || !json_expect(r, ':') || !json_skip_value(r, depth + 1)) {
+      return false;
+    }
+  }
+}
+
+struct builder {
+  struct hashmap *uni;
+  struct hashmap *bi;
+  struct hashmap *tri;
+  // Where the weight object of each slot starts in the JSON, or NULL if it has not been seen yet.
+  char const *uni_at[UNIGRAM_SLOTS];
+  char const *bi_at[BIGRAM_SLOTS];
+  char const *tri_at[TRIGRAM_SLOTS];
+};
+
+#define IMPL_BUILD_MAP(typ)                                                                                            \
+  static int typ##_compare(void const *const a, void const *const b, void *const udata) {                              \
+    (void)udata;                                                                                                       \
+    struct typ const *const aa = a;                                                                                    \
+    struct typ const *const bb = b;                                                                                    \
+    return memcmp(&aa->key, &bb->key, sizeof(aa->key));                                                                \
+  }                                                                                                                    \
+  static uint64_t typ##_hash(void const *const item, uint64_t const seed0, uint64_t const seed1, void *const udata) {  \
+    (void)udata;                                                                                                       \
+    struct typ const *const i = item;                                                                                  \
+    return hashmap_sip(&i->key, sizeof(i->key), seed0, seed1);                                                         \
+  }                                                                                                                    \
+  static struct hashmap *new_##typ##_map(struct budouxc_allocators *const allocators) {                                \
+    return hashmap_new_with_allocator(                                                                                 \
+        hm_realloc, hm_free, sizeof(struct typ), 0, 0, 0, typ##_hash, typ##_compare, NULL, allocators);                \
+  }                                                                                                                    \
+  static bool load_##typ##_weights(struct json_reader *const r,                                                        \
+                                   struct hashmap *const map,                                                          \
+                                   size_t const slot,                                                                  \
+                                   int32_t *const sum) {                                                               \
+    struct typ g = {0};                                                                                                \
+    size_t const n = ARRAY_SIZE(g.key);                                                                                \
+    bool first = true;                                                                                                 \
+    ++r->pos;                                                                                                          \
+    for (;;) {                                                                                                         \
+      switch (json_next_member(r, &first)) {                                                                           \
+      case json_member_next:                                                                                           \
+        break;                                                                                                         \
+      case json_member_end:                                                                                            \
+        return true;                                                                                                   \
+      case json_member_failed:                                                                                         \
+        return false;                                                                                                  \
+      }                                                                                                                \
+      char const *const name = r->pos + 1;                                                                             \
+      size_t len = 0;                                                                                                  \
+      bool valid = true;                                                                                               \
+      if (!json_read_string(r, &g.key[0], n, &len, &valid)) {                                                          \
+        return false;                                                                                                  \
+      }                                                                                                                \
+      int const name_len = (int)(r->pos - 1 - name);                                                                   \
+      if (!json_expect(r, ':')) {                                                                                      \
+        return false;                                                                                                  \
+      }                                                                                                                \
+      json_skip_space(r);                                                                                              \
+      int64_t value = 0;                                                                                               \
+      bool integer = false;                                                                                            \
+      if (r->pos == r->end || (*r->pos != '-' && (*r->pos < '0' || '9' < *r->pos))) {                                  \
+        strcpy(r->error128, "Invalid JSON structure");                                                                 \
+        return false;                                                                                                  \
+      }                                                                                                                \
+      if (!json_read_number(r, &value, &integer)) {                                                                    \
+        return false;                                                                                                  \
+      }                                                                                                                \
+      if (!integer) {                                                                                                  \
+        strcpy(r->error128, "Invalid JSON structure");                                                                 \
+        return false;                                                                                                  \
+      }                                                                                                                \
+      if (!valid || !len || len > n) {                                                                                 \
+        snprintf(r->error128, 128, "Failed to convert to codepoint(s): %.*s", name_len < 80 ? name_len : 80, name);    \
+        return false;                                                                                                  \
+      }                                                                                                                \
+      if (len < n) {                                                                                                   \
+        memset((&g.key[0]) + len, 0, (n - len) * sizeof(g.key[0]));                                                    \
+      }                                                                                                                \
+      struct typ const *const found = hashmap_get(map, &g);                                                            \
+      if (found) {                                                                                                     \
+        memcpy(g.values, found->values, sizeof(g.values));                                                             \
+      } else {                                                                                                         \
+        memset(g.values, 0, sizeof(g.values));                                                                         \
+      }                                                                                                                \
+      int32_t const old = g.values[slot];                                                                              \
+      g.values[slot] = (int32_t)value;                                                                                 \
+      *sum += g.values[slot] - old;                                                                                    \
+      if (hashmap_set(map, &g) == NULL && hashmap_oom(map)) {                                                          \
+        strcpy(r->error128, "Out of memory");                                                                          \
+        return false;                                                                                                  \
+      }                                                                                                                \
+    }                                                                                                                  \
+  }                                                                                                                    \
+  static void mark_##typ##_chars(uint8_t *const bitmap, struct hashmap *const map) {                                   \
+    size_t iter = 0;                                                                                                   \
+    void *item = NULL;                                                                                                 \
+    while (hashmap_iter(map, &iter, &item)) {                                                                          \
+      struct typ const *const g = item;                                                                                \
+      for (size_t i = 0; i < ARRAY_SIZE(g->key); ++i) {                                                                \
+        bitmap[g->key[i] >> 3] |= (uint8_t)(1 << (g->key[i] & 7));                                                     \
+      }                                                                                                                \
+    }                                                                                                                  \
+  }                                                                                                                    \
+  static void freeze_##typ##_map(                                                                                      \
+      uint8_t *const base, struct binary_table *const bt, struct charmap const *const cm, struct hashmap *const map) { \
+    ftable_clear(base + bt->offset, bt->bits);                                                                         \
+    size_t iter = 0;                                                                                                   \
+    void *item = NULL;                                                                                                 \
+    while (hashmap_iter(map, &iter, &item)) {                                                                          \
+      struct typ const *const g = item;                                                                                \
+      ftable_insert(base + bt->offset, bt->bits, bt->width, pack_key(cm, g->key, ARRAY_SIZE(g->key)), g->values);      \
+    }                                                                                                                  \
+  }                                                                                                                    \
+  static void freeze_##typ##_map(                                                                                      \
+      uint8_t *const base, struct binary_table *const bt, struct charmap const *const cm, struct hashmap *const map)
+
+IMPL_BUILD_MAP(unigram);
+IMPL_BUILD_MAP(bigram);
+IMPL_BUILD_MAP(trigram);
+
+#undef IMPL_BUILD_MAP
+
+// Shared models ----
+
+// budouxc_acquire and its embedded variants keep one model per JSON content or embedded model in a process-wide list.
+// A shared model counts its references, and budouxc_destroy only frees it when the last one is released. Models are
+// loaded outside of the lock, so two threads asking for the same new model at once may both load it. The one that
+// finishes last then takes a reference to the other's model and frees its own.
+
+#define SHARED_SEED0 UINT64_C(0x9e3779b97f4a7c15)
+#define SHARED_SEED1 UINT64_C(0xbf58476d1ce4e5b9)
+#define SHARED_SEED2 UINT64_C(0x94d049bb133111eb)
+#define SHARED_SEED3 UINT64_C(0x2545f4914f6cdd1d)
+
+static mutex shared_lock = MUTEX_INITIALIZER;
+static struct budouxc *shared_models;
+
+static struct shared_key shared_key_json(char const *const json, size_t const json_len) {
+  return (struct shared_key){
+      .hash =
+          {
+              hashmap_sip(json, json_len, SHARED_SEED0, SHARED_SEED1),
+              hashmap_sip(json, json_len, SHARED_SEED2, SHARED_SEED3),
+          },
+      .len = json_len,
+  };
+}
+
+// Must be called with shared_lock held. Takes a reference to the model if it is found.
+static struct budouxc *shared_find(struct shared_key const *const key) {
+  for (struct budouxc *m = shared_models; m; m = m->shared_next) {
+    if (m->shared_key.len == key->len && m->shared_key.hash[0] == key->hash[0] &&
+        m->shared_key.hash[1] == key->hash[1]) {
+      ++m->shared_refs;
+      return m;
+    }
+  }
+  return NULL;
+}
+
+static struct budouxc *shared_get(struct shared_key const *const key) {
+  mutex_lock(&shared_lock);
+  struct budouxc *const model = shared_find(key);
+  mutex_unlock(&shared_lock);
+  return model;
+}
+
+// Shares a model that has just been loaded, unless another thread has shared the same one in the meantime.
+static struct budouxc *shared_put(struct budouxc *const model, struct shared_key const *const key) {
+  mutex_lock(&shared_lock);
+  struct budouxc *const found = shared_find(key);
+  if (!found) {
+    model->shared = true;
+    model->shared_key = *key;
+    model->shared_refs = 1;
+    model->shared_next = shared_models;
+    shared_models = model;
+  }
+  mutex_unlock(&shared_lock);
+  if (found) {
+    budouxc_destroy(model);
+    return found;
+  }
+  return model;
+}
+
+// Returns true if the last reference to a shared model has been released, and removes it from the list.
+static bool shared_release(struct budouxc *const model) {
+  mutex_lock(&shared_lock);
+  bool const last = --model->shared_refs == 0;
+  if (last) {
+    for (struct budouxc **m = &shared_models; *m; m = &(*m)->shared_next) {
+      if (*m == model) {
+        *m = model->shared_next;
+        break;
+      }
+    }
+  }
+  mutex_unlock(&shared_lock);
+  return last;
+}
+
+struct budouxc *BUDOUXC_DECLSPEC budouxc_acquire(struct budouxc_allocators const *const allocators,
+                                                 char const *const json,
+                                                 size_t const json_len,
+                                                 char *error128) {
+  if (!json || !json_len) {
+    strcpy(error128, "Invalid arguments");
+    return NULL;
+  }
+  struct shared_key const key = shared_key_json(json, json_len);
+  struct budouxc *const model = shared_get(&key);
+  if (model) {
+    return model;
+  }
+  struct budouxc *const loaded = budouxc_init(allocators, json, json_len, error128);
+  return loaded ? shared_put(loaded, &key) : NULL;
+}
+
+void BUDOUXC_DECLSPEC budouxc_destroy(struct budouxc *const model) {
+  if (!model) {
+    return;
+  }
+  if (model->shared && !shared_release(model)) {
+    return;
+  }
+  if (model->storage_ptr) {
+    switch (model->storage) {
+    case storage_owned:
+      model->allocators.fn_free(model->storage_ptr, model->allocators.user_data);
+      break;
+    case storage_borrowed:
+      break;
+    case storage_mapped:
+      unmap_file(model->storage_ptr, model->storage_size, &model->allocators);
+      break;
+    }
+  }
+  model->allocators.fn_free(model, model->allocators.user_data);
+}
+
+static struct budouxc *model_new(struct budouxc_allocators const *const allocators, char *const error128) {
+  struct budouxc_allocators a = allocators ? *allocators : (struct budouxc_allocators){0};
+  if (!a.fn_realloc || !a.fn_free) {
+    a.fn_realloc = realloc_default;
+    a.fn_free = free_default;
+    a.user_data = NULL;
+  }
+  struct budouxc *const model = a.fn_realloc(NULL, sizeof(struct budouxc), a.user_data);
+  if (!model) {
+    strcpy(error128, "Out of memory");
+    return NULL;
+  }
+  *model = (struct budouxc){
+      .allocators = a,
+  };
+#ifdef BUDOUXC_COUNT_LOOKUPS
+  model->counts = model->counts_storage;
+#endif
+  return model;
+}
+
+static bool builder_init(struct builder *const b, struct budouxc_allocators *const allocators) {
+  b->uni = new_unigram_map(allocators);
+  b->bi = new_bigram_map(allocators);
+  b->tri = new_trigram_map(allocators);
+  return b->uni && b->bi && b->tri;
+}
+
+static void builder_destroy(struct builder *const b) {
+  hashmap_free(b->uni);
+  b->uni = NULL;
+  hashmap_free(b->bi);
+  b->bi = NULL;
+  hashmap_free(b->tri);
+  b->tri = NULL;
+}
+
+#define CHARMAP_BITMAP_SIZE ((size_t)CODEPOINT_MAX / 8 + 1)
+#define CHARMAP_PAGE_BYTES (CHARMAP_PAGE_SIZE / 8)
+
+static bool bitmap_page_used(uint8_t const *const page) {
+  for (size_t i = 0; i < CHARMAP_PAGE_BYTES; ++i) {
+    if (page[i]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Assigns IDs in code point order from a bitmap of used code points.
+static void build_charmap(uint16_t *const index, uint8_t const *const bitmap) {
+  uint16_t *const pages = index + CHARMAP_INDEX_SIZE;
+  uint16_t page = 0;
+  uint16_t id = CHAR_ID_OOV;
+  for (size_t i = 0; i < CHARMAP_INDEX_SIZE; ++i) {
+    uint8_t const *const bits = bitmap + i * CHARMAP_PAGE_BYTES;
+    if (!bitmap_page_used(bits)) {
+      continue;
+    }
+    index[i] = ++page;
+    uint16_t *const ids = pages + (size_t)page * CHARMAP_PAGE_SIZE;
+    for (size_t j = 0; j < CHARMAP_PAGE_SIZE; ++j) {
+      ids[j] = (bits[j >> 3] >> (j & 7)) & 1 ? ++id : CHAR_ID_OOV;
+    }
+  }
+}
+
+struct freeze_job {
+  uint8_t *base;
+  struct binary_header *h;
+  struct charmap const *cm;
+  struct builder *b;
+};
+
+static bool freeze_table(void *const ctx, size_t const worker, size_t const item) {
+  (void)worker;
+  struct freeze_job const *const job = ctx;
+  switch (item) {
+  case 0:
+    freeze_unigram_map(job->base, &job->h->tables[0], job->cm, job->b->uni);
+    break;
+  case 1:
+    freeze_bigram_map(job->base, &job->h->tables[1], job->cm, job->b->bi);
+    break;
+  case 2:
+    freeze_trigram_map(job->base, &job->h->tables[2], job->cm, job->b->tri);
+    break;
+  }
+  return true;
+}
+
+// Lays out the character map and all maps as a single binary model allocated with the model's allocators. Once the
+// character map is known, the tables are filled on up to `threads` threads.
+static void *builder_freeze(struct builder *const b,
+                            int32_t const sum,
+                            struct budouxc_allocators const *const allocators,
+                            struct arena *const scratch,
+                            size_t const threads,
+                            size_t *const size,
+                            char *const error128) {
+  uint8_t *base = NULL;
+  uint8_t *const bitmap = allocators->fn_realloc(NULL, CHARMAP_BITMAP_SIZE, allocators->user_data);
+  if (!bitmap) {
+    strcpy(error128, "Out of memory");
+    goto cleanup;
+  }
+  memset(bitmap, 0, CHARMAP_BITMAP_SIZE);
+  mark_unigram_chars(bitmap, b->uni);
+  mark_bigram_chars(bitmap, b->bi);
+  mark_trigram_chars(bitmap, b->tri);
+
+  size_t pages = 1;
+  size_t ids = 0;
+  for (size_t i = 0; i < CHARMAP_INDEX_SIZE; ++i) {
+    uint8_t const *const bits = bitmap + i * CHARMAP_PAGE_BYTES;
+    if (!bitmap_page_used(bits)) {
+      continue;
+    }
+    ++pages;
+    for (size_t j = 0; j < CHARMAP_PAGE_SIZE; ++j) {
+      ids += (bits[j >> 3] >> (j & 7)) & 1;
+    }
+  }
+  if (ids > CHAR_ID_MAX) {
+    sprintf(error128, "Too many distinct characters in model keys: %zu", ids);
+    goto cleanup;
+  }
+
+  struct binary_header h = {
+      .magic = BINARY_MAGIC,
+      .version = BINARY_VERSION,
+      .byte_order = BINARY_BYTE_ORDER,
+      .sum = sum,
+      .id_bits = CHAR_ID_BITS,
+      .charmap =
+          {
+              .offset = sizeof(struct binary_header),
+              .pages = (uint32_t)pages,
+              .ids = (uint32_t)ids,
+          },
+  };
+  struct hashmap *const maps[BINARY_TABLES] = {b->uni, b->bi, b->tri};
+  unsigned int const widths[BINARY_TABLES] = {UNIGRAM_SLOTS, BIGRAM_SLOTS, TRIGRAM_SLOTS};
+  size_t offset = sizeof(struct binary_header) + charmap_size(pages);
+  for (size_t i = 0; i < BINARY_TABLES; ++i) {
+    struct binary_table *const bt = &h.tables[i];
+    *bt = (struct binary_table){
+        .offset = offset,
+        .bits = ftable_bits(hashmap_count(maps[i])),
+        .width = widths[i],
+        .key_size = sizeof(uint64_t),
+    };
+    offset += ftable_size(bt->bits, bt->width);
+  }
+  h.size = offset;
+
+  base = allocators->fn_realloc(NULL, offset, allocators->user_data);
+  if (!base) {
+    strcpy(error128, "Out of memory");
+    goto cleanup;
+  }
+  memcpy(base, &h, sizeof(h));
+  uint16_t *const index = (void *)(base + h.charmap.offset);
+  memset(index, 0, charmap_size(pages));
+  build_charmap(index, bitmap);
+  struct charmap cm;
+  charmap_attach(&cm, index);
+  struct freeze_job job = {
+      .base = base,
+      .h = &h,
+      .cm = &cm,
+      .b = b,
+  };
+  if (!parallel_for(scratch, BINARY_TABLES, threads, freeze_table, &job, error128)) {
+    allocators->fn_free(base, allocators->user_data);
+    base = NULL;
+    goto cleanup;
+  }
+  *size = offset;
+cleanup:
+  if (bitmap) {
+    allocators->fn_free(bitmap, allocators->user_data);
+  }
+  return base;
+}
+
+// Reads the root object. Only UW1 - UW6, BW1 - BW3, TW1 - TW4 are located on it. Each weight object is read into its
+// map right away, and its weights are added to sum, unless defer is set. Then the weight objects are only checked for
+// syntax and read later by build_table.
+static bool read_root(struct json_reader *const r,
+                      struct builder *const b,
+                      bool const defer,
+                      int32_t *const sum,
+                      uint64_t *const build_ns) {
+  if (!json_peek(r, '{')) {
+    if (json_skip_value(r, 0)) {
+      json_skip_space(r);
+      if (r->pos == r->end) {
+        strcpy(r->error128, "JSON root is not an object");
+      } else {
+        json_unexpected(r);
+      }
+    }
+    return false;
+  }
+  ++r->pos;
+  bool first = true;
+  for (;;) {
+    enum json_member const member = json_next_member(r, &first);
+    if (member == json_member_end) {
+      break;
+    }
+    if (member == json_member_failed) {
+      return false;
+    }
+    char32_t name[4];
+    size_t len = 0;
+    bool valid = true;
+    if (!json_read_string(r, name, ARRAY_SIZE(name), &len, &valid) || !json_expect(r, ':')) {
+      return false;
+    }
+    char const **at = NULL;
+    if (valid && len == 3 && name[1] == 'W' && '1' <= name[2]) {
+      size_t const n = (size_t)(name[2] - '1');
+      switch (name[0]) {
+      case 'U':
+        at = n < ARRAY_SIZE(b->uni_at) ? &b->uni_at[n] : NULL;
+        break;
+      case 'B':
+        at = n < ARRAY_SIZE(b->bi_at) ? &b->bi_at[n] : NULL;
+        break;
+      case 'T':
+        at = n < ARRAY_SIZE(b->tri_at) ? &b->tri_at[n] : NULL;
+        break;
+      }
+    }
+    if (!at) {
+      if (!json_skip_value(r, 1)) {
+        return false;
+      }
+      continue;
+    }
+    char const key[4] = {(char)name[0], 'W', (char)name[2], '\0'};
+    if (!json_peek(r, '{')) {
+      sprintf(r->error128, "JSON key %s is not an object", key);
+      return false;
+    }
+    if (*at) {
+      sprintf(r->error128, "Duplicate key %s", key);
+      return false;
+    }
+    *at = r->pos;
+    if (defer) {
+      if (!json_skip_value(r, 1)) {
+        return false;
+      }
+      continue;
+    }
+    uint64_t const phase_start = instrument_now();
+    size_t const slot = (size_t)(name[2] - '1');
+    switch (name[0]) {
+    case 'U':
+      if (!load_unigram_weights(r, b->uni, slot, sum)) {
+        return false;
+      }
+      build_ns[0] += instrument_since(phase_start);
+      break;
+    case 'B':
+      if (!load_bigram_weights(r, b->bi, slot, sum)) {
+        return false;
+      }
+      build_ns[1] += instrument_since(phase_start);
+      break;
+    case 'T':
+      if (!load_trigram_weights(r, b->tri, slot, sum)) {
+        return false;
+      }
+      build_ns[2] += instrument_since(phase_start);
+      break;
+    }
+  }
+  json_skip_space(r);
+  if (r->pos != r->end) {
+    json_unexpected(r);
+    return false;
+  }
+  return true;
+}
+
+// Missing weight objects are only reported once the others have been read, so that errors in them come first.
+static bool builder_complete(struct builder const *const b, char *const error128) {
+  for (size_t i = 0; i < ARRAY_SIZE(b->uni_at); ++i) {
+    if (!b->uni_at[i]) {
+      sprintf(error128, "Missing key UW%zu", i + 1);
+      return false;
+    }
+  }
+  for (size_t i = 0; i < ARRAY_SIZE(b->bi_at); ++i) {
+    if (!b->bi_at[i]) {
+      sprintf(error128, "Missing key BW%zu", i + 1);
+      return false;
+    }
+  }
+  for (size_t i = 0; i < ARRAY_SIZE(b->tri_at); ++i) {
+    if (!b->tri_at[i]) {
+      sprintf(error128, "Missing key TW%zu", i + 1);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Builds the maps that read_root has deferred, one table per item. Each table has its own sum and error buffer, which
+// are merged once all of them are built.
+struct build_job {
+  struct builder *b;
+  char const *begin;
+  char const *end;
+  int32_t sums[BINARY_TABLES];
+  uint64_t build_ns[BINARY_TABLES];
+  char errors[BINARY_TABLES][128];
+};
+
+static bool build_table(void *const ctx, size_t const worker, size_t const item) {
+  (void)worker;
+  struct build_job *const job = ctx;
+  struct builder *const b = job->b;
+  struct json_reader r = {
+      .begin = job->begin,
+      .end = job->end,
+      .error128 = job->errors[item],
+  };
+  uint64_t const phase_start = instrument_now();
+  switch (item) {
+  case 0:
+    for (size_t i = 0; i < ARRAY_SIZE(b->uni_at); ++i) {
+      r.pos = b->uni_at[i];
+      if (r.pos && !load_unigram_weights(&r, b->uni, i, &job->sums[item])) {
+        return false;
+      }
+    }
+    break;
+  case 1:
+    for (size_t i = 0; i < ARRAY_SIZE(b->bi_at); ++i) {
+      r.pos = b->bi_at[i];
+      if (r.pos && !load_bigram_weights(&r, b->bi, i, &job->sums[item])) {
+        return false;
+      }
+    }
+    break;
+  case 2:
+    for (size_t i = 0; i < ARRAY_SIZE(b->tri_at); ++i) {
+      r.pos = b->tri_at[i];
+      if (r.pos && !load_trigram_weights(&r, b->tri, i, &job->sums[item])) {
+        return false;
+      }
+    }
+    break;
+  }
+  job->build_ns[item] = instrument_since(phase_start);
+  return true;
+}
+
+static struct budouxc *init_json(struct budouxc_allocators const *const allocators,
+                                 char const *const json,
+                                 size_t const json_len,
+                                 size_t threads,
+                                 char *const error128) {
+  struct budouxc *model = NULL;
+  struct builder b = {0};
+  struct arena scratch = {0};
+  if (!json || !json_len) {
+    strcpy(error128, "Invalid arguments");
+    return NULL;
+  }
+  threads = usable_threads(threads);
+
+  model = model_new(allocators, error128);
+  if (!model) {
+    goto failed;
+  }
+  scratch = arena_new(&model->allocators);
+  if (!builder_init(&b, &model->allocators)) {
+    strcpy(error128, "Out of memory");
+    goto failed;
+  }
+
+  // With more than one thread, the weight objects are only located while reading the JSON, and each map is then built
+  // from them on a thread of its own.
+  struct json_reader r = {
+      .begin = json,
+      .pos = json,
+      .end = json + json_len,
+      .error128 = error128,
+  };
+  int32_t sum = 0;
+  uint64_t build_ns[BINARY_TABLES] = {0};
+  uint64_t const read_start = instrument_now();
+  if (!read_root(&r, &b, threads > 1, &sum, build_ns)) {
+    goto failed;
+  }
+  uint64_t read_ns = instrument_since(read_start);
+  if (threads > 1) {
+    struct build_job job = {
+        .b = &b,
+        .begin = json,
+        .end = json + json_len,
+    };
+    if (!parallel_for(&scratch, BINARY_TABLES, threads, build_table, &job, error128)) {
+      for (size_t i = 0; i < BINARY_TABLES; ++i) {
+        if (job.errors[i][0]) {
+          strcpy(error128, job.errors[i]);
+          break;
+        }
+      }
+      goto failed;
+    }
+    for (size_t i = 0; i < BINARY_TABLES; ++i) {
+      sum += job.sums[i];
+      build_ns[i] = job.build_ns[i];
+    }
+  } else {
+    read_ns -= build_ns[0] + build_ns[1] + build_ns[2];
+  }
+  if (!builder_complete(&b, error128)) {
+    goto failed;
+  }
+  instrument_init_phase(budouxc_init_phase_json_parse, read_ns);
+  instrument_init_phase(budouxc_init_phase_build_unigram, build_ns[0]);
+  instrument_init_phase(budouxc_init_phase_build_bigram, build_ns[1]);
+  instrument_init_phase(budouxc_init_phase_build_trigram, build_ns[2]);
+
+  uint64_t const phase_start = instrument_now();
+  size_t binary_size = 0;
+  void *const binary = builder_freeze(&b, sum, &model->allocators, &scratch, threads, &binary_size, error128);
+  if (!binary) {
+    goto failed;
+  }
+  builder_destroy(&b);
+  arena_destroy(&scratch);
+
+  model->storage = storage_owned;
+  model->storage_ptr = binary;
+  model->storage_size = binary_size;
+  if (!attach_binary(model, binary, binary_size, error128)) {
+    goto failed;
+  }
+  instrument_init_phase(budouxc_init_phase_freeze, instrument_since(phase_start));
+  return model;
+failed:
+  builder_destroy(&b);
+  arena_destroy(&scratch);
+  if (model) {
+    budouxc_destroy(model);
+  }
+  return NULL;
+}
+
+struct budouxc *BUDOUXC_DECLSPEC budouxc_init(struct budouxc_allocators const *const allocators,
+                                              char const *const json,
+                                              size_t const json_len,
+                                              char *error128) {
+  return init_json(allocators, json, json_len, 1, error128);
+}
+
+struct budouxc *BUDOUXC_DECLSPEC budouxc_init_parallel(struct budouxc_allocators const *const allocators,
+                                                       char const *const json,
+                                                       size_t const json_len,
+                                                       size_t const threads,
+                                                       char *error128) {
+  return init_json(allocators, json, json_len, threads, error128);
+}
+
+struct budouxc *BUDOUXC_DECLSPEC budouxc_init_binary(struct budouxc_allocators const *const allocators,
+                                                     void const *const data,
+                                                     size_t const data_len,
+                                                     char *error128) {
+  if (!data || !data_len) {
+    strcpy(error128, "Invalid arguments");
+    return NULL;
+  }
+  uint64_t const start = instrument_now();
+  struct budouxc *const model = model_new(allocators, error128);
+  if (!model) {
+    return NULL;
+  }
+  model->storage = storage_borrowed;
+  if (!attach_binary(model, data, data_len, error128)) {
+    budouxc_destroy(model);
+    return NULL;
+  }
+  instrument_init_phase(budouxc_init_phase_load_binary, instrument_since(start));
+  return model;
+}
+
+struct budouxc *BUDOUXC_DECLSPEC budouxc_init_mmap(struct budouxc_allocators const *const allocators,
+                                                   char const *const path,
+                                                   char *error128) {
+  if (!path) {
+    strcpy(error128, "Invalid arguments");
+    return NULL;
+  }
+  uint64_t const start = instrument_now();
+  struct budouxc *const model = model_new(allocators, error128);
+  if (!model) {
+    return NULL;
+  }
+  model->storage = storage_mapped;
+  model->storage_ptr = map_file(path, &model->storage_size, &model->allocators, error128);
+  if (!model->storage_ptr || !attach_binary(model, model->storage_ptr, model->storage_size, error128)) {
+    budouxc_destroy(model);
+    return NULL;
+  }
+  instrument_init_phase(budouxc_init_phase_load_binary, instrument_since(start));
+  return model;
+}
+
+static bool record_below(int32_t const *const record, unsigned int const width, int32_t const threshold) {
+  for (size_t i = 0; i < width; ++i) {
+    if (record[i] >= threshold || record[i] <= -threshold) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Lays out a copy of a model that is not compact, without the records whose weights are all below the threshold. The
+// character map is copied as is, so characters that only appeared in removed n-grams still get probed.
+static void *prune_freeze(struct budouxc const *const source,
+                          int32_t const threshold,
+                          struct budouxc_allocators const *const allocators,
+                          size_t *const size,
+                          char *const error128) {
+  struct binary_header const *const src = source->binary;
+  struct ftable const *const tables[BINARY_TABLES] = {&source->uni, &source->bi, &source->tri};
+  struct binary_header h = *src;
+  size_t offset = sizeof(struct binary_header) + charmap_size(src->charmap.pages);
+  h.charmap.offset = sizeof(struct binary_header);
+  for (size_t i = 0; i < BINARY_TABLES; ++i) {
+    struct ftable const *const t = tables[i];
+    size_t n = 0;
+    for (size_t j = 0; j <= t->mask; ++j) {
+      n += t->keys[j] != FTABLE_EMPTY_KEY && !record_below(t->values + j * t->width, t->width, threshold);
+    }
+    struct binary_table *const bt = &h.tables[i];
+    bt->offset = offset;
+    bt->bits = ftable_bits(n);
+    offset += ftable_size(bt->bits, bt->width);
+  }
+  h.size = offset;
+
+  uint8_t *const base = allocators->fn_realloc(NULL, offset, allocators->user_data);
+  if (!base) {
+    strcpy(error128, "Out of memory");
+    return NULL;
+  }
+  memcpy(base, &h, sizeof(h));
+  memcpy(base + h.charmap.offset, (uint8_t const *)src + src->charmap.offset, charmap_size(src->charmap.pages));
+  for (size_t i = 0; i < BINARY_TABLES; ++i) {
+    struct ftable const *const t = tables[i];
+    struct binary_table const *const bt = &h.tables[i];
+    ftable_clear(base + bt->offset, bt->bits);
+    for (size_t j = 0; j <= t->mask; ++j) {
+      int32_t const *const record = t->values + j * t->width;
+      if (t->keys[j] != FTABLE_EMPTY_KEY && !record_below(record, t->width, threshold)) {
+        ftable_insert(base + bt->offset, bt->bits, bt->width, t->keys[j], record);
+      }
+    }
+  }
+  *size = offset;
+  return base;
+}
+
+// Lays out a compact copy of a model that is not compact itself, reading the keys and records of its frozen tables.
+static void *compact_freeze(struct budouxc const *const source,
+                            struct budouxc_allocators const *const allocators,
+                            size_t *const size,
+                            char *const error128) {
+  struct binary_header const *const src = source->binary;
+  struct ftable const *const tables[BINARY_TABLES] = {&source->uni, &source->bi, &source->tri};
+  unsigned int id_bits = 1;
+  while (((uint64_t)1 << id_bits) <= src->charmap.ids) {
+    ++id_bits;
+  }
+  struct binary_header h = {
+      .magic = BINARY_MAGIC,
+      .version = BINARY_VERSION,
+      .byte_order = BINARY_BYTE_ORDER,
+      .sum = src->sum,
+      .flags = BINARY_FLAG_COMPACT,
+      .id_bits = id_bits,
+      .charmap =
+          {
+              .offset = sizeof(struct binary_header),
+              .pages = src->charmap.pages,
+              .ids = src->charmap.ids,
+          },
+  };
+  size_t offset = sizeof(struct binary_header) + charmap_size(src->charmap.pages);
+  for (size_t i = 0; i < BINARY_TABLES; ++i) {
+    struct ftable const *const t = tables[i];
+    size_t n = 0;
+    int32_t min = 0;
+    int32_t max = 0;
+    for (size_t j = 0; j <= t->mask; ++j) {
+      if (t->keys[j] == FTABLE_EMPTY_KEY) {
+        continue;
+      }
+      ++n;
+      for (size_t k = 0; k < t->width; ++k) {
+        int32_t const v = t->values[j * t->width + k];
+        min = v < min ? v : min;
+        max = v > max ? v : max;
+      }
+    }
+    unsigned int key_size = sizeof(uint16_t);
+    while (key_size * 8 < (i + 1) * id_bits) {
+      key_size *= 2;
+    }
+    struct binary_table *const bt = &h.tables[i];
+    *bt = (struct binary_table){
+        .offset = offset,
+        .bits = ctable_bits(n),
+        .width = t->width,
+        .key_size = key_size,
+        .value_shift = quantize_shift(min, max),
+    };
+    offset += ctable_size(bt->bits, bt->width, bt->key_size);
+  }
+  h.size = offset;
+
+  uint8_t *const base = allocators->fn_realloc(NULL, offset, allocators->user_data);
+  if (!base) {
+    strcpy(error128, "Out of memory");
+    return NULL;
+  }
+  memset(base, 0, offset);
+  memcpy(base, &h, sizeof(h));
+  memcpy(base + h.charmap.offset, (uint8_t const *)src + src->charmap.offset, charmap_size(src->charmap.pages));
+  for (size_t i = 0; i < BINARY_TABLES; ++i) {
+    struct ftable const *const t = tables[i];
+    struct binary_table const *const bt = &h.tables[i];
+    for (size_t j = 0; j <= t->mask; ++j) {
+      uint64_t const key = t->keys[j];
+      if (key == FTABLE_EMPTY_KEY) {
+        continue;
+      }
+      uint64_t packed = 0;
+      for (size_t c = 0; c <= i; ++c) {
+        packed = (packed << id_bits) | ((key >> (CHAR_ID_BITS * (i - c))) & CHAR_ID_MAX);
+      }
+      ctable_insert(
+          base + bt->offset, bt->bits, bt->width, bt->key_size, bt->value_shift, packed, t->values + j * t->width);
+    }
+  }
+  *size = offset;
+  return base;
+}
+
+struct budouxc *BUDOUXC_DECLSPEC budouxc_init_compact(struct budouxc_allocators const *const allocators,
+                                                      struct budouxc const *const source,
+                                                      char *error128) {
+  if (!source) {
+    strcpy(error128, "Invalid arguments");
+    return NULL;
+  }
+  if (source->compact) {
+    strcpy(error128, "Model is already compact");
+    return NULL;
+  }
+  struct budouxc *const model = model_new(allocators, error128);
+  if (!model) {
+    return NULL;
+  }
+  model->storage = storage_owned;
+  model->storage_ptr = compact_freeze(source, &model->allocators, &model->storage_size, error128);
+  if (!model->storage_ptr || !attach_binary(model, model->storage_ptr, model->storage_size, error128)) {
+    budouxc_destroy(model);
+    return NULL;
+  }
+  return model;
+}
+
+struct budouxc *BUDOUXC_DECLSPEC budouxc_init_pruned(struct budouxc_allocators const *const allocators,
+                                                     struct budouxc const *const source,
+                                                     int32_t const threshold,
+                                                     char *error128) {
+  if (!source || threshold < 0) {
+    strcpy(error128, "Invalid arguments");
+    return NULL;
+  }
+  if (source->compact) {
+    strcpy(error128, "Compact models cannot be pruned");
+    return NULL;
+  }
+  struct budouxc *const model = model_new(allocators, error128);
+  if (!model) {
+    return NULL;
+  }
+  model->storage = storage_owned;
+  model->storage_ptr = prune_freeze(source, threshold, &model->allocators, &model->storage_size, error128);
+  if (!model->storage_ptr || !attach_binary(model, model->storage_ptr, model->storage_size, error128)) {
+    budouxc_destroy(model);
+    return NULL;
+  }
+  return model;
+}
+
+size_t BUDOUXC_DECLSPEC budouxc_model_bytes(struct budouxc const *const model) {
+  if (!model) {
+    return 0;
+  }
+  // A mapped file may be longer than the binary model it holds, and all of it is mapped.
+  return sizeof(struct budouxc) + (model->storage == storage_mapped ? model->storage_size : model->binary_size);
+}
+
+// Model statistics ----
+
+// Both kinds of tables are read through the binary header, so that one scan covers them. Keys are widened to 64 bits
+// and empty slots read as FTABLE_EMPTY_KEY.
+static uint64_t stats_key(void const *const keys, unsigned int const key_size, bool const compact, size_t const i) {
+  uint64_t key;
+  switch (key_size) {
+  case sizeof(uint16_t):
+    key = ((uint16_t const *)keys)[i];
+    break;
+  case sizeof(uint32_t):
+    key = ((uint32_t const *)keys)[i];
+    break;
+  default:
+    key = ((uint64_t const *)keys)[i];
+    break;
+  }
+  return compact && key == 0 ? FTABLE_EMPTY_KEY : key;
+}
+
+static void stats_table(struct budouxc const *const model,
+                        size_t const table,
+                        struct budouxc_table_stats *const ts,
+                        size_t *const weights) {
+  struct binary_table const *const bt = &((struct binary_header const *)model->binary)->tables[table];
+  uint8_t const *const base = (uint8_t const *)model->binary + bt->offset;
+  size_t const cap = (size_t)1 << bt->bits;
+  size_t const mask = cap - 1;
+  void const *const records =
+      base + (model->compact ? ctable_keys_size(bt->bits, bt->key_size) : cap * sizeof(uint64_t));
+  size_t probes = 0;
+  size_t empty = SIZE_MAX;
+  for (size_t i = 0; i < cap; ++i) {
+    uint64_t const key = stats_key(base, bt->key_size, model->compact, i);
+    if (key == FTABLE_EMPTY_KEY) {
+      empty = i;
+      continue;
+    }
+    size_t const n = ((i - ftable_hash(key, 64 - bt->bits)) & mask) + 1;
+    ++ts->entries;
+    ++ts->probe_lengths[n < BUDOUXC_PROBE_LENGTHS ? n - 1 : BUDOUXC_PROBE_LENGTHS - 1];
+    probes += n;
+    for (size_t j = 0; j < bt->width; ++j) {
+      bool const nonzero = model->compact ? ((int16_t const *)records)[i * bt->width + j] != 0
+                                          : ((int32_t const *)records)[i * bt->width + j] != 0;
+      if (nonzero) {
+        ++weights[j];
+      }
+    }
+  }
+  // A miss starting at a slot probes up to and including the next empty slot. Walking backwards from an empty slot
+  // gives each slot's distance from the one before it.
+  size_t miss_probes = 0;
+  if (empty == SIZE_MAX) {
+    // A full table never ends a miss. Counting every slot once keeps the average finite.
+    miss_probes = cap * cap;
+  } else {
+    for (size_t k = 0, run = 0; k < cap; ++k) {
+      size_t const i = (empty - k) & mask;
+      run = stats_key(base, bt->key_size, model->compact, i) == FTABLE_EMPTY_KEY ? 1 : run + 1;
+      miss_probes += run;
+    }
+  }
+  ts->capacity = cap;
+  ts->bytes = model->compact ? ctable_size(bt->bits, bt->width, bt->key_size) : ftable_size(bt->bits, bt->width);
+  ts->load_factor = (double)ts->entries / (double)cap;
+  ts->average_probes = ts->entries ? (double)probes / (double)ts->entries : 0.0;
+  ts->average_miss_probes = (double)miss_probes / (double)cap;
+#ifdef BUDOUXC_COUNT_LOOKUPS
+  ts->hits = atomic_load_explicit(&model->counts[table].hits, memory_order_relaxed);
+  ts->misses = atomic_load_explicit(&model->counts[table].misses, memory_order_relaxed);
+  ts->skipped = atomic_load_explicit(&model->counts[table].skipped, memory_order_relaxed);
+#endif
+}
+
+bool BUDOUXC_DECLSPEC budouxc_model_stats(struct budouxc const *const model, struct budouxc_model_stats *const stats) {
+  if (!model || !stats) {
+    return false;
+  }
+  struct binary_header const *const h = model->binary;
+  *stats = (struct budouxc_model_stats){
+      .bytes = budouxc_model_bytes(model),
+      .charmap_bytes = charmap_size(h->charmap.pages),
+      .characters = h->charmap.ids,
+      .sum = model->sum,
+      .base_score = -(double)model->sum / 2.0,
+      .compact = model->compact,
+  };
+#ifdef BUDOUXC_COUNT_LOOKUPS
+  stats->counting = true;
+#endif
+  stats_table(model, 0, &stats->tables[0], stats->weights);
+  stats_table(model, 1, &stats->tables[1], stats->weights + UNIGRAM_SLOTS);
+  stats_table(model, 2, &stats->tables[2], stats->weights + UNIGRAM_SLOTS + BIGRAM_SLOTS);
+  return true;
+}
+
+size_t BUDOUXC_DECLSPEC budouxc_write_binary(struct budouxc const *const model,
+                                             void *const dest,
+                                             size_t const dest_len) {
+  if (!model) {
+    return 0;
+  }
+  if (dest && dest_len >= model->binary_size) {
+    memcpy(dest, model->binary, model->binary_size);
+  }
+  return model->binary_size;
+}
+
+// Reverses the bytes of each of the n values of size bytes at p.
+static void swap_bytes(uint8_t *p, size_t const size, size_t const n) {
+  for (size_t i = 0; i < n; ++i, p += size) {
+    for (size_t j = 0; j < size / 2; ++j) {
+      uint8_t const b = p[j];
+      p[j] = p[size - 1 - j];
+      p[size - 1 - j] = b;
+    }
+  }
+}
+
+size_t BUDOUXC_DECLSPEC budouxc_write_binary_swapped(struct budouxc const *const model,
+                                                     void *const dest,
+                                                     size_t const dest_len) {
+  if (!model) {
+    return 0;
+  }
+  if (!dest || dest_len < model->binary_size) {
+    return model->binary_size;
+  }
+  // The layout is read from the model's own copy, which is in the byte order of the running machine.
+  struct binary_header const *const h = model->binary;
+  uint8_t *const base = dest;
+  memcpy(base, h, model->binary_size);
+  swap_bytes(base + offsetof(struct binary_header, version), sizeof(uint32_t), 3);
+  swap_bytes(base + offsetof(struct binary_header, size), sizeof(uint64_t), 1);
+  swap_bytes(base + offsetof(struct binary_header, flags), sizeof(uint32_t), 2);
+  uint8_t *const charmap = base + offsetof(struct binary_header, charmap);
+  swap_bytes(charmap + offsetof(struct binary_charmap, offset), sizeof(uint64_t), 1);
+  swap_bytes(charmap + offsetof(struct binary_charmap, pages), sizeof(uint32_t), 2);
+  swap_bytes(
+      base + (size_t)h->charmap.offset, sizeof(uint16_t), CHARMAP_INDEX_SIZE + h->charmap.pages * CHARMAP_PAGE_SIZE);
+  for (size_t i = 0; i < BINARY_TABLES; ++i) {
+    struct binary_table const *const bt = &h->tables[i];
+    uint8_t *const table = base + offsetof(struct binary_header, tables) + i * sizeof(struct binary_table);
+    swap_bytes(table + offsetof(struct binary_table, offset), sizeof(uint64_t), 1);
+    swap_bytes(table + offsetof(struct binary_table, bits), sizeof(uint32_t), 4);
+    size_t const cap = (size_t)1 << bt->bits;
+    uint8_t *const keys = base + (size_t)bt->offset;
+    if (model->compact) {
+      swap_bytes(keys, bt->key_size, cap);
+      swap_bytes(keys + ctable_keys_size(bt->bits, bt->key_size), sizeof(int16_t), cap * bt->width);
+    } else {
+      swap_bytes(keys, sizeof(uint64_t), cap);
+      swap_bytes(keys + cap * sizeof(uint64_t), sizeof(int32_t), cap * bt->width);
+    }
+  }
+  return model->binary_size;
+}
+
+// Scoring ----
+
+// The boundary before character i depends on characters i-3 to i+2. Instead of looking up every n-gram in every slot,
+// each character completes one unigram, one bigram and one trigram, whose records are kept in a small ring indexed by
+// the position where the n-gram starts. Positions outside of the sentence hold zero_record.
+// Characters are converted to IDs once when they enter the ring. An n-gram containing an out-of-vocabulary character
+// cannot be in the model, so it gets zero_record without a table lookup.
+
+struct features {
+  int32_t const *uni;
+  int32_t const *bi;
+  int32_t const *tri;
+};
+
+// Records of a compact model are scaled back into the window, and the features point to these copies.
+struct records {
+  int32_t uni[UNIGRAM_SLOTS];
+  int32_t bi[BIGRAM_SLOTS];
+  int32_t tri[TRIGRAM_SLOTS];
+};
+
+struct window {
+  uint16_t id[8];
+  struct features f[8];
+  struct records r[8];
+  // Number of consecutive out-of-vocabulary positions up to the last one added, counting positions outside of the
+  // sentence as out-of-vocabulary.
+  size_t oov_run;
+};
+
+// Counts a lookup in table #table of the binary model when built with BUDOUXC_COUNT_LOOKUPS.
+static inline int32_t const *
+count_lookup(struct budouxc const *const model, size_t const table, int32_t const *const record) {
+#ifdef BUDOUXC_COUNT_LOOKUPS
+  atomic_fetch_add_explicit(
+      record == zero_record ? &model->counts[table].misses : &model->counts[table].hits, 1, memory_order_relaxed);
+#else
+  (void)model;
+  (void)table;
+#endif
+  return record;
+}
+
+// Counts an n-gram that was not looked up because one of its characters is out-of-vocabulary.
+static inline int32_t const *count_skip(struct budouxc const *const model, size_t const table) {
+#ifdef BUDOUXC_COUNT_LOOKUPS
+  atomic_fetch_add_explicit(&model->counts[table].skipped, 1, memory_order_relaxed);
+#else
+  (void)model;
+  (void)table;
+#endif
+  return zero_record;
+}
+
+// dest is only written for a compact model.
+static inline int32_t const *
+lookup_unigram(struct budouxc const *const model, uint16_t const id0, struct records *const dest) {
+  if (id0 == CHAR_ID_OOV) {
+    return count_skip(model, 0);
+  }
+  if (model->compact) {
+    return count_lookup(model, 0, ctable_get(&model->cuni, (uint64_t)id0, dest->uni));
+  }
+  return count_lookup(model, 0, ftable_get(&model->uni, (uint64_t)id0));
+}
+
+static inline int32_t const *lookup_bigram(struct budouxc const *const model,
+                                           uint16_t const id0,
+                                           uint16_t const id1,
+                                           struct records *const dest) {
+  if (id0 == CHAR_ID_OOV || id1 == CHAR_ID_OOV) {
+    return count_skip(model, 1);
+  }
+  if (model->compact) {
+    return count_lookup(model, 1, ctable_get(&model->cbi, ((uint64_t)id0 << model->id_bits) | (uint64_t)id1, dest->bi));
+  }
+  return count_lookup(model, 1, ftable_get(&model->bi, ((uint64_t)id0 << CHAR_ID_BITS) | (uint64_t)id1));
+}
+
+static inline int32_t const *lookup_trigram(struct budouxc const *const model,
+                                            uint16_t const id0,
+                                            uint16_t const id1,
+                                            uint16_t const id2,
+                                            struct records *const dest) {
+  if (id0 == CHAR_ID_OOV || id1 == CHAR_ID_OOV || id2 == CHAR_ID_OOV) {
+    return count_skip(model, 2);
+  }
+  if (model->compact) {
+    uint64_t const key =
+        ((uint64_t)id0 << (model->id_bits * 2)) | ((uint64_t)id1 << model->id_bits) | (uint64_t)id2;
+    return count_lookup(model, 2, ctable_get(&model->ctri, key, dest->tri));
+  }
+  uint64_t const key = ((uint64_t)id0 << (CHAR_ID_BITS * 2)) | ((uint64_t)id1 << CHAR_ID_BITS) | (uint64_t)id2;
+  return count_lookup(model, 2, ftable_get(&model->tri, key));
+}
+
+static inline void window_init(struct window *const w) {
+  for (size_t i = 0; i < ARRAY_SIZE(w->f); ++i) {
+    w->id[i] = CHAR_ID_OOV;
+    w->f[i] = (struct features){zero_record, zero_record, zero_record};
+  }
+  w->oov_run = 3;
+}
+
+// Adds the character at position k, completing the unigram at k, the bigram at k-1 and the trigram at k-2.
+static inline void
+window_push(struct window *const w, struct budouxc const *const model, size_t const k, char32_t const ch) {
+  uint16_t const id = charmap_get(&model->chars, ch);
+  w->id[k & 7] = id;
+  w->oov_run = id == CHAR_ID_OOV ? w->oov_run + 1 : 0;
+  w->f[k & 7].uni = lookup_unigram(model, id, &w->r[k & 7]);
+  if (k >= 1) {
+    w->f[(k - 1) & 7].bi = lookup_bigram(model, w->id[(k - 1) & 7], id, &w->r[(k - 1) & 7]);
+  }
+  if (k >= 2) {
+    w->f[(k - 2) & 7].tri = lookup_trigram(model, w->id[(k - 2) & 7], w->id[(k - 1) & 7], id, &w->r[(k - 2) & 7]);
+  }
+}
+
+// Marks position k as past the end of the sentence.
+static inline void window_end(struct window *const w, size_t const k) {
+  w->f[k & 7].uni = zero_record;
+  w->f[(k - 1) & 7].bi = zero_record;
+  w->f[(k - 2) & 7].tri = zero_record;
+  ++w->oov_run;
+}
+
+// Positions up to i+2 must have been pushed or ended.
+static inline int32_t window_score(struct window const *const w, size_t const i) {
+  struct features const *const m3 = &w->f[(i - 3) & 7];
+  struct features const *const m2 = &w->f[(i - 2) & 7];
+  struct features const *const m1 = &w->f[(i - 1) & 7];
+  struct features const *const p0 = &w->f[i & 7];
+  struct features const *const p1 = &w->f[(i + 1) & 7];
+  struct features const *const p2 = &w->f[(i + 2) & 7];
+  return m3->uni[0] + m2->uni[1] + m1->uni[2] + p0->uni[3] + p1->uni[4] + p2->uni[5] + m2->bi[0] + m1->bi[1] +
+         p0->bi[2] + m3->tri[0] + m2->tri[1] + m1->tri[2] + p0->tri[3];
+}
+
+// Decides position i once positions up to i+2 are in the window. A window that is entirely out-of-vocabulary scores 0
+// without reading any record.
+static inline bool window_boundary(struct window const *const w, size_t const i, FLOAT_TYPE const base_score) {
+  int32_t const score = w->oov_run >= 6 ? 0 : window_score(w, i);
+  return base_score + (FLOAT_TYPE)(score) > 0;
+}
+
+// Output ----
+
+// Boundaries are collected into a list that either grows with the model's allocators, or is a caller-provided buffer
+// that never grows. Boundaries past the end of a fixed buffer are only counted, so that the caller can learn the
+// required size. A list with a sink passes every boundary to it instead of storing it.
+struct boundary_list {
+  size_t *indices;
+  size_t len;
+  size_t cap;
+  bool fixed;
+  bool (*sink)(void *ctx, size_t i);
+  void *sink_ctx;
+};
+
+static bool boundary_list_add(struct budouxc const *const model, struct boundary_list *const l, size_t const i) {
+  if (l->sink) {
+    return l->sink(l->sink_ctx, i);
+  }
+  if (l->len >= l->cap) {
+    if (l->fixed) {
+      ++l->len;
+      return true;
+    }
+    size_t const newcap = l->cap ? l->cap * 2 : 16;
+    size_t *newbuf = model->allocators.fn_realloc(
+        l->indices, newcap * sizeof(size_t) + sizeof(struct budouxc_boundaries), model->allocators.user_data);
+    if (!newbuf) {
+      return false;
+    }
+    l->indices = newbuf;
+    l->cap = newcap;
+  }
+  l->indices[l->len++] = i;
+  return true;
+}
+
+// Places the result header right after the indices. The list is allocated even when there are no boundaries, since
+// the header needs somewhere to live.
+static struct budouxc_boundaries *boundary_list_finish(struct budouxc const *const model,
+                                                       struct boundary_list *const l) {
+  if (!l->indices) {
+    l->indices = model->allocators.fn_realloc(NULL, sizeof(struct budouxc_boundaries), model->allocators.user_data);
+    if (!l->indices) {
+      return NULL;
+    }
+  }
+  struct budouxc_boundaries *const ret = (void *)(l->indices + l->cap);
+  ret->indices = l->indices;
+  ret->n = l->len;
+  return ret;
+}
+
+struct budouxc_parser {
+  struct budouxc *model;
+  struct boundary_list list;
+  struct budouxc_boundaries result;
+};
+
+struct budouxc_parser *BUDOUXC_DECLSPEC budouxc_parser_init(struct budouxc *const model, char *error128) {
+  if (!model) {
+    strcpy(error128, "Invalid arguments");
+    return NULL;
+  }
+  struct budouxc_parser *const parser =
+      model->allocators.fn_realloc(NULL, sizeof(struct budouxc_parser), model->allocators.user_data);
+  if (!parser) {
+    strcpy(error128, "Out of memory");
+    return NULL;
+  }
+  *parser = (struct budouxc_parser){
+      .model = model,
+  };
+  return parser;
+}
+
+void BUDOUXC_DECLSPEC budouxc_parser_destroy(struct budouxc_parser *const parser) {
+  if (!parser) {
+    return;
+  }
+  struct budouxc_allocators const *const a = &parser->model->allocators;
+  if (parser->list.indices) {
+    a->fn_free(parser->list.indices, a->user_data);
+  }
+  a->fn_free(parser, a->user_data);
+}
+
+// Every input encoding is implemented once as parse_xxx, which appends to a boundary list. This defines the public
+// functions on top of it: one allocating the result, one writing into a caller-provided buffer and one reusing the
+// buffer of a parser.
+#define IMPL_PARSE_API(name, typ)                                                                                      \
+  struct budouxc_boundaries *BUDOUXC_DECLSPEC budouxc_parse_boundaries_##name(                                         \
+      struct budouxc *const model, typ const *const sentence, size_t const sentence_len, char *error128) {             \
+    uint64_t const start = instrument_now();                                                                           \
+    struct boundary_list l = {0};                                                                                      \
+    if (!parse_##name(model, sentence, sentence_len, &l, error128)) {                                                  \
+      goto failed;                                                                                                     \
+    }                                                                                                                  \
+    struct budouxc_boundaries *const ret = boundary_list_finish(model, &l);                                            \
+    if (!ret) {                                                                                                        \
+      strcpy(error128, "Out of memory");                                                                               \
+      goto failed;                                                                                                     \
+    }                                                                                                                  \
+    instrument_parse_##name(budouxc_entry_point_##name, start, sentence, sentence_len);                                \
+    return ret;                                                                                                        \
+  failed:                                                                                                              \
+    if (l.indices) {                                                                                                   \
+      model->allocators.fn_free(l.indices, model->allocators.user_data);                                               \
+    }                                                                                                                  \
+    return NULL;                                                                                                       \
+  }                                                                                                                    \
+  size_t BUDOUXC_DECLSPEC budouxc_parse_boundaries_##name##_into(struct budouxc *const model,                          \
+                                                                 typ const *const sentence,                            \
+                                                                 size_t const sentence_len,                            \
+                                                                 size_t *const indices,                                \
+                                                                 size_t const indices_len,                             \
+                                                                 char *error128) {                                     \
+    uint64_t const start = instrument_now();                                                                           \
+    struct boundary_list l = {                                                                                         \
+        .indices = indices,                                                                                            \
+        .cap = indices ? indices_len : 0,                                                                              \
+        .fixed = true,                                                                                                 \
+    };                                                                                                                 \
+    if (!parse_##name(model, sentence, sentence_len, &l, error128)) {                                                  \
+      return SIZE_MAX;                                                                                                 \
+    }                                                                                                                  \
+    instrument_parse_##name(budouxc_entry_point_##name, start, sentence, sentence_len);                                \
+    return l.len;                                                                                                      \
+  }                                                                                                                    \
+  struct budouxc_boundaries const *BUDOUXC_DECLSPEC budouxc_parser_parse_##name(                                       \
+      struct budouxc_parser *const parser, typ const *const sentence, size_t const sentence_len, char *error128) {     \
+    uint64_t const start = instrument_now();                                                                           \
+    parser->list.len = 0;                                                                                              \
+    if (!parse_##name(parser->model, sentence, sentence_len, &parser->list, error128)) {                               \
+      return NULL;                                                                                                     \
+    }                                                                                                                  \
+    parser->result = (struct budouxc_boundaries){                                                                      \
+        .indices = parser->list.indices,                                                                               \
+        .n = parser->list.len,                                                                                         \
+    };                                                                                                                 \
+    instrument_parse_##name(budouxc_entry_point_##name, start, sentence, sentence_len);                                \
+    return &parser->result;                                                                                            \
+  }                                                                                                                    \
+  struct budouxc_boundaries const *BUDOUXC_DECLSPEC budouxc_parser_parse_##name(                                       \
+      struct budouxc_parser *const parser, typ const *const sentence, size_t const sentence_len, char *error128)
+
+// When every character from i-3 to i+2 is out-of-vocabulary, all records in the window are zero_record and the score
+// of position i is exactly 0. Such runs are decided in bulk from base_score alone: the parser only scans for the next
+// character in vocabulary and restarts the window right before it.
+// parse_range_xxx only decides positions from begin to end - 1, reading at most 3 characters before begin and 2
+// characters from end, so that a sentence can be parsed in independent chunks.
+#define IMPL_PARSE(bits)                                                                                               \
+  static inline size_t skip_oov_char##bits(                                                                            \
+      struct charmap const *const cm, char##bits##_t const *const sentence, size_t k, size_t const sentence_len) {     \
+    while (k < sentence_len && charmap_get(cm, sentence[k]) == CHAR_ID_OOV) {                                          \
+      ++k;                                                                                                             \
+    }                                                                                                                  \
+    return k;                                                                                                          \
+  }                                                                                                                    \
+  static bool parse_range_utf##bits(struct budouxc const *const model,                                                 \
+                                    char##bits##_t const *const sentence,                                              \
+                                    size_t const sentence_len,                                                         \
+                                    size_t const begin,                                                                \
+                                    size_t const end,                                                                  \
+                                    struct boundary_list *const l,                                                     \
+                                    char *const error128) {                                                            \
+    struct window w;                                                                                                   \
+    window_init(&w);                                                                                                   \
+    for (size_t k = begin > 3 ? begin - 3 : 0; k < begin + 2 && k < sentence_len; ++k) {                               \
+      window_push(&w, model, k, (char32_t)sentence[k]);                                                                \
+    }                                                                                                                  \
+    size_t const scan_end = end + 3 < sentence_len ? end + 3 : sentence_len;                                           \
+    FLOAT_TYPE const base_score = (FLOAT_TYPE)(model->sum) * (FLOAT_TYPE)(-0.5);                                       \
+    for (size_t i = begin; i < end; ++i) {                                                                             \
+      if (i + 2 < sentence_len) {                                                                                      \
+        window_push(&w, model, i + 2, (char32_t)sentence[i + 2]);                                                      \
+      } else {                                                                                                         \
+        window_end(&w, i + 2);                                                                                         \
+      }                                                                                                                \
+      if (w.oov_run >= 6) {                                                                                            \
+        size_t const next = skip_oov_char##bits(&model->chars, sentence, i + 3, scan_end);                             \
+        size_t last = next >= sentence_len ? sentence_len - 1 : next - 3;                                              \
+        if (last >= end) {                                                                                             \
+          last = end - 1;                                                                                              \
+        }                                                                                                              \
+        if (base_score > 0) {                                                                                          \
+          for (size_t j = i ? i : 1; j <= last; ++j) {                                                                 \
+            if (!boundary_list_add(model, l, j)) {                                                                     \
+              strcpy(error128, "Out of memory");                                                                       \
+              return false;                                                                                            \
+            }                                                                                                          \
+          }                                                                                                            \
+        }                                                                                                              \
+        window_init(&w);                                                                                               \
+        i = last;                                                                                                      \
+        continue;                                                                                                      \
+      }                                                                                                                \
+      if (i == 0) {                                                                                                    \
+        continue;                                                                                                      \
+      }                                                                                                                \
+      if (base_score + (FLOAT_TYPE)(window_score(&w, i)) > 0) {                                                        \
+        if (!boundary_list_add(model, l, i)) {                                                                         \
+          strcpy(error128, "Out of memory");                                                                           \
+          return false;                                                                                                \
+        }                                                                                                              \
+      }                                                                                                                \
+    }                                                                                                                  \
+    return true;                                                                                                       \
+  }                                                                                                                    \
+  static bool parse_utf##bits(struct budouxc const *const model,                                                       \
+                              char##bits##_t const *const sentence,                                                    \
+                              size_t const sentence_len,                                                               \
+                              struct boundary_list *const l,                                                           \
+                              char *const error128) {                                                                  \
+    return parse_range_utf##bits(model, sentence, sentence_len, 0, sentence_len, l, error128);                         \
+  }                                                                                                                    \
+  IMPL_PARSE_API(utf##bits, char##bits##_t)
+
+// I think it is not correct as an implementation to ignore surrogate pairs,
+// but it seems that BudouX's JavaScript implementation does not consider surrogate pairs.
+// Therefore, in this implementation, we will also ignore surrogate pairs.
+IMPL_PARSE(16);
+IMPL_PARSE(32);
+
+bool BUDOUXC_DECLSPEC budouxc_parse_boundaries_callback(struct budouxc *const model,
+                                                        char32_t (*get_char)(void *userdata),
+                                                        bool (*add_boundary)(size_t const boundary, void *userdata),
+                                                        void *userdata) {
+  uint64_t const start = instrument_now();
+  struct window w;
+  window_init(&w);
+  size_t sentence_len = SIZE_MAX;
+
+  for (size_t i = 0; i < 3; ++i) {
+    char32_t const ch = get_char(userdata);
+    window_push(&w, model, i, ch);
+    if (ch == 0) {
+      sentence_len = i + 1;
+      break;
+    }
+  }
+
+  FLOAT_TYPE const base_score = (FLOAT_TYPE)(model->sum) * (FLOAT_TYPE)(-0.5);
+  for (size_t i = 0; i < sentence_len; ++i) {
+    if (i + 3 < sentence_len) {
+      char32_t const ch = get_char(userdata);
+      if (ch == 0) {
+        sentence_len = i + 3;
+        window_end(&w, i + 3);
+      } else {
+        window_push(&w, model, i + 3, ch);
+      }
+    } else {
+      window_end(&w, i + 3);
+    }
+
+    if (i == 0) {
+      // Position 0 is scored as if the sentence were preceded by U+0000. Slot 7 is free until position 7 is pushed.
+      uint16_t const nul = charmap_get(&model->chars, 0);
+      w.f[7] = (struct features){
+          .uni = lookup_unigram(model, nul, &w.r[7]),
+          .bi = lookup_bigram(model, nul, w.id[0], &w.r[7]),
+          .tri = sentence_len > 1 ? lookup_trigram(model, nul, w.id[0], w.id[1], &w.r[7]) : zero_record,
+      };
+    }
+    int32_t const score = window_score(&w, i);
+    if (i == 0) {
+      w.f[7] = (struct features){zero_record, zero_record, zero_record};
+    }
+
+    if (base_score + (FLOAT_TYPE)(score) > 0) {
+      if (!add_boundary(i, userdata)) {
+        return false;
+      }
+    }
+  }
+  instrument_parse(budouxc_entry_point_callback, start, sentence_len);
+  return true;
+}
+
+// Number of boundaries passed at a time to the add_boundaries callback of budouxc_parse_boundaries_callback_block.
+#define CALLBACK_BLOCK_SIZE 256
+
+bool BUDOUXC_DECLSPEC budouxc_parse_boundaries_callback_block(
+    struct budouxc *const model,
+    char32_t const *(*get_chars)(size_t *const len, void *userdata),
+    bool (*add_boundaries)(size_t const *const boundaries, size_t const n, void *userdata),
+    void *userdata) {
+  uint64_t const start = instrument_now();
+  size_t out[CALLBACK_BLOCK_SIZE];
+  size_t out_len = 0;
+  struct window w;
+  window_init(&w);
+  FLOAT_TYPE const base_score = (FLOAT_TYPE)(model->sum) * (FLOAT_TYPE)(-0.5);
+  size_t k = 0;
+  for (;;) {
+    size_t len = 0;
+    char32_t const *const chars = get_chars(&len, userdata);
+    if (!chars || !len) {
+      break;
+    }
+    for (size_t j = 0; j < len; ++j, ++k) {
+      window_push(&w, model, k, chars[j]);
+      if (k < 3 || !window_boundary(&w, k - 2, base_score)) {
+        continue;
+      }
+      out[out_len++] = k - 2;
+      if (out_len == CALLBACK_BLOCK_SIZE) {
+        if (!add_boundaries(out, out_len, userdata)) {
+          return false;
+        }
+        out_len = 0;
+      }
+    }
+  }
+  // Decide the last two positions.
+  for (size_t const end = k + 2; k < end; ++k) {
+    window_end(&w, k);
+    if (k < 3 || !window_boundary(&w, k - 2, base_score)) {
+      continue;
+    }
+    out[out_len++] = k - 2;
+    if (out_len == CALLBACK_BLOCK_SIZE) {
+      if (!add_boundaries(out, out_len, userdata)) {
+        return false;
+      }
+      out_len = 0;
+    }
+  }
+  if (out_len && !add_boundaries(out, out_len, userdata)) {
+    return false;
+  }
+  instrument_parse(budouxc_entry_point_callback_block, start, k - 2);
+  return true;
+}
+
+// Number of code points decoded at a time by budouxc_parse_boundaries_utf8.
+#define UTF8_CHUNK_SIZE 128
+
+static inline bool utf8_continuation(uint8_t const b) { return (b & 0xc0) == 0x80; }
+
+// UTF-8 input is decoded a chunk at a time straight into the scoring window, and boundaries are reported as byte
+// offsets kept alongside the window, so memory use does not depend on the length of the input.
+// Like parse_range_utf16/32, only characters starting from byte begin to end - 1 are decided. begin and end must not
+// point into the middle of a character.
+static bool parse_range_utf8(struct budouxc const *const model,
+                             char const *const sentence,
+                             size_t const sentence_len,
+                             size_t const begin,
+                             size_t const end,
+                             struct boundary_list *const l,
+                             char *const error128) {
+  uint8_t const *const src = (uint8_t const *)sentence;
+  // Step back 3 characters and forward 2 characters to cover every character the decisions depend on.
+  size_t halo_begin = begin;
+  for (size_t n = 0; n < 3 && halo_begin > 0; ++n) {
+    do {
+      --halo_begin;
+    } while (halo_begin > 0 && utf8_continuation(src[halo_begin]));
+  }
+  size_t halo_end = end;
+  for (size_t n = 0; n < 2 && halo_end < sentence_len; ++n) {
+    do {
+      ++halo_end;
+    } while (halo_end < sentence_len && utf8_continuation(src[halo_end]));
+  }
+
+  char32_t chars[UTF8_CHUNK_SIZE];
+  size_t chunk_offsets[UTF8_CHUNK_SIZE];
+  size_t offsets[8] = {SIZE_MAX, SIZE_MAX, SIZE_MAX, SIZE_MAX, SIZE_MAX, SIZE_MAX, SIZE_MAX, SIZE_MAX};
+  struct window w;
+  window_init(&w);
+  FLOAT_TYPE const base_score = (FLOAT_TYPE)(model->sum) * (FLOAT_TYPE)(-0.5);
+  // Positions are counted from the start of the sentence only when it is read, since position 0 is never a boundary.
+  size_t k = halo_begin ? 3 : 0;
+  size_t pos = halo_begin;
+  while (pos < halo_end) {
+    size_t const n = utf8_decode(chars, chunk_offsets, UTF8_CHUNK_SIZE, src, halo_end, &pos);
+    if (n == SIZE_MAX) {
+      strcpy(error128, "Broken input");
+      return false;
+    }
+    for (size_t j = 0; j < n; ++j, ++k) {
+      window_push(&w, model, k, chars[j]);
+      offsets[k & 7] = chunk_offsets[j];
+      if (k < 3) {
+        continue;
+      }
+      size_t const offset = offsets[(k - 2) & 7];
+      if (offset >= begin && offset < end && window_boundary(&w, k - 2, base_score) &&
+          !boundary_list_add(model, l, offset)) {
+        strcpy(error128, "Out of memory");
+        return false;
+      }
+    }
+  }
+  if (halo_end < sentence_len) {
+    return true;
+  }
+  // Decide the last two positions.
+  for (size_t const last = k + 2; k < last; ++k) {
+    window_end(&w, k);
+    if (k < 3) {
+      continue;
+    }
+    size_t const offset = offsets[(k - 2) & 7];
+    if (offset >= begin && offset < end && window_boundary(&w, k - 2, base_score) &&
+        !boundary_list_add(model, l, offset)) {
+      strcpy(error128, "Out of memory");
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool parse_utf8(struct budouxc const *const model,
+                       char const *const sentence,
+                       size_t const sentence_len,
+                       struct boundary_list *const l,
+                       char *const error128) {
+  if (!sentence || !sentence_len) {
+    strcpy(error128, "Broken input");
+    return false;
+  }
+  return parse_range_utf8(model, sentence, sentence_len, 0, sentence_len, l, error128);
+}
+
+IMPL_PARSE_API(utf8, char);
+
+#undef IMPL_PARSE_API
+
+// Batch parsing ----
+
+// Each worker parses into its own growing list, and the position of every item's boundaries in those lists is
+// recorded. Once all items are done, the lists are gathered into a single allocation: in CSR layout when the items are
+// sentences, or as one list when they are chunks of a single sentence.
+
+struct batch_item {
+  size_t worker;
+  size_t start;
+  size_t count;
+};
+
+struct batch_worker {
+  struct boundary_list list;
+  size_t failed_item;
+  char error[128];
+};
+
+struct batch {
+  struct budouxc const *model;
+  void const *sentences;
+  size_t const *sentence_lens;
+  // Cut points of the chunks when parsing a single sentence in parallel.
+  size_t const *cuts;
+  struct batch_item *items;
+  struct batch_worker *workers;
+  size_t threads;
+  size_t failed_item;
+  // Everything but the lists of the workers, which grow on several threads at once.
+  struct arena scratch;
+};
+
+// Parses every item. On failure, the error of the first failing item is reported so that it does not depend on
+// scheduling.
+static bool batch_parse(struct batch *const b,
+                        size_t const n,
+                        size_t threads,
+                        bool (*fn)(void *ctx, size_t worker, size_t item),
+                        char *const error128) {
+  if (threads > n) {
+    threads = n;
+  }
+  if (threads < 1) {
+    threads = 1;
+  }
+  b->threads = threads;
+  b->failed_item = SIZE_MAX;
+  b->items = arena_alloc(&b->scratch, n * sizeof(struct batch_item) + threads * sizeof(struct batch_worker));
+  if (!b->items) {
+    strcpy(error128, "Out of memory");
+    return false;
+  }
+  b->workers = (void *)(b->items + n);
+  for (size_t i = 0; i < threads; ++i) {
+    b->workers[i] = (struct batch_worker){
+        .failed_item = SIZE_MAX,
+    };
+  }
+  if (!parallel_for(&b->scratch, n, threads, fn, b, error128)) {
+    struct batch_worker const *failed = NULL;
+    for (size_t i = 0; i < threads; ++i) {
+      if (!failed || b->workers[i].failed_item < failed->failed_item) {
+        failed = &b->workers[i];
+      }
+    }
+    if (failed->failed_item != SIZE_MAX) {
+      strcpy(error128, failed->error);
+      b->failed_item = failed->failed_item;
+    }
+    return false;
+  }
+  return true;
+}
+
+// Copies the boundaries of items from begin to end - 1 to dest in order.
+static size_t batch_gather(struct batch const *const b, size_t const begin, size_t const end, size_t *const dest) {
+  size_t pos = 0;
+  for (size_t i = begin; i < end; ++i) {
+    struct batch_item const *const item = &b->items[i];
+    if (item->count) {
+      memcpy(dest + pos, b->workers[item->worker].list.indices + item->start, item->count * sizeof(size_t));
+    }
+    pos += item->count;
+  }
+  return pos;
+}
+
+static void batch_free(struct batch *const b) {
+  struct budouxc_allocators const *const a = &b->model->allocators;
+  for (size_t i = 0; b->items && i < b->threads; ++i) {
+    if (b->workers[i].list.indices) {
+      a->fn_free(b->workers[i].list.indices, a->user_data);
+    }
+  }
+  arena_destroy(&b->scratch);
+  b->items = NULL;
+}
+
+static struct budouxc_batch *batch_run(struct batch *const b,
+                                       size_t const n,
+                                       size_t const threads,
+                                       bool (*fn)(void *ctx, size_t worker, size_t item),
+                                       char *const error128) {
+  struct budouxc_allocators const *const a = &b->model->allocators;
+  struct budouxc_batch *ret = NULL;
+  if (!batch_parse(b, n, threads, fn, error128)) {
+    if (b->failed_item != SIZE_MAX) {
+      char error[128];
+      strcpy(error, error128);
+      snprintf(error128, 128, "%.92s at sentence #%zu", error, b->failed_item);
+    }
+    goto cleanup;
+  }
+
+  size_t total = 0;
+  for (size_t i = 0; i < n; ++i) {
+    total += b->items[i].count;
+  }
+  ret = a->fn_realloc(NULL, sizeof(struct budouxc_batch) + (n + 1 + total) * sizeof(size_t), a->user_data);
+  if (!ret) {
+    strcpy(error128, "Out of memory");
+    goto cleanup;
+  }
+  size_t *const offsets = (void *)(ret + 1);
+  size_t *const indices = offsets + n + 1;
+  offsets[0] = 0;
+  for (size_t i = 0; i < n; ++i) {
+    offsets[i + 1] = offsets[i] + b->items[i].count;
+  }
+  batch_gather(b, 0, n, indices);
+  *ret = (struct budouxc_batch){
+      .indices = indices,
+      .offsets = offsets,
+      .n = n,
+  };
+
+cleanup:
+  batch_free(b);
+  return ret;
+}
+
+#define IMPL_PARSE_BATCH(name, typ)                                                                                    \
+  static bool batch_item_##name(void *const ctx, size_t const worker, size_t const i) {                                \
+    struct batch *const b = ctx;                                                                                       \
+    struct batch_worker *const w = &b->workers[worker];                                                                \
+    size_t const start = w->list.len;                                                                                  \
+    typ const *const *const sentences = b->sentences;                                                                  \
+    if (!parse_##name(b->model, sentences[i], b->sentence_lens[i], &w->list, w->error)) {                              \
+      w->failed_item = i;                                                                                              \
+      return false;                                                                                                    \
+    }                                                                                                                  \
+    b->items[i] = (struct batch_item){                                                                                 \
+        .worker = worker,                                                                                              \
+        .start = start,                                                                                                \
+        .count = w->list.len - start,                                                                                  \
+    };                                                                                                                 \
+    return true;                                                                                                       \
+  }                                                                                                                    \
+  struct budouxc_batch *BUDOUXC_DECLSPEC budouxc_parse_batch_##name(struct budouxc *const model,                       \
+                                                                    typ const *const *const sentences,                 \
+                                                                    size_t const *const sentence_lens,                 \
+                                                                    size_t const n,                                    \
+                                                                    size_t const threads,                              \
+                                                                    char *error128) {                                  \
+    if (!model || (n && (!sentences || !sentence_lens))) {                                                             \
+      strcpy(error128, "Invalid arguments");                                                                           \
+      return NULL;                                                                                                     \
+    }                                                                                                                  \
+    struct batch b = {                                                                                                 \
+        .model = model,                                                                                                \
+        .sentences = sentences,                                                                                        \
+        .sentence_lens = sentence_lens,                                                                                \
+        .scratch = arena_new(&model->allocators),                                                                      \
+    };                                                                                                                 \
+    return batch_run(&b, n, threads, batch_item_##name, error128);                                                     \
+  }                                                                                                                    \
+  struct budouxc_batch *BUDOUXC_DECLSPEC budouxc_parse_batch_##name(struct budouxc *const model,                       \
+                                                                    typ const *const *const sentences,                 \
+                                                                    size_t const *const sentence_lens,                 \
+                                                                    size_t const n,                                    \
+                                                                    size_t const threads,                              \
+                                                                    char *error128)
+
+IMPL_PARSE_BATCH(utf8, char);
+IMPL_PARSE_BATCH(utf16, char16_t);
+IMPL_PARSE_BATCH(utf32, char32_t);
+
+#undef IMPL_PARSE_BATCH
+
+void BUDOUXC_DECLSPEC budouxc_batch_destroy(struct budouxc *const model, struct budouxc_batch *const batch) {
+  if (!model || !batch) {
+    return;
+  }
+  model->allocators.fn_free(batch, model->allocators.user_data);
+}
+
+// Parallel parsing ----
+
+// A single sentence is split into chunks that are parsed as the items of a batch. Every chunk is parsed with the
+// characters around it, so the result is exactly the same as parsing the whole sentence at once.
+
+// Sentences shorter than this are not split, since starting threads would cost more than parsing.
+#define PARALLEL_MIN_CHUNK_SIZE 65536
+
+// Each thread gets several chunks on average so that idle threads have something to steal.
+#define PARALLEL_CHUNKS_PER_THREAD 4
+
+static inline size_t chunk_cut_utf8(char const *const sentence, size_t const sentence_len, size_t cut) {
+  while (cut < sentence_len && utf8_continuation((uint8_t)sentence[cut])) {
+    ++cut;
+  }
+  return cut;
+}
+
+// Surrogate pairs are ignored as in budouxc_parse_boundaries_utf16.
+static inline size_t chunk_cut_utf16(char16_t const *const sentence, size_t const sentence_len, size_t const cut) {
+  (void)sentence;
+  (void)sentence_len;
+  return cut;
+}
+
+static inline size_t chunk_cut_utf32(char32_t const *const sentence, size_t const sentence_len, size_t const cut) {
+  (void)sentence;
+  (void)sentence_len;
+  return cut;
+}
+
+#define IMPL_PARSE_PARALLEL(name, typ)                                                                                 \
+  static bool parallel_chunk_##name(void *const ctx, size_t const worker, size_t const i) {                            \
+    struct batch *const b = ctx;                                                                                       \
+    struct batch_worker *const w = &b->workers[worker];                                                                \
+    size_t const start = w->list.len;                                                                                  \
+    if (!parse_range_##name(                                                                                           \
+            b->model, b->sentences, *b->sentence_lens, b->cuts[i], b->cuts[i + 1], &w->list, w->error)) {              \
+      w->failed_item = i;                                                                                              \
+      return false;                                                                                                    \
+    }                                                                                                                  \
+    b->items[i] = (struct batch_item){                                                                                 \
+        .worker = worker,                                                                                              \
+        .start = start,                                                                                                \
+        .count = w->list.len - start,                                                                                  \
+    };                                                                                                                 \
+    return true;                                                                                                       \
+  }                                                                                                                    \
+  struct budouxc_boundaries *BUDOUXC_DECLSPEC budouxc_parse_boundaries_parallel_##name(struct budouxc *const model,    \
+                                                                                       typ const *const sentence,      \
+                                                                                       size_t const sentence_len,      \
+                                                                                       size_t const threads,           \
+                                                                                       char *error128) {               \
+    if (!model) {                                                                                                      \
+      strcpy(error128, "Invalid arguments");                                                                           \
+      return NULL;                                                                                                     \
+    }                                                                                                                  \
+    size_t chunks = sentence_len / PARALLEL_MIN_CHUNK_SIZE;                                                            \
+    if (threads <= 1 || chunks <= 1) {                                                                                 \
+      return budouxc_parse_boundaries_##name(model, sentence, sentence_len, error128);                                 \
+    }                                                                                                                  \
+    uint64_t const start = instrument_now();                                                                           \
+    if (chunks > threads * PARALLEL_CHUNKS_PER_THREAD) {                                                               \
+      chunks = threads * PARALLEL_CHUNKS_PER_THREAD;                                                                   \
+    }                                                                                                                  \
+    struct budouxc_allocators const *const a = &model->allocators;                                                     \
+    struct budouxc_boundaries *ret = NULL;                                                                             \
+    struct batch b = {                                                                                                 \
+        .model = model,                                                                                                \
+        .sentences = sentence,                                                                                         \
+        .sentence_lens = &sentence_len,                                                                                \
+        .scratch = arena_new(&model->allocators),                                                                      \
+    };                                                                                                                 \
+    size_t *const cuts = arena_alloc(&b.scratch, (chunks + 1) * sizeof(size_t));                                       \
+    if (!cuts) {                                                                                                       \
+      strcpy(error128, "Out of memory");                                                                               \
+      goto cleanup;                                                                                                    \
+    }                                                                                                                  \
+    for (size_t i = 0; i < chunks; ++i) {                                                                              \
+      cuts[i] = chunk_cut_##name(sentence, sentence_len, sentence_len / chunks * i);                                   \
+    }                                                                                                                  \
+    cuts[chunks] = sentence_len;                                                                                       \
+    b.cuts = cuts;                                                                                                     \
+    if (!batch_parse(&b, chunks, threads, parallel_chunk_##name, error128)) {                                          \
+      goto cleanup;                                                                                                    \
+    }                                                                                                                  \
+    size_t total = 0;                                                                                                  \
+    for (size_t i = 0; i < chunks; ++i) {                                                                              \
+      total += b.items[i].count;                                                                                       \
+    }                                                                                                                  \
+    size_t *const indices =                                                                                            \
+        a->fn_realloc(NULL, total * sizeof(size_t) + sizeof(struct budouxc_boundaries), a->user_data);                 \
+    if (!indices) {                                                                                                    \
+      strcpy(error128, "Out of memory");                                                                               \
+      goto cleanup;                                                                                                    \
+    }                                                                                                                  \
+    batch_gather(&b, 0, chunks, indices);                                                                              \
+    ret = (void *)(indices + total);                                                                                   \
+    ret->indices = indices;                                                                                            \
+    ret->n = total;                                                                                                    \
+  cleanup:                                                                                                             \
+    batch_free(&b);                                                                                                    \
+    if (ret) {                                                                                                         \
+      instrument_parse_##name(budouxc_entry_point_parallel_##name, start, sentence, sentence_len);                     \
+    }                                                                                                                  \
+    return ret;                                                                                                        \
+  }                                                                                                                    \
+  struct budouxc_boundaries *BUDOUXC_DECLSPEC budouxc_parse_boundaries_parallel_##name(struct budouxc *const model,    \
+                                                                                       typ const *const sentence,      \
+                                                                                       size_t const sentence_len,      \
+                                                                                       size_t const threads,           \
+                                                                                       char *error128)
+
+IMPL_PARSE_PARALLEL(utf8, char);
+IMPL_PARSE_PARALLEL(utf16, char16_t);
+IMPL_PARSE_PARALLEL(utf32, char32_t);
+
+#undef IMPL_PARSE_PARALLEL
+
+// Incremental parsing ----
+
+// An edit can only change the boundaries whose window of characters i-3 to i+2 overlaps the inserted text or spans
+// the removed text, which are the positions from 2 characters before the edit to 2 characters after the inserted text.
+// These are parsed again, and every other boundary is copied from the previous result. Boundaries from end onward were
+// at end - inserted_len + removed_len in the previous sentence.
+
+// Finds the positions to parse again in the new sentence, or returns false if the edit does not fit in it.
+static inline bool edit_range_utf8(char const *const sentence,
+                                   size_t const sentence_len,
+                                   size_t const offset,
+                                   size_t const inserted_len,
+                                   size_t *const begin,
+                                   size_t *const end) {
+  uint8_t const *const src = (uint8_t const *)sentence;
+  size_t const edit_end = offset + inserted_len;
+  if ((offset < sentence_len && utf8_continuation(src[offset])) ||
+      (edit_end < sentence_len && utf8_continuation(src[edit_end]))) {
+    return false;
+  }
+  size_t lo = offset;
+  for (size_t n = 0; n < 2 && lo > 0; ++n) {
+    do {
+      --lo;
+    } while (lo > 0 && utf8_continuation(src[lo]));
+  }
+  size_t hi = edit_end;
+  for (size_t n = 0; n < 3 && hi < sentence_len; ++n) {
+    do {
+      ++hi;
+    } while (hi < sentence_len && utf8_continuation(src[hi]));
+  }
+  *begin = lo;
+  *end = hi;
+  return true;
+}
+
+static inline bool edit_range_utf16(char16_t const *const sentence,
+                                    size_t const sentence_len,
+                                    size_t const offset,
+                                    size_t const inserted_len,
+                                    size_t *const begin,
+                                    size_t *const end) {
+  (void)sentence;
+  size_t const edit_end = offset + inserted_len;
+  *begin = offset > 2 ? offset - 2 : 0;
+  *end = edit_end + 3 < sentence_len ? edit_end + 3 : sentence_len;
+  return true;
+}
+
+static inline bool edit_range_utf32(char32_t const *const sentence,
+                                    size_t const sentence_len,
+                                    size_t const offset,
+                                    size_t const inserted_len,
+                                    size_t *const begin,
+                                    size_t *const end) {
+  (void)sentence;
+  size_t const edit_end = offset + inserted_len;
+  *begin = offset > 2 ? offset - 2 : 0;
+  *end = edit_end + 3 < sentence_len ? edit_end + 3 : sentence_len;
+  return true;
+}
+
+// Returns the number of boundaries before position i.
+static size_t boundaries_lower_bound(struct budouxc_boundaries const *const b, size_t const i) {
+  size_t lo = 0;
+  size_t hi = b->n;
+  while (lo < hi) {
+    size_t const mid = lo + (hi - lo) / 2;
+    if (b->indices[mid] < i) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+#define IMPL_UPDATE(name, typ)                                                                                         \
+  struct budouxc_boundaries *BUDOUXC_DECLSPEC budouxc_update_boundaries_##name(                                        \
+      struct budouxc *const model,                                                                                     \
+      struct budouxc_boundaries const *const prev,                                                                     \
+      typ const *const sentence,                                                                                       \
+      size_t const sentence_len,                                                                                       \
+      size_t const offset,                                                                                             \
+      size_t const removed_len,                                                                                        \
+      size_t const inserted_len,                                                                                       \
+      char *error128) {                                                                                                \
+    size_t begin = 0;                                                                                                  \
+    size_t end = 0;                                                                                                    \
+    if (!model || !prev || offset > sentence_len || inserted_len > sentence_len - offset ||                            \
+        !edit_range_##name(sentence, sentence_len, offset, inserted_len, &begin, &end)) {                              \
+      strcpy(error128, "Invalid arguments");                                                                           \
+      return NULL;                                                                                                     \
+    }                                                                                                                  \
+    if (!sentence_len) {                                                                                               \
+      return budouxc_parse_boundaries_##name(model, sentence, sentence_len, error128);                                 \
+    }                                                                                                                  \
+    size_t const head = boundaries_lower_bound(prev, begin);                                                           \
+    size_t const tail = boundaries_lower_bound(prev, end - inserted_len + removed_len);                                \
+    size_t const tail_len = prev->n - tail;                                                                            \
+    struct boundary_list l = {                                                                                         \
+        .cap = head + (end - begin) + tail_len,                                                                        \
+    };                                                                                                                 \
+    l.indices = model->allocators.fn_realloc(                                                                          \
+        NULL, l.cap * sizeof(size_t) + sizeof(struct budouxc_boundaries), model->allocators.user_data);                \
+    if (!l.indices) {                                                                                                  \
+      strcpy(error128, "Out of memory");                                                                               \
+      goto failed;                                                                                                     \
+    }                                                                                                                  \
+    if (head) {                                                                                                        \
+      memcpy(l.indices, prev->indices, head * sizeof(size_t));                                                         \
+    }                                                                                                                  \
+    l.len = head;                                                                                                      \
+    if (!parse_range_##name(model, sentence, sentence_len, begin, end, &l, error128)) {                                \
+      goto failed;                                                                                                     \
+    }                                                                                                                  \
+    for (size_t i = tail; i < prev->n; ++i) {                                                                          \
+      l.indices[l.len++] = prev->indices[i] - removed_len + inserted_len;                                              \
+    }                                                                                                                  \
+    return boundary_list_finish(model, &l);                                                                            \
+  failed:                                                                                                              \
+    if (l.indices) {                                                                                                   \
+      model->allocators.fn_free(l.indices, model->allocators.user_data);                                               \
+    }                                                                                                                  \
+    return NULL;                                                                                                       \
+  }                                                                                                                    \
+  struct budouxc_boundaries *BUDOUXC_DECLSPEC budouxc_update_boundaries_##name(                                        \
+      struct budouxc *const model,                                                                                     \
+      struct budouxc_boundaries const *const prev,                                                                     \
+      typ const *const sentence,                                                                                       \
+      size_t const sentence_len,                                                                                       \
+      size_t const offset,                                                                                             \
+      size_t const removed_len,                                                                                        \
+      size_t const inserted_len,                                                                                       \
+      char *error128)
+
+IMPL_UPDATE(utf8, char);
+IMPL_UPDATE(utf16, char16_t);
+IMPL_UPDATE(utf32, char32_t);
+
+#undef IMPL_UPDATE
+
+// Streaming ----
+
+// A stream is the state of parse_utf8 kept between calls: the scoring window, the offsets of the characters in it and
+// the bytes of a character split across chunks. Each position is decided as soon as the 2 characters after it arrive,
+// and the boundaries decided by a chunk are returned in a list reused by every call.
+
+struct budouxc_stream {
+  struct budouxc *model;
+  struct window w;
+  size_t offsets[8];
+  // Number of characters added so far.
+  size_t k;
+  // Offset of the next input unit from the start of the stream.
+  size_t pos;
+  uint8_t pending[4];
+  size_t pending_len;
+  struct boundary_list list;
+  struct budouxc_boundaries result;
+};
+
+static void stream_reset(struct budouxc_stream *const s) {
+  window_init(&s->w);
+  s->k = 0;
+  s->pos = 0;
+  s->pending_len = 0;
+}
+
+static inline bool stream_push(struct budouxc_stream *const s, char32_t const ch, size_t const offset) {
+  FLOAT_TYPE const base_score = (FLOAT_TYPE)(s->model->sum) * (FLOAT_TYPE)(-0.5);
+  size_t const k = s->k++;
+  window_push(&s->w, s->model, k, ch);
+  s->offsets[k & 7] = offset;
+  return k < 3 || !window_boundary(&s->w, k - 2, base_score) ||
+         boundary_list_add(s->model, &s->list, s->offsets[(k - 2) & 7]);
+}
+
+static struct budouxc_boundaries const *stream_result(struct budouxc_stream *const s) {
+  s->result = (struct budouxc_boundaries){
+      .indices = s->list.indices,
+      .n = s->list.len,
+  };
+  return &s->result;
+}
+
+struct budouxc_stream *BUDOUXC_DECLSPEC budouxc_stream_init(struct budouxc *const model, char *error128) {
+  if (!model) {
+    strcpy(error128, "Invalid arguments");
+    return NULL;
+  }
+  struct budouxc_stream *const s =
+      model->allocators.fn_realloc(NULL, sizeof(struct budouxc_stream), model->allocators.user_data);
+  if (!s) {
     strcpy(error128, "Out of memory");
-    goto failed;
+    return NULL;
   }
-  *model = (struct budouxc){
-      .allocators = a,
+  *s = (struct budouxc_stream){
+      .model = model,
   };
+  stream_reset(s);
+  return s;
+}
 
-  root = json_parse_ex(&settings, json, json_len, error128);
-  if (root == NULL) {
-    goto failed;
+void BUDOUXC_DECLSPEC budouxc_stream_destroy(struct budouxc_stream *const stream) {
+  if (!stream) {
+    return;
   }
-  if (root->type != json_object) {
-    strcpy(error128, "JSON root is not an object");
-    goto failed;
+  struct budouxc_allocators const *const a = &stream->model->allocators;
+  if (stream->list.indices) {
+    a->fn_free(stream->list.indices, a->user_data);
   }
-  // Only UW1 - UW6, BW1 - BW3, TW1 - TW4 are located on the root object.
-  for (unsigned int i = 0, len = root->u.object.length; i < len; ++i) {
-    char const *const name = root->u.object.values[i].name;
-    if (root->u.object.values[i].name_length != 3 || name[1] != 'W') {
-      continue;
+  a->fn_free(stream, a->user_data);
+}
+
+// Number of bytes of the character starting with b. Bytes that cannot start a character count as 1 so that the
+// decoder rejects them.
+static inline size_t utf8_sequence_len(uint8_t const b) {
+  if (b >= 0xc0 && b < 0xe0) {
+    return 2;
+  }
+  if (b >= 0xe0 && b < 0xf0) {
+    return 3;
+  }
+  if (b >= 0xf0 && b < 0xf8) {
+    return 4;
+  }
+  return 1;
+}
+
+// Returns the length of src without a character cut off at the end.
+static inline size_t utf8_complete_len(uint8_t const *const src, size_t const len) {
+  for (size_t p = len, back = 0; p > 0 && back < 4; ++back) {
+    --p;
+    if (!utf8_continuation(src[p])) {
+      return utf8_sequence_len(src[p]) > len - p ? p : len;
     }
-    int n = name[2] - '1';
-    switch (name[0]) {
-    case 'U':
-      if (n < 0 || n >= (int)(ARRAY_SIZE(model->uni))) {
-        continue;
-      }
-      break;
-    case 'B':
-      if (n < 0 || n >= (int)(ARRAY_SIZE(model->bi))) {
-        continue;
-      }
-      break;
-    case 'T':
-      if (n < 0 || n >= (int)(ARRAY_SIZE(model->tri))) {
-        continue;
+  }
+  return len;
+}
+
+static bool stream_feed_utf8_bytes(struct budouxc_stream *const s,
+                                   uint8_t const *const src,
+                                   size_t const len,
+                                   char *const error128) {
+  char32_t chars[UTF8_CHUNK_SIZE];
+  size_t chunk_offsets[UTF8_CHUNK_SIZE];
+  size_t pos = 0;
+  while (pos < len) {
+    size_t const n = utf8_decode(chars, chunk_offsets, UTF8_CHUNK_SIZE, src, len, &pos);
+    if (n == SIZE_MAX) {
+      strcpy(error128, "Broken input");
+      return false;
+    }
+    for (size_t j = 0; j < n; ++j) {
+      if (!stream_push(s, chars[j], s->pos + chunk_offsets[j])) {
+        strcpy(error128, "Out of memory");
+        return false;
       }
-      break;
-    default:
-      continue;
     }
-    json_value const *const obj = root->u.object.values[i].value;
-    if (obj->type != json_object) {
-      sprintf(error128, "JSON key %s is not an object", root->u.object.values[i].name);
-      goto failed;
+  }
+  s->pos += len;
+  return true;
+}
+
+struct budouxc_boundaries const *BUDOUXC_DECLSPEC budouxc_stream_feed_utf8(struct budouxc_stream *const stream,
+                                                                           char const *const chunk,
+                                                                           size_t const chunk_len,
+                                                                           char *error128) {
+  uint8_t const *const src = (uint8_t const *)chunk;
+  size_t i = 0;
+  stream->list.len = 0;
+  if (stream->pending_len) {
+    size_t const need = utf8_sequence_len(stream->pending[0]);
+    while (stream->pending_len < need && i < chunk_len) {
+      stream->pending[stream->pending_len++] = src[i++];
     }
-    switch (name[0]) {
-    case 'U':
-      if (model->uni[n] != NULL) {
-        sprintf(error128, "Duplicate key %s", root->u.object.values[i].name);
-        goto failed;
-      }
-      if ((model->uni[n] = build_unigram_map(obj, &model->allocators, error128)) == NULL) {
-        goto failed;
-      }
-      break;
-    case 'B':
-      if (model->bi[n] != NULL) {
-        sprintf(error128, "Duplicate key %s", root->u.object.values[i].name);
-        goto failed;
-      }
-      if ((model->bi[n] = build_bigram_map(obj, &model->allocators, error128)) == NULL) {
-        goto failed;
-      }
-      break;
-    case 'T':
-      if (model->tri[n] != NULL) {
-        sprintf(error128, "Duplicate key %s", root->u.object.values[i].name);
-        goto failed;
-      }
-      if ((model->tri[n] = build_trigram_map(obj, &model->allocators, error128)) == NULL) {
-        goto failed;
-      }
-      break;
+    if (stream->pending_len < need) {
+      return stream_result(stream);
+    }
+    if (!stream_feed_utf8_bytes(stream, stream->pending, stream->pending_len, error128)) {
+      goto failed;
     }
+    stream->pending_len = 0;
+  }
+  size_t const end = i + utf8_complete_len(src + i, chunk_len - i);
+  if (!stream_feed_utf8_bytes(stream, src + i, end - i, error128)) {
+    goto failed;
+  }
+  for (; end + stream->pending_len < chunk_len; ++stream->pending_len) {
+    stream->pending[stream->pending_len] = src[end + stream->pending_len];
   }
+  return stream_result(stream);
+failed:
+  stream_reset(stream);
+  return NULL;
+}
 
-#define SUM_MAP(typ, map, sum)                                                                                         \
-  do {                                                                                                                 \
-    size_t iter = 0;                                                                                                   \
-    void *item = NULL;                                                                                                 \
-    while (hashmap_iter(map, &iter, &item)) {                                                                          \
-      struct typ const *const j = item;                                                                                \
-      sum += j->value;                                                                                                 \
+#define IMPL_STREAM_FEED(name, typ)                                                                                    \
+  struct budouxc_boundaries const *BUDOUXC_DECLSPEC budouxc_stream_feed_##name(                                        \
+      struct budouxc_stream *const stream, typ const *const chunk, size_t const chunk_len, char *error128) {           \
+    stream->list.len = 0;                                                                                              \
+    for (size_t i = 0; i < chunk_len; ++i) {                                                                           \
+      if (!stream_push(stream, (char32_t)chunk[i], stream->pos++)) {                                                   \
+        strcpy(error128, "Out of memory");                                                                             \
+        stream_reset(stream);                                                                                          \
+        return NULL;                                                                                                   \
+      }                                                                                                                \
     }                                                                                                                  \
-  } while (0)
+    return stream_result(stream);                                                                                      \
+  }                                                                                                                    \
+  struct budouxc_boundaries const *BUDOUXC_DECLSPEC budouxc_stream_feed_##name(                                        \
+      struct budouxc_stream *const stream, typ const *const chunk, size_t const chunk_len, char *error128)
 
-  int32_t sum = 0;
-  for (size_t i = 0; i < ARRAY_SIZE(model->uni); ++i) {
-    if (!model->uni[i]) {
-      sprintf(error128, "Missing key UW%zu", i + 1);
-      goto failed;
-    }
-    SUM_MAP(unigram, model->uni[i], sum);
+// Surrogate pairs are ignored as in budouxc_parse_boundaries_utf16.
+IMPL_STREAM_FEED(utf16, char16_t);
+IMPL_STREAM_FEED(utf32, char32_t);
+
+#undef IMPL_STREAM_FEED
+
+struct budouxc_boundaries const *BUDOUXC_DECLSPEC budouxc_stream_finish(struct budouxc_stream *const stream,
+                                                                        char *error128) {
+  struct budouxc_boundaries const *ret = NULL;
+  stream->list.len = 0;
+  if (stream->pending_len) {
+    strcpy(error128, "Broken input");
+    goto cleanup;
   }
-  for (size_t i = 0; i < ARRAY_SIZE(model->bi); ++i) {
-    if (!model->bi[i]) {
-      sprintf(error128, "Missing key BW%zu", i + 1);
-      goto failed;
+  // Decide the last two positions.
+  FLOAT_TYPE const base_score = (FLOAT_TYPE)(stream->model->sum) * (FLOAT_TYPE)(-0.5);
+  for (size_t const end = stream->k + 2; stream->k < end; ++stream->k) {
+    size_t const k = stream->k;
+    window_end(&stream->w, k);
+    if (k >= 3 && window_boundary(&stream->w, k - 2, base_score) &&
+        !boundary_list_add(stream->model, &stream->list, stream->offsets[(k - 2) & 7])) {
+      strcpy(error128, "Out of memory");
+      goto cleanup;
     }
-    SUM_MAP(bigram, model->bi[i], sum);
   }
-  for (size_t i = 0; i < ARRAY_SIZE(model->tri); ++i) {
-    if (!model->tri[i]) {
-      sprintf(error128, "Missing key TW%zu", i + 1);
-      goto failed;
+  ret = stream_result(stream);
+cleanup:
+  stream_reset(stream);
+  return ret;
+}
+
+// Separated text ----
+
+// The text is copied to the output between boundaries as they are decided, so no boundary is stored. The output is
+// written either to a caller-provided buffer, counting what does not fit, or to a callback.
+
+struct separator_writer {
+  void const *sentence;
+  size_t copied;
+  void const *separator;
+  size_t separator_len;
+  size_t unit;
+  void *out;
+  size_t out_len;
+  size_t written;
+  bool (*write)(void const *data, size_t len, void *userdata);
+  void *userdata;
+  bool aborted;
+};
+
+static bool separator_writer_write(struct separator_writer *const w, void const *const data, size_t const len) {
+  if (!len) {
+    return true;
+  }
+  if (w->write) {
+    if (!w->write(data, len, w->userdata)) {
+      w->aborted = true;
+      return false;
     }
-    SUM_MAP(trigram, model->tri[i], sum);
+  } else if (w->out && w->written < w->out_len) {
+    size_t const n = w->out_len - w->written < len ? w->out_len - w->written : len;
+    memcpy((char *)w->out + w->written * w->unit, data, n * w->unit);
   }
-#undef SUM_MAP
+  w->written += len;
+  return true;
+}
 
-  model->sum = sum;
-  json_value_free_ex(&settings, root);
-  return model;
-failed:
-  if (root != NULL) {
-    json_value_free_ex(&settings, root);
+static bool separator_writer_copy(struct separator_writer *const w, size_t const end) {
+  char const *const src = (char const *)w->sentence + w->copied * w->unit;
+  if (!separator_writer_write(w, src, end - w->copied)) {
+    return false;
   }
-  if (model) {
-    budouxc_destroy(model);
+  w->copied = end;
+  return true;
+}
+
+static bool separator_writer_add(void *const ctx, size_t const i) {
+  struct separator_writer *const w = ctx;
+  return separator_writer_copy(w, i) && separator_writer_write(w, w->separator, w->separator_len);
+}
+
+static bool separate(struct separator_writer *const w,
+                     bool (*parse)(struct budouxc const *model,
+                                   void const *sentence,
+                                   size_t sentence_len,
+                                   struct boundary_list *l,
+                                   char *error128),
+                     struct budouxc const *const model,
+                     size_t const sentence_len,
+                     char *const error128) {
+  struct boundary_list l = {
+      .sink = separator_writer_add,
+      .sink_ctx = w,
+  };
+  if (!parse(model, w->sentence, sentence_len, &l, error128) || !separator_writer_copy(w, sentence_len)) {
+    if (w->aborted) {
+      strcpy(error128, "Aborted");
+    }
+    return false;
   }
-  return NULL;
+  return true;
 }
 
-#define IMPL_PARSE(bits)                                                                                               \
-  static inline void get_unigram_score_char##bits(                                                                     \
-      int32_t *score, struct hashmap *const map, char##bits##_t const k0) {                                            \
-    struct unigram const *const item = hashmap_get(map, &(struct unigram const){.key = {k0}});                         \
-    if (item) {                                                                                                        \
-      *score += item->value;                                                                                           \
-    }                                                                                                                  \
+#define IMPL_SEPARATE(name, typ)                                                                                       \
+  static bool separate_parse_##name(struct budouxc const *const model,                                                 \
+                                    void const *const sentence,                                                        \
+                                    size_t const sentence_len,                                                         \
+                                    struct boundary_list *const l,                                                     \
+                                    char *const error128) {                                                            \
+    return parse_##name(model, sentence, sentence_len, l, error128);                                                   \
   }                                                                                                                    \
-  static inline void get_bigram_score_char##bits(                                                                      \
-      int32_t *score, struct hashmap *const map, char##bits##_t const k0, char##bits##_t const k1) {                   \
-    struct bigram const *const item = hashmap_get(map, &(struct bigram const){.key = {k0, k1}});                       \
-    if (item) {                                                                                                        \
-      *score += item->value;                                                                                           \
-    }                                                                                                                  \
+  struct separator_callback_##name {                                                                                   \
+    bool (*write)(typ const *data, size_t len, void *userdata);                                                        \
+    void *userdata;                                                                                                    \
+  };                                                                                                                   \
+  static bool separator_callback_##name(void const *const data, size_t const len, void *const ctx) {                   \
+    struct separator_callback_##name const *const c = ctx;                                                             \
+    return c->write(data, len, c->userdata);                                                                           \
   }                                                                                                                    \
-  static inline void get_trigram_score_char##bits(int32_t *score,                                                      \
-                                                  struct hashmap *const map,                                           \
-                                                  char##bits##_t const k0,                                             \
-                                                  char##bits##_t const k1,                                             \
-                                                  char##bits##_t const k2) {                                           \
-    struct trigram const *const item = hashmap_get(map, &(struct trigram const){.key = {k0, k1, k2}});                 \
-    if (item) {                                                                                                        \
-      *score += item->value;                                                                                           \
+  size_t BUDOUXC_DECLSPEC budouxc_separate_##name(struct budouxc *const model,                                         \
+                                                  typ const *const sentence,                                           \
+                                                  size_t const sentence_len,                                           \
+                                                  typ const *const separator,                                          \
+                                                  size_t const separator_len,                                          \
+                                                  typ *const out,                                                      \
+                                                  size_t const out_len,                                                \
+                                                  char *error128) {                                                    \
+    if (!model || (!separator && separator_len)) {                                                                     \
+      strcpy(error128, "Invalid arguments");                                                                           \
+      return SIZE_MAX;                                                                                                 \
     }                                                                                                                  \
-  }                                                                                                                    \
-  struct budouxc_boundaries *BUDOUXC_DECLSPEC budouxc_parse_boundaries_utf##bits(                                      \
-      struct budouxc *const model, char##bits##_t const *const sentence, size_t const sentence_len, char *error128) {  \
-    size_t *r = NULL;                                                                                                  \
-    size_t r_len = 0;                                                                                                  \
-    size_t r_cap = 0;                                                                                                  \
-                                                                                                                       \
-    FLOAT_TYPE const base_score = (FLOAT_TYPE)(model->sum) * (FLOAT_TYPE)(-0.5);                                       \
-    for (size_t i = 1; i < sentence_len; ++i) {                                                                        \
-      int32_t score = 0;                                                                                               \
-      if (i >= 3) {                                                                                                    \
-        get_unigram_score_char##bits(&score, model->uni[0], sentence[i - 3]);                                          \
-      }                                                                                                                \
-      if (i >= 2) {                                                                                                    \
-        get_unigram_score_char##bits(&score, model->uni[1], sentence[i - 2]);                                          \
-      }                                                                                                                \
-      get_unigram_score_char##bits(&score, model->uni[2], sentence[i - 1]);                                            \
-      get_unigram_score_char##bits(&score, model->uni[3], sentence[i]);                                                \
-      if (i + 1 < sentence_len) {                                                                                      \
-        get_unigram_score_char##bits(&score, model->uni[4], sentence[i + 1]);                                          \
-      }                                                                                                                \
-      if (i + 2 < sentence_len) {                                                                                      \
-        get_unigram_score_char##bits(&score, model->uni[5], sentence[i + 2]);                                          \
-      }                                                                                                                \
-                                                                                                                       \
-      if (i >= 2) {                                                                                                    \
-        get_bigram_score_char##bits(&score, model->bi[0], sentence[i - 2], sentence[i - 1]);                           \
-      }                                                                                                                \
-      get_bigram_score_char##bits(&score, model->bi[1], sentence[i - 1], sentence[i]);                                 \
-      if (i + 1 < sentence_len) {                                                                                      \
-        get_bigram_score_char##bits(&score, model->bi[2], sentence[i], sentence[i + 1]);                               \
-      }                                                                                                                \
-                                                                                                                       \
-      if (i >= 3) {                                                                                                    \
-        get_trigram_score_char##bits(&score, model->tri[0], sentence[i - 3], sentence[i - 2], sentence[i - 1]);        \
-      }                                                                                                                \
-      if (i >= 2) {                                                                                                    \
-        get_trigram_score_char##bits(&score, model->tri[1], sentence[i - 2], sentence[i - 1], sentence[i]);            \
-      }                                                                                                                \
-      if (i + 1 < sentence_len) {                                                                                      \
-        get_trigram_score_char##bits(&score, model->tri[2], sentence[i - 1], sentence[i], sentence[i + 1]);            \
-      }                                                                                                                \
-      if (i + 2 < sentence_len) {                                                                                      \
-        get_trigram_score_char##bits(&score, model->tri[3], sentence[i], sentence[i + 1], sentence[i + 2]);            \
-      }                                                                                                                \
-                                                                                                                       \
-      if (base_score + (FLOAT_TYPE)(score) > 0) {                                                                      \
-        if (r_len == r_cap) {                                                                                          \
-          size_t const newcap = r_cap ? r_cap * 2 : 16;                                                                \
-          size_t *newbuf = model->allocators.fn_realloc(                                                               \
-              r, newcap * sizeof(size_t) + sizeof(struct budouxc_boundaries), model->allocators.user_data);            \
-          if (!newbuf) {                                                                                               \
-            strcpy(error128, "Out of memory");                                                                         \
-            goto failed;                                                                                               \
-          }                                                                                                            \
-          r = newbuf;                                                                                                  \
-          r_cap = newcap;                                                                                              \
-        }                                                                                                              \
-        r[r_len++] = i;                                                                                                \
-      }                                                                                                                \
+    struct separator_writer w = {                                                                                      \
+        .sentence = sentence,                                                                                          \
+        .separator = separator,                                                                                        \
+        .separator_len = separator_len,                                                                                \
+        .unit = sizeof(typ),                                                                                           \
+        .out = out,                                                                                                    \
+        .out_len = out ? out_len : 0,                                                                                  \
+    };                                                                                                                 \
+    if (!separate(&w, separate_parse_##name, model, sentence_len, error128)) {                                         \
+      return SIZE_MAX;                                                                                                 \
     }                                                                                                                  \
-    struct budouxc_boundaries *ret = (void *)(r + r_cap);                                                              \
-    ret->indices = r;                                                                                                  \
-    ret->n = r_len;                                                                                                    \
-    return ret;                                                                                                        \
-  failed:                                                                                                              \
-    if (r) {                                                                                                           \
-      model->allocators.fn_free(r, model->allocators.user_data);                                                       \
+    return w.written;                                                                                                  \
+  }                                                                                                                    \
+  bool BUDOUXC_DECLSPEC budouxc_separate_##name##_callback(struct budouxc *const model,                                \
+                                                           typ const *const sentence,                                  \
+                                                           size_t const sentence_len,                                  \
+                                                           typ const *const separator,                                 \
+                                                           size_t const separator_len,                                 \
+                                                           bool (*write)(typ const *data, size_t len, void *userdata), \
+                                                           void *userdata,                                             \
+                                                           char *error128) {                                           \
+    if (!model || (!separator && separator_len) || !write) {                                                           \
+      strcpy(error128, "Invalid arguments");                                                                           \
+      return false;                                                                                                    \
     }                                                                                                                  \
-    return NULL;                                                                                                       \
+    struct separator_callback_##name c = {                                                                             \
+        .write = write,                                                                                                \
+        .userdata = userdata,                                                                                          \
+    };                                                                                                                 \
+    struct separator_writer w = {                                                                                      \
+        .sentence = sentence,                                                                                          \
+        .separator = separator,                                                                                        \
+        .separator_len = separator_len,                                                                                \
+        .unit = sizeof(typ),                                                                                           \
+        .write = separator_callback_##name,                                                                            \
+        .userdata = &c,                                                                                                \
+    };                                                                                                                 \
+    return separate(&w, separate_parse_##name, model, sentence_len, error128);                                         \
   }                                                                                                                    \
-  struct budouxc_boundaries *BUDOUXC_DECLSPEC budouxc_parse_boundaries_utf##bits(                                      \
-      struct budouxc *const model, char##bits##_t const *const sentence, size_t const sentence_len, char *error128)
+  bool BUDOUXC_DECLSPEC budouxc_separate_##name##_callback(struct budouxc *const model,                                \
+                                                           typ const *const sentence,                                  \
+                                                           size_t const sentence_len,                                  \
+                                                           typ const *const separator,                                 \
+                                                           size_t const separator_len,                                 \
+                                                           bool (*write)(typ const *data, size_t len, void *userdata), \
+                                                           void *userdata,                                             \
+                                                           char *error128)
 
-// I think it is not correct as an implementation to ignore surrogate pairs,
-// but it seems that BudouX's JavaScript implementation does not consider surrogate pairs.
-// Therefore, in this implementation, we will also ignore surrogate pairs.
-IMPL_PARSE(16);
-IMPL_PARSE(32);
+IMPL_SEPARATE(utf8, char);
+IMPL_SEPARATE(utf16, char16_t);
+IMPL_SEPARATE(utf32, char32_t);
 
-bool BUDOUXC_DECLSPEC budouxc_parse_boundaries_callback(struct budouxc *const model,
-                                                        char32_t (*get_char)(void *userdata),
-                                                        bool (*add_boundary)(size_t const boundary, void *userdata),
-                                                        void *userdata) {
-  char32_t buffer[8] = {0};
-  size_t sentence_len = SIZE_MAX;
+#undef IMPL_SEPARATE
 
-  for (size_t i = 0; i < 3; ++i) {
-    char32_t const ch = get_char(userdata);
-    buffer[i] = ch;
-    if (ch == 0) {
-      sentence_len = i + 1;
-      break;
+// HTML ----
+
+// The annotator scans the document once. Markup is skipped, and the characters of text nodes go through the scoring
+// window as one sentence until a block-level element ends it. The input is copied to the output lazily: when a
+// boundary is decided, everything up to it is copied followed by the separator, so the document is copied only once.
+
+struct annotator {
+  struct budouxc const *model;
+  struct window w;
+  size_t offsets[8];
+  size_t k;
+  FLOAT_TYPE base_score;
+  char const *src;
+  size_t copied;
+  char const *separator;
+  size_t separator_len;
+  struct budouxc_buffer *out;
+};
+
+static bool buffer_append(struct budouxc const *const model,
+                          struct budouxc_buffer *const b,
+                          char const *const data,
+                          size_t const len) {
+  if (b->len + len > b->cap) {
+    size_t newcap = b->cap ? b->cap : 256;
+    while (newcap < b->len + len) {
+      newcap *= 2;
+    }
+    char *const newbuf = model->allocators.fn_realloc(b->ptr, newcap, model->allocators.user_data);
+    if (!newbuf) {
+      return false;
     }
+    b->ptr = newbuf;
+    b->cap = newcap;
   }
+  if (len) {
+    memcpy(b->ptr + b->len, data, len);
+  }
+  b->len += len;
+  return true;
+}
 
-  FLOAT_TYPE const base_score = (FLOAT_TYPE)(model->sum) * (FLOAT_TYPE)(-0.5);
-  for (size_t i = 0; i < sentence_len; ++i) {
-    if (i + 3 < sentence_len) {
-      char32_t const ch = get_char(userdata);
-      buffer[(i + 3) & 7] = ch;
-      if (ch == 0) {
-        sentence_len = i + 3;
-      }
-    } else {
-      buffer[(i + 3) & 7] = 0;
+static bool annotator_copy(struct annotator *const a, size_t const end) {
+  if (!buffer_append(a->model, a->out, a->src + a->copied, end - a->copied)) {
+    return false;
+  }
+  a->copied = end;
+  return true;
+}
+
+static inline bool annotator_decide(struct annotator *const a, size_t const k) {
+  if (k < 3 || !window_boundary(&a->w, k - 2, a->base_score)) {
+    return true;
+  }
+  return annotator_copy(a, a->offsets[(k - 2) & 7]) &&
+         buffer_append(a->model, a->out, a->separator, a->separator_len);
+}
+
+static inline bool annotator_push(struct annotator *const a, char32_t const ch, size_t const offset) {
+  size_t const k = a->k++;
+  window_push(&a->w, a->model, k, ch);
+  a->offsets[k & 7] = offset;
+  return annotator_decide(a, k);
+}
+
+// Ends the current sentence.
+static bool annotator_end(struct annotator *const a) {
+  for (size_t const end = a->k + 2; a->k < end; ++a->k) {
+    window_end(&a->w, a->k);
+    if (!annotator_decide(a, a->k)) {
+      return false;
     }
+  }
+  window_init(&a->w);
+  a->k = 0;
+  return true;
+}
+
+static inline char ascii_lower(char const c) { return c >= 'A' && c <= 'Z' ? (char)(c - 'A' + 'a') : c; }
 
-    int32_t score = 0;
-    if (i >= 3) {
-      get_unigram_score_char32(&score, model->uni[0], buffer[(i + 5) & 7]);
+static inline bool ascii_alnum(char const c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+// Returns whether the tag name is one of the space-separated names in list, ignoring case.
+static bool tag_name_in(char const *const name, size_t const name_len, char const *list) {
+  while (*list) {
+    size_t n = 0;
+    while (list[n] && list[n] != ' ') {
+      ++n;
     }
-    if (i >= 2) {
-      get_unigram_score_char32(&score, model->uni[1], buffer[(i + 6) & 7]);
+    if (n == name_len) {
+      size_t i = 0;
+      while (i < n && ascii_lower(name[i]) == list[i]) {
+        ++i;
+      }
+      if (i == n) {
+        return true;
+      }
     }
-    get_unigram_score_char32(&score, model->uni[2], buffer[(i + 7) & 7]);
-    get_unigram_score_char32(&score, model->uni[3], buffer[i & 7]);
-    if (i + 1 < sentence_len) {
-      get_unigram_score_char32(&score, model->uni[4], buffer[(i + 1) & 7]);
+    list += list[n] ? n + 1 : n;
+  }
+  return false;
+}
+
+// Elements whose content is not text to be segmented.
+static char const html_raw_elements[] = "script style textarea title template";
+
+// Elements that start or end a sentence.
+static char const html_block_elements[] =
+    "address article aside blockquote br caption dd details dialog div dl dt fieldset figcaption figure footer form "
+    "h1 h2 h3 h4 h5 h6 header hgroup hr li main nav ol option p pre section summary table tbody td tfoot th thead "
+    "tr ul";
+
+// Finds needle in src from pos, or returns len.
+static size_t find_str(char const *const src, size_t const len, size_t const pos, char const *const needle) {
+  size_t const n = strlen(needle);
+  for (size_t i = pos; i + n <= len; ++i) {
+    if (memcmp(src + i, needle, n) == 0) {
+      return i;
     }
-    if (i + 2 < sentence_len) {
-      get_unigram_score_char32(&score, model->uni[5], buffer[(i + 2) & 7]);
+  }
+  return len;
+}
+
+// Finds the end tag of a raw text element, or returns len.
+static size_t find_end_tag(char const *const src, size_t const len, size_t pos, char const *const name, size_t n) {
+  for (; (pos = find_str(src, len, pos, "</")) < len; pos += 2) {
+    if (pos + 2 + n <= len) {
+      size_t i = 0;
+      while (i < n && ascii_lower(src[pos + 2 + i]) == ascii_lower(name[i])) {
+        ++i;
+      }
+      if (i == n && (pos + 2 + n == len || !ascii_alnum(src[pos + 2 + n]))) {
+        return pos;
+      }
     }
+  }
+  return len;
+}
 
-    if (i >= 2) {
-      get_bigram_score_char32(&score, model->bi[0], buffer[(i + 6) & 7], buffer[(i + 7) & 7]);
+// Decodes the character reference at src[pos], which is '&'. Returns the length of the reference, or 0 if it is not
+// one, in which case '&' is an ordinary character.
+static size_t decode_entity(char const *const src, size_t const len, size_t const pos, char32_t *const ch) {
+  static struct {
+    char const *name;
+    char32_t ch;
+  } const named[] = {
+      {"amp", '&'}, {"lt", '<'}, {"gt", '>'}, {"quot", '"'}, {"apos", '\''}, {"nbsp", 0xa0},
+  };
+  size_t end = pos + 1;
+  while (end < len && end - pos < 32 && (ascii_alnum(src[end]) || src[end] == '#')) {
+    ++end;
+  }
+  if (end >= len || src[end] != ';' || end == pos + 1) {
+    return 0;
+  }
+  char const *const body = src + pos + 1;
+  size_t const body_len = end - pos - 1;
+  *ch = 0xfffd;
+  if (body[0] == '#') {
+    bool const hex = body_len > 1 && (body[1] == 'x' || body[1] == 'X');
+    char32_t v = 0;
+    for (size_t i = hex ? 2 : 1; i < body_len; ++i) {
+      char const c = ascii_lower(body[i]);
+      uint32_t d = 16;
+      if (c >= '0' && c <= '9') {
+        d = (uint32_t)(c - '0');
+      } else if (hex && c >= 'a' && c <= 'f') {
+        d = (uint32_t)(c - 'a' + 10);
+      }
+      if (d >= (hex ? 16u : 10u) || v > CODEPOINT_MAX) {
+        return end + 1 - pos;
+      }
+      v = v * (hex ? 16 : 10) + d;
     }
-    get_bigram_score_char32(&score, model->bi[1], buffer[(i + 7) & 7], buffer[i & 7]);
-    if (i + 1 < sentence_len) {
-      get_bigram_score_char32(&score, model->bi[2], buffer[i & 7], buffer[(i + 1) & 7]);
+    if (v <= CODEPOINT_MAX) {
+      *ch = v;
     }
-
-    if (i >= 3) {
-      get_trigram_score_char32(&score, model->tri[0], buffer[(i + 5) & 7], buffer[(i + 6) & 7], buffer[(i + 7) & 7]);
+    return end + 1 - pos;
+  }
+  for (size_t i = 0; i < ARRAY_SIZE(named); ++i) {
+    if (strlen(named[i].name) == body_len && memcmp(named[i].name, body, body_len) == 0) {
+      *ch = named[i].ch;
+      break;
     }
-    if (i >= 2) {
-      get_trigram_score_char32(&score, model->tri[1], buffer[(i + 6) & 7], buffer[(i + 7) & 7], buffer[i & 7]);
+  }
+  return end + 1 - pos;
+}
+
+// Moves *pos past the markup at src[*pos], which is '<', ending the sentence at block-level elements. *pos is left as
+// is if '<' is an ordinary character. Returns false if out of memory.
+static bool annotate_markup(struct annotator *const a, size_t const len, size_t *const pos) {
+  char const *const src = a->src;
+  size_t p = *pos + 1;
+  if (p >= len) {
+    return true;
+  }
+  if (src[p] == '!' || src[p] == '?') {
+    if (len - p >= 3 && memcmp(src + p, "!--", 3) == 0) {
+      size_t const end = find_str(src, len, p + 3, "-->");
+      *pos = end < len ? end + 3 : len;
+    } else if (len - p >= 8 && memcmp(src + p, "![CDATA[", 8) == 0) {
+      size_t const end = find_str(src, len, p + 8, "]]>");
+      *pos = end < len ? end + 3 : len;
+    } else {
+      size_t const end = find_str(src, len, p, ">");
+      *pos = end < len ? end + 1 : len;
     }
-    if (i + 1 < sentence_len) {
-      get_trigram_score_char32(&score, model->tri[2], buffer[(i + 7) & 7], buffer[i & 7], buffer[(i + 1) & 7]);
+    return true;
+  }
+  bool const closing = src[p] == '/';
+  if (closing) {
+    ++p;
+  }
+  if (p >= len || !((src[p] >= 'a' && src[p] <= 'z') || (src[p] >= 'A' && src[p] <= 'Z'))) {
+    return true;
+  }
+  size_t const name = p;
+  while (p < len && (ascii_alnum(src[p]) || src[p] == '-' || src[p] == ':')) {
+    ++p;
+  }
+  size_t const name_len = p - name;
+  char quote = 0;
+  for (; p < len && (quote || src[p] != '>'); ++p) {
+    if (quote) {
+      quote = src[p] == quote ? 0 : quote;
+    } else if (src[p] == '"' || src[p] == '\'') {
+      quote = src[p];
     }
-    if (i + 2 < sentence_len) {
-      get_trigram_score_char32(&score, model->tri[3], buffer[i & 7], buffer[(i + 1) & 7], buffer[(i + 2) & 7]);
+  }
+  bool const self_closing = p < len && src[p - 1] == '/';
+  p = p < len ? p + 1 : len;
+  if (tag_name_in(src + name, name_len, html_block_elements)) {
+    if (!annotator_end(a)) {
+      return false;
     }
+  }
+  if (!closing && !self_closing && tag_name_in(src + name, name_len, html_raw_elements)) {
+    p = find_end_tag(src, len, p, src + name, name_len);
+  }
+  *pos = p;
+  return true;
+}
 
-    if (base_score + (FLOAT_TYPE)(score) > 0) {
-      if (!add_boundary(i, userdata)) {
+bool BUDOUXC_DECLSPEC budouxc_annotate_html(struct budouxc *const model,
+                                            char const *const html,
+                                            size_t const html_len,
+                                            char const *const separator,
+                                            size_t const separator_len,
+                                            struct budouxc_buffer *const out,
+                                            char *error128) {
+  if (!model || (!html && html_len) || (!separator && separator_len) || !out) {
+    strcpy(error128, "Invalid arguments");
+    return false;
+  }
+  struct annotator a = {
+      .model = model,
+      .base_score = (FLOAT_TYPE)(model->sum) * (FLOAT_TYPE)(-0.5),
+      .src = html,
+      .separator = separator,
+      .separator_len = separator_len,
+      .out = out,
+  };
+  window_init(&a.w);
+  char32_t chars[UTF8_CHUNK_SIZE];
+  size_t chunk_offsets[UTF8_CHUNK_SIZE];
+  size_t pos = 0;
+  while (pos < html_len) {
+    char const c = html[pos];
+    if (c == '<') {
+      size_t const start = pos;
+      if (!annotate_markup(&a, html_len, &pos)) {
+        goto out_of_memory;
+      }
+      if (pos != start) {
+        continue;
+      }
+    }
+    if (c == '&' || c == '<') {
+      char32_t ch = (char32_t)c;
+      size_t const n = c == '&' ? decode_entity(html, html_len, pos, &ch) : 0;
+      if (!annotator_push(&a, ch, pos)) {
+        goto out_of_memory;
+      }
+      pos += n ? n : 1;
+      continue;
+    }
+    // Decode the text up to the next markup or character reference.
+    size_t end = pos + 1;
+    while (end < html_len && html[end] != '<' && html[end] != '&') {
+      ++end;
+    }
+    while (pos < end) {
+      size_t const n = utf8_decode(chars, chunk_offsets, UTF8_CHUNK_SIZE, (uint8_t const *)html, end, &pos);
+      if (n == SIZE_MAX) {
+        strcpy(error128, "Broken input");
         return false;
       }
+      for (size_t j = 0; j < n; ++j) {
+        if (!annotator_push(&a, chars[j], chunk_offsets[j])) {
+          goto out_of_memory;
+        }
+      }
     }
   }
+  if (!annotator_end(&a) || !annotator_copy(&a, html_len)) {
+    goto out_of_memory;
+  }
   return true;
+out_of_memory:
+  strcpy(error128, "Out of memory");
+  return false;
 }
 
-struct budouxc_boundaries *BUDOUXC_DECLSPEC budouxc_parse_boundaries_utf8(struct budouxc *const model,
-                                                                          char const *const sentence,
-                                                                          size_t const sentence_len,
-                                                                          char *error128) {
-  char32_t *temp = NULL;
-  struct budouxc_boundaries *boundaries = NULL;
-  size_t const u32chars = utf8to32(NULL, NULL, 0, sentence, sentence_len);
-  if (!u32chars) {
-    strcpy(error128, "Broken input");
-    goto failed;
-  }
-  temp =
-      model->allocators.fn_realloc(NULL, u32chars * (sizeof(char32_t) + sizeof(size_t)), model->allocators.user_data);
-  if (!temp) {
-    strcpy(error128, "Out of memory");
-    goto failed;
-  }
-  size_t *const utf8_indices = (void *)(temp + u32chars);
-  if (!utf8to32(temp, utf8_indices, u32chars, sentence, sentence_len)) {
-    strcpy(error128, "Broken input");
-    goto failed;
-  }
-  boundaries = budouxc_parse_boundaries_utf32(model, temp, u32chars, error128);
-  if (!boundaries) {
-    goto failed;
-  }
-  // Convert UTF-32 indices to UTF-8 indices.
-  for (size_t i = 0, len = boundaries->n; i < len; ++i) {
-    boundaries->indices[i] = utf8_indices[boundaries->indices[i]];
-  }
-  model->allocators.fn_free(temp, model->allocators.user_data);
-  return boundaries;
-failed:
-  if (boundaries) {
-    budouxc_boundaries_destroy(model, boundaries);
+void BUDOUXC_DECLSPEC budouxc_buffer_destroy(struct budouxc *const model, struct budouxc_buffer *const buffer) {
+  if (!model || !buffer) {
+    return;
   }
-  if (temp) {
-    model->allocators.fn_free(temp, model->allocators.user_data);
+  if (buffer->ptr) {
+    model->allocators.fn_free(buffer->ptr, model->allocators.user_data);
   }
-  return NULL;
+  *buffer = (struct budouxc_buffer){0};
 }
 
 void BUDOUXC_DECLSPEC budouxc_boundaries_destroy(struct budouxc *const model,
@@ -631,30 +4876,73 @@ void BUDOUXC_DECLSPEC budouxc_boundaries_destroy(struct budouxc *const model,
 
 struct budouxc *BUDOUXC_DECLSPEC budouxc_init_embedded_ja(struct budouxc_allocators const *const allocators,
                                                           char *error128) {
-  extern unsigned char ja_json[];
-  extern unsigned int ja_json_len;
-  return budouxc_init(allocators, (char const *)ja_json, (size_t)ja_json_len, error128);
+  extern uint64_t const ja_model[];
+  extern size_t const ja_model_len;
+  return budouxc_init_binary(allocators, ja_model, ja_model_len, error128);
 }
 
 struct budouxc *BUDOUXC_DECLSPEC budouxc_init_embedded_zh_hans(struct budouxc_allocators const *const allocators,
                                                                char *error128) {
-  extern unsigned char zh_hans_json[];
-  extern unsigned int zh_hans_json_len;
-  return budouxc_init(allocators, (char const *)zh_hans_json, (size_t)zh_hans_json_len, error128);
+  extern uint64_t const zh_hans_model[];
+  extern size_t const zh_hans_model_len;
+  return budouxc_init_binary(allocators, zh_hans_model, zh_hans_model_len, error128);
 }
 
 struct budouxc *BUDOUXC_DECLSPEC budouxc_init_embedded_zh_hant(struct budouxc_allocators const *const allocators,
                                                                char *error128) {
-  extern unsigned char zh_hant_json[];
-  extern unsigned int zh_hant_json_len;
-  return budouxc_init(allocators, (char const *)zh_hant_json, (size_t)zh_hant_json_len, error128);
+  extern uint64_t const zh_hant_model[];
+  extern size_t const zh_hant_model_len;
+  return budouxc_init_binary(allocators, zh_hant_model, zh_hant_model_len, error128);
 }
 
 struct budouxc *BUDOUXC_DECLSPEC budouxc_init_embedded_th(struct budouxc_allocators const *const allocators,
                                                           char *error128) {
-  extern unsigned char th_json[];
-  extern unsigned int th_json_len;
-  return budouxc_init(allocators, (char const *)th_json, (size_t)th_json_len, error128);
+  extern uint64_t const th_model[];
+  extern size_t const th_model_len;
+  return budouxc_init_binary(allocators, th_model, th_model_len, error128);
+}
+
+// Shared embedded models are keyed by these IDs.
+enum embedded_model {
+  embedded_model_ja = 1,
+  embedded_model_zh_hans,
+  embedded_model_zh_hant,
+  embedded_model_th,
+};
+
+static struct budouxc *acquire_embedded(enum embedded_model const id,
+                                        struct budouxc *(*const init)(struct budouxc_allocators const *, char *),
+                                        struct budouxc_allocators const *const allocators,
+                                        char *const error128) {
+  struct shared_key const key = {
+      .hash = {(uint64_t)id, 0},
+  };
+  struct budouxc *const model = shared_get(&key);
+  if (model) {
+    return model;
+  }
+  struct budouxc *const loaded = init(allocators, error128);
+  return loaded ? shared_put(loaded, &key) : NULL;
+}
+
+struct budouxc *BUDOUXC_DECLSPEC budouxc_acquire_embedded_ja(struct budouxc_allocators const *const allocators,
+                                                             char *error128) {
+  return acquire_embedded(embedded_model_ja, budouxc_init_embedded_ja, allocators, error128);
+}
+
+struct budouxc *BUDOUXC_DECLSPEC budouxc_acquire_embedded_zh_hans(struct budouxc_allocators const *const allocators,
+                                                                  char *error128) {
+  return acquire_embedded(embedded_model_zh_hans, budouxc_init_embedded_zh_hans, allocators, error128);
+}
+
+struct budouxc *BUDOUXC_DECLSPEC budouxc_acquire_embedded_zh_hant(struct budouxc_allocators const *const allocators,
+                                                                  char *error128) {
+  return acquire_embedded(embedded_model_zh_hant, budouxc_init_embedded_zh_hant, allocators, error128);
+}
+
+struct budouxc *BUDOUXC_DECLSPEC budouxc_acquire_embedded_th(struct budouxc_allocators const *const allocators,
+                                                             char *error128) {
+  return acquire_embedded(embedded_model_th, budouxc_init_embedded_th, allocators, error128);
 }
 
 #endif // BUDOUXC_NO_EMBEDDED_MODELS
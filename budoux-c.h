@@ -2,6 +2,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <uchar.h>
 
 #if (defined(_WIN32) || defined(WIN32)) && defined(BUDOUXC_SHARED)
@@ -16,6 +17,10 @@
 
 /**
  * @brief Struct containing memory allocation functions to be used by budoux.
+ *
+ * If `fn_realloc` or `fn_free` is NULL, the default implementation is used for both. Functions that take a number of
+ * threads call them from all of those threads at the same time, so they must be thread-safe whenever more than one
+ * thread is used.
  */
 struct budouxc_allocators {
   void *(*fn_realloc)(void *ptr, size_t size, void *user_data);
@@ -23,9 +28,20 @@ struct budouxc_allocators {
   void *user_data;
 };
 
+/**
+ * @brief BudouX model.
+ *
+ * A model is never modified after initialization, and parsing only reads it. One model can therefore be used from any
+ * number of threads at the same time, as long as it is not destroyed while in use.
+ */
+struct budouxc;
+
 /**
  * @brief Initializes a budoux model with the given JSON.
  *
+ * The JSON is read in a single pass straight into the n-gram maps, without building a tree of its values. Syntax
+ * errors are reported with their line and column.
+ *
  * @param allocators Pointer to the struct containing the memory allocation functions to be used. If NULL, default
  * implementation will be used.
  * @param json Pointer to the JSON string.
@@ -38,6 +54,280 @@ struct budouxc *BUDOUXC_DECLSPEC budouxc_init(struct budouxc_allocators const *c
                                               size_t const json_len,
                                               char *error128);
 
+/**
+ * @brief Initializes a budoux model with the given JSON on multiple threads.
+ *
+ * The JSON is read once to locate the weight objects, and then the unigram, bigram and trigram maps are built and
+ * frozen into lookup tables on a thread each. The model is the same as the one `budouxc_init` makes. With more than one
+ * thread, the allocators are called from all of them.
+ *
+ * @param allocators Pointer to the struct containing the memory allocation functions to be used. If NULL, default
+ * implementation will be used.
+ * @param json Pointer to the JSON string.
+ * @param json_len Length of the JSON string.
+ * @param threads Number of threads to use, including the calling thread. 0 or 1 behaves like `budouxc_init`, and no
+ * more than 3 are used.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the initialized budoux model, or NULL if initialization failed.
+ *
+ * @see budouxc_init
+ */
+struct budouxc *BUDOUXC_DECLSPEC budouxc_init_parallel(struct budouxc_allocators const *const allocators,
+                                                       char const *const json,
+                                                       size_t const json_len,
+                                                       size_t const threads,
+                                                       char *error128);
+
+/**
+ * @brief Callbacks that run the worker threads of the functions taking a number of threads.
+ *
+ * `spawn` starts a task that calls `fn(arg)` and returns a handle for it, or NULL if it cannot be started, in which
+ * case its work is done by the other threads. `join` waits until the task of a handle has returned. Tasks of one call
+ * may run at the same time as each other and as the calling thread, but a scheduler may also run them one after
+ * another, for example when they are joined.
+ */
+struct budouxc_thread_hooks {
+  void *(*spawn)(void (*fn)(void *arg), void *arg, void *userdata);
+  void (*join)(void *task, void *userdata);
+  void *userdata;
+};
+
+/**
+ * @brief Registers the callbacks used to start worker threads instead of the threads of the platform.
+ *
+ * This lets `budouxc_init_parallel`, `budouxc_parse_batch_*` and `budouxc_parse_boundaries_parallel_*` use more than
+ * one thread on hosts without pthreads or Win32 threads, such as WASI, or on a task scheduler of the application.
+ * The hooks must not be changed while other threads are using the library.
+ *
+ * @param hooks Pointer to the callbacks, which are copied. If NULL, the threads of the platform are used again.
+ * @return true if successful, false if only one of `spawn` and `join` is set.
+ */
+bool BUDOUXC_DECLSPEC budouxc_set_thread_hooks(struct budouxc_thread_hooks const *const hooks);
+
+/**
+ * @brief Returns the model for the given JSON that is shared by the whole process, loading it on first use.
+ *
+ * Models are looked up by a 128-bit hash of the JSON and its length, so every component of a process that acquires
+ * the same JSON gets the same model instead of a copy of its own. Each successful call takes a reference, which is
+ * released with `budouxc_destroy`, and the model is freed when the last one is. This function is thread-safe.
+ *
+ * A shared model is allocated with the allocators of the call that loads it, which must stay usable until it is freed.
+ *
+ * @param allocators Pointer to the struct containing the memory allocation functions to be used if the model has to be
+ * loaded. If NULL, default implementation will be used.
+ * @param json Pointer to the JSON string.
+ * @param json_len Length of the JSON string.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the shared budoux model, or NULL if initialization failed.
+ *
+ * @see budouxc_init
+ * @see budouxc_destroy
+ */
+struct budouxc *BUDOUXC_DECLSPEC budouxc_acquire(struct budouxc_allocators const *const allocators,
+                                                 char const *const json,
+                                                 size_t const json_len,
+                                                 char *error128);
+
+/**
+ * @brief Initializes a budoux model from a binary model written by `budouxc_write_binary`.
+ *
+ * The data is used in place without copying or parsing, so it must stay valid and unchanged until the model is
+ * destroyed. The layout of the data is checked so that lookups stay in bounds and end, but the weights are used as they
+ * are, so the data should come from `budouxc_write_binary`.
+ *
+ * @param allocators Pointer to the struct containing the memory allocation functions to be used. If NULL, default
+ * implementation will be used.
+ * @param data Pointer to the binary model. It must be aligned to 8 bytes.
+ * @param data_len Length of the binary model in bytes.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the initialized budoux model, or NULL if initialization failed.
+ *
+ * @see budouxc_write_binary
+ */
+struct budouxc *BUDOUXC_DECLSPEC budouxc_init_binary(struct budouxc_allocators const *const allocators,
+                                                     void const *const data,
+                                                     size_t const data_len,
+                                                     char *error128);
+
+/**
+ * @brief Initializes a budoux model by memory-mapping a binary model file written by `budouxc_write_binary`.
+ *
+ * The file is mapped read-only and shared, so processes loading the same file share one copy in the page cache. The
+ * mapping is released by `budouxc_destroy`. On platforms without mmap such as WASI, the file is read into memory.
+ *
+ * @param allocators Pointer to the struct containing the memory allocation functions to be used. If NULL, default
+ * implementation will be used.
+ * @param path Path to the binary model file, encoded in UTF-8.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the initialized budoux model, or NULL if initialization failed.
+ *
+ * @see budouxc_write_binary
+ */
+struct budouxc *BUDOUXC_DECLSPEC budouxc_init_mmap(struct budouxc_allocators const *const allocators,
+                                                   char const *const path,
+                                                   char *error128);
+
+/**
+ * @brief Initializes a compact copy of a budoux model.
+ *
+ * A compact model packs keys into fewer bits and stores weights as 16-bit integers, which takes well under half of the
+ * memory. Each of the unigram, bigram and trigram tables is scaled by the smallest power of two 2^s that
+ * fits its weights, so that each weight is off by at most 2^(s-1), and a score by at most 13 * 2^(s-1) with the
+ * largest s. A boundary can only differ from the source model where the score is that close to the threshold.
+ * Models whose weights all fit in 16 bits, such as the embedded Japanese and Thai models, give identical boundaries.
+ *
+ * The compact model does not refer to the source model, which can be destroyed right away. It can be written with
+ * `budouxc_write_binary` and loaded again as is.
+ *
+ * @param allocators Pointer to the struct containing the memory allocation functions to be used. If NULL, default
+ * implementation will be used.
+ * @param source Pointer to the budoux model to copy. It must not be compact itself.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the initialized budoux model, or NULL if initialization failed.
+ *
+ * @see budouxc_model_bytes
+ */
+struct budouxc *BUDOUXC_DECLSPEC budouxc_init_compact(struct budouxc_allocators const *const allocators,
+                                                      struct budouxc const *const source,
+                                                      char *error128);
+
+/**
+ * @brief Initializes a copy of a budoux model without its smallest weights.
+ *
+ * Each n-gram keeps the weights of all positions it appears at, and it is removed when all of them are smaller than
+ * the threshold in magnitude. A removed n-gram scores as if it were not in the model, while the score threshold stays
+ * that of the source model. A threshold of 0 removes nothing.
+ *
+ * The pruned model does not refer to the source model, which can be destroyed right away.
+ *
+ * @param allocators Pointer to the struct containing the memory allocation functions to be used. If NULL, default
+ * implementation will be used.
+ * @param source Pointer to the budoux model to copy. It must not be compact.
+ * @param threshold Weights whose magnitude is smaller than this are removed.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the initialized budoux model, or NULL if initialization failed.
+ *
+ * @see budouxc_init_compact
+ * @see budouxc_model_bytes
+ */
+struct budouxc *BUDOUXC_DECLSPEC budouxc_init_pruned(struct budouxc_allocators const *const allocators,
+                                                     struct budouxc const *const source,
+                                                     int32_t const threshold,
+                                                     char *error128);
+
+/**
+ * @brief Writes the model in the binary model format.
+ *
+ * The format is versioned and position independent, but it uses the byte order of the running machine.
+ *
+ * @param model Pointer to the budoux model.
+ * @param dest Pointer to the buffer to write to. If NULL or smaller than the required size, nothing is written.
+ * @param dest_len Size of the buffer in bytes.
+ * @return The size of the binary model in bytes.
+ *
+ * @see budouxc_init_binary
+ * @see budouxc_init_mmap
+ */
+size_t BUDOUXC_DECLSPEC budouxc_write_binary(struct budouxc const *const model,
+                                             void *const dest,
+                                             size_t const dest_len);
+
+/**
+ * @brief Writes the model in the binary model format, in the opposite byte order of the running machine.
+ *
+ * This lets a tool running on a little-endian machine write a binary model for a big-endian one, and the other way
+ * around. The result is rejected by `budouxc_init_binary` on the running machine.
+ *
+ * @param model Pointer to the budoux model.
+ * @param dest Pointer to the buffer to write to. If NULL or smaller than the required size, nothing is written.
+ * @param dest_len Size of the buffer in bytes.
+ * @return The size of the binary model in bytes.
+ *
+ * @see budouxc_write_binary
+ */
+size_t BUDOUXC_DECLSPEC budouxc_write_binary_swapped(struct budouxc const *const model,
+                                                     void *const dest,
+                                                     size_t const dest_len);
+
+/**
+ * @brief Returns the number of bytes of memory the model reads from.
+ *
+ * This is the model object itself plus its lookup tables, whether they were allocated, borrowed from
+ * `budouxc_init_binary` or mapped by `budouxc_init_mmap`. Nothing else is kept alive by a model.
+ *
+ * @param model Pointer to the budoux model.
+ * @return The size of the model in bytes.
+ */
+size_t BUDOUXC_DECLSPEC budouxc_model_bytes(struct budouxc const *const model);
+
+/**
+ * @brief Number of buckets in `budouxc_table_stats.probe_lengths`.
+ */
+#define BUDOUXC_PROBE_LENGTHS 8
+
+/**
+ * @brief Number of weights in each position of the window: UW1 to UW6, BW1 to BW3 and TW1 to TW4.
+ */
+#define BUDOUXC_FEATURES 13
+
+/**
+ * @brief Statistics of one lookup table of a model.
+ *
+ * `probe_lengths[i]` is the number of entries found with i + 1 probes, and the last bucket also counts longer probes.
+ * `average_miss_probes` is the number of probes to find that a key is not in the table, averaged over all slots it
+ * could start from.
+ *
+ * The hits, misses and skipped fields count lookups since the model was initialized, and they are only updated when
+ * budoux-c is built with `BUDOUXC_COUNT_LOOKUPS`. An n-gram is skipped instead of looked up when one of its characters
+ * is not in the model. Runs of such characters are decided without looking up their n-grams at all, and they are not
+ * counted.
+ */
+struct budouxc_table_stats {
+  size_t entries;
+  size_t capacity;
+  size_t bytes;
+  double load_factor;
+  size_t probe_lengths[BUDOUXC_PROBE_LENGTHS];
+  double average_probes;
+  double average_miss_probes;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t skipped;
+};
+
+/**
+ * @brief Statistics of a model.
+ *
+ * The n-grams of each length share one table, indexed by `tables[0]` for unigrams, `tables[1]` for bigrams and
+ * `tables[2]` for trigrams. `weights` counts the nonzero weights of each feature, in the order of
+ * `BUDOUXC_FEATURES`.
+ */
+struct budouxc_model_stats {
+  size_t bytes;
+  size_t charmap_bytes;
+  size_t characters;
+  int32_t sum;
+  double base_score;
+  bool compact;
+  bool counting;
+  struct budouxc_table_stats tables[3];
+  size_t weights[BUDOUXC_FEATURES];
+};
+
+/**
+ * @brief Collects the statistics of a model.
+ *
+ * The tables are scanned on every call, which takes time in proportion to the size of the model. Lookup counters are
+ * read while other threads may still be parsing, so they can be slightly behind each other.
+ *
+ * @param model Pointer to the budoux model.
+ * @param stats Pointer to the struct to fill.
+ * @return true if successful, false if model or stats is NULL.
+ *
+ * @see budouxc_model_bytes
+ */
+bool BUDOUXC_DECLSPEC budouxc_model_stats(struct budouxc const *const model, struct budouxc_model_stats *const stats);
+
 #ifndef BUDOUXC_NO_EMBEDDED_MODELS
 
 /**
@@ -92,11 +382,66 @@ struct budouxc *BUDOUXC_DECLSPEC budouxc_init_embedded_zh_hant(struct budouxc_al
 struct budouxc *BUDOUXC_DECLSPEC budouxc_init_embedded_th(struct budouxc_allocators const *const allocators,
                                                           char *error128);
 
+/**
+ * @brief Returns the embedded Japanese model that is shared by the whole process, loading it on first use.
+ *
+ * @param allocators Pointer to the struct containing the memory allocation functions to be used if the model has to be
+ * loaded. If NULL, default implementation will be used.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the shared budoux model, or NULL if initialization failed.
+ *
+ * @see budouxc_acquire
+ */
+struct budouxc *BUDOUXC_DECLSPEC budouxc_acquire_embedded_ja(struct budouxc_allocators const *const allocators,
+                                                             char *error128);
+
+/**
+ * @brief Returns the embedded Simplified Chinese model that is shared by the whole process, loading it on first use.
+ *
+ * @param allocators Pointer to the struct containing the memory allocation functions to be used if the model has to be
+ * loaded. If NULL, default implementation will be used.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the shared budoux model, or NULL if initialization failed.
+ *
+ * @see budouxc_acquire
+ */
+struct budouxc *BUDOUXC_DECLSPEC budouxc_acquire_embedded_zh_hans(struct budouxc_allocators const *const allocators,
+                                                                  char *error128);
+
+/**
+ * @brief Returns the embedded Traditional Chinese model that is shared by the whole process, loading it on first use.
+ *
+ * @param allocators Pointer to the struct containing the memory allocation functions to be used if the model has to be
+ * loaded. If NULL, default implementation will be used.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the shared budoux model, or NULL if initialization failed.
+ *
+ * @see budouxc_acquire
+ */
+struct budouxc *BUDOUXC_DECLSPEC budouxc_acquire_embedded_zh_hant(struct budouxc_allocators const *const allocators,
+                                                                  char *error128);
+
+/**
+ * @brief Returns the embedded Thai model that is shared by the whole process, loading it on first use.
+ *
+ * @param allocators Pointer to the struct containing the memory allocation functions to be used if the model has to be
+ * loaded. If NULL, default implementation will be used.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the shared budoux model, or NULL if initialization failed.
+ *
+ * @see budouxc_acquire
+ */
+struct budouxc *BUDOUXC_DECLSPEC budouxc_acquire_embedded_th(struct budouxc_allocators const *const allocators,
+                                                             char *error128);
+
 #endif // BUDOUXC_NO_EMBEDDED_MODELS
 
 /**
  * @brief Destroys a budoux model and frees all associated memory.
  *
+ * A model from `budouxc_acquire` or `budouxc_acquire_embedded_xxx` is only freed when its last reference is released,
+ * and each call releases one reference.
+ *
  * @param model Pointer to the budoux model to be destroyed.
  */
 void BUDOUXC_DECLSPEC budouxc_destroy(struct budouxc *const model);
@@ -176,6 +521,491 @@ struct budouxc_boundaries *BUDOUXC_DECLSPEC budouxc_parse_boundaries_utf8(struct
 void BUDOUXC_DECLSPEC budouxc_boundaries_destroy(struct budouxc *const model,
                                                  struct budouxc_boundaries *const boundaries);
 
+/**
+ * @brief Parses a sentence and writes the word boundaries into a caller-provided buffer.
+ *
+ * Nothing is allocated. If the buffer is too small, only the first indices_len boundaries are written, and the return
+ * value tells how large the buffer needs to be.
+ *
+ * @param model Pointer to the budoux model to be used for parsing.
+ * @param sentence Pointer to the sentence to be parsed, as an array of UTF-32 code points.
+ * @param sentence_len Length of the sentence in code points.
+ * @param indices Pointer to the buffer to write the indices of the word boundaries to. Can be NULL.
+ * @param indices_len Number of indices the buffer can hold.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return The number of word boundaries, or SIZE_MAX if parsing failed.
+ */
+size_t BUDOUXC_DECLSPEC budouxc_parse_boundaries_utf32_into(struct budouxc *const model,
+                                                           char32_t const *const sentence,
+                                                           size_t const sentence_len,
+                                                           size_t *const indices,
+                                                           size_t const indices_len,
+                                                           char *error128);
+
+/**
+ * @brief Parses a sentence and writes the word boundaries into a caller-provided buffer.
+ *
+ * Nothing is allocated. If the buffer is too small, only the first indices_len boundaries are written, and the return
+ * value tells how large the buffer needs to be.
+ *
+ * @param model Pointer to the budoux model to be used for parsing.
+ * @param sentence Pointer to the sentence to be parsed, as an array of UTF-16 code points.
+ * @param sentence_len Length of the sentence in code points.
+ * @param indices Pointer to the buffer to write the indices of the word boundaries to. Can be NULL.
+ * @param indices_len Number of indices the buffer can hold.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return The number of word boundaries, or SIZE_MAX if parsing failed.
+ */
+size_t BUDOUXC_DECLSPEC budouxc_parse_boundaries_utf16_into(struct budouxc *const model,
+                                                           char16_t const *const sentence,
+                                                           size_t const sentence_len,
+                                                           size_t *const indices,
+                                                           size_t const indices_len,
+                                                           char *error128);
+
+/**
+ * @brief Parses a sentence and writes the word boundaries into a caller-provided buffer.
+ *
+ * Nothing is allocated. If the buffer is too small, only the first indices_len boundaries are written, and the return
+ * value tells how large the buffer needs to be.
+ *
+ * @param model Pointer to the budoux model to be used for parsing.
+ * @param sentence Pointer to the sentence to be parsed, as a UTF-8 string.
+ * @param sentence_len Length of the sentence in bytes.
+ * @param indices Pointer to the buffer to write the byte indices of the word boundaries to. Can be NULL.
+ * @param indices_len Number of indices the buffer can hold.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return The number of word boundaries, or SIZE_MAX if parsing failed.
+ */
+size_t BUDOUXC_DECLSPEC budouxc_parse_boundaries_utf8_into(struct budouxc *const model,
+                                                          char const *const sentence,
+                                                          size_t const sentence_len,
+                                                          size_t *const indices,
+                                                          size_t const indices_len,
+                                                          char *error128);
+
+/**
+ * @brief Reusable parser workspace.
+ *
+ * A parser keeps its output buffer between calls, so parsing many sentences does not allocate once the buffer is
+ * large enough. A parser must not be used from multiple threads at the same time, but multiple parsers can share a
+ * model.
+ */
+struct budouxc_parser;
+
+/**
+ * @brief Creates a parser workspace for the given model.
+ *
+ * @param model Pointer to the budoux model to be used for parsing. It must outlive the parser.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the parser, or NULL if initialization failed.
+ *
+ * @see budouxc_parser_destroy
+ */
+struct budouxc_parser *BUDOUXC_DECLSPEC budouxc_parser_init(struct budouxc *const model, char *error128);
+
+/**
+ * @brief Destroys a parser workspace and frees all associated memory.
+ *
+ * @param parser Pointer to the parser to be destroyed.
+ */
+void BUDOUXC_DECLSPEC budouxc_parser_destroy(struct budouxc_parser *const parser);
+
+/**
+ * @brief Parses a sentence and returns the word boundaries using the buffer of the parser.
+ *
+ * @param parser Pointer to the parser.
+ * @param sentence Pointer to the sentence to be parsed, as an array of UTF-32 code points.
+ * @param sentence_len Length of the sentence in code points.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the word boundaries, or NULL if parsing failed. It is owned by the parser and stays valid until
+ * the next call with the same parser or until the parser is destroyed.
+ */
+struct budouxc_boundaries const *BUDOUXC_DECLSPEC budouxc_parser_parse_utf32(struct budouxc_parser *const parser,
+                                                                             char32_t const *const sentence,
+                                                                             size_t const sentence_len,
+                                                                             char *error128);
+
+/**
+ * @brief Parses a sentence and returns the word boundaries using the buffer of the parser.
+ *
+ * @param parser Pointer to the parser.
+ * @param sentence Pointer to the sentence to be parsed, as an array of UTF-16 code points.
+ * @param sentence_len Length of the sentence in code points.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the word boundaries, or NULL if parsing failed. It is owned by the parser and stays valid until
+ * the next call with the same parser or until the parser is destroyed.
+ */
+struct budouxc_boundaries const *BUDOUXC_DECLSPEC budouxc_parser_parse_utf16(struct budouxc_parser *const parser,
+                                                                             char16_t const *const sentence,
+                                                                             size_t const sentence_len,
+                                                                             char *error128);
+
+/**
+ * @brief Parses a sentence and returns the word boundaries using the buffer of the parser.
+ *
+ * @param parser Pointer to the parser.
+ * @param sentence Pointer to the sentence to be parsed, as a UTF-8 string.
+ * @param sentence_len Length of the sentence in bytes.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the word boundaries, or NULL if parsing failed. It is owned by the parser and stays valid until
+ * the next call with the same parser or until the parser is destroyed.
+ */
+struct budouxc_boundaries const *BUDOUXC_DECLSPEC budouxc_parser_parse_utf8(struct budouxc_parser *const parser,
+                                                                            char const *const sentence,
+                                                                            size_t const sentence_len,
+                                                                            char *error128);
+
+/**
+ * @brief Parses a long sentence on multiple threads and returns the word boundaries.
+ *
+ * The sentence is split into chunks that are parsed independently with the few characters around them, so the result
+ * is exactly the same as `budouxc_parse_boundaries_utf32`. Sentences too short to benefit are parsed on the calling
+ * thread. Each chunk grows its boundaries on the worker thread that parses it, so with more than one thread the
+ * allocators are called from all of them and must be thread-safe.
+ *
+ * @param model Pointer to the budoux model to be used for parsing.
+ * @param sentence Pointer to the sentence to be parsed, as an array of UTF-32 code points.
+ * @param sentence_len Length of the sentence in code points.
+ * @param threads Number of threads to use, including the calling thread. 0 or 1 parses on the calling thread only.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the word boundaries, or NULL if parsing failed. It must be freed with
+ * `budouxc_boundaries_destroy`.
+ *
+ * @see budouxc_boundaries_destroy
+ */
+struct budouxc_boundaries *BUDOUXC_DECLSPEC budouxc_parse_boundaries_parallel_utf32(
+    struct budouxc *const model,
+    char32_t const *const sentence,
+    size_t const sentence_len,
+    size_t const threads,
+    char *error128);
+
+/**
+ * @brief Parses a long sentence on multiple threads and returns the word boundaries.
+ *
+ * The sentence is split into chunks that are parsed independently with the few characters around them, so the result
+ * is exactly the same as `budouxc_parse_boundaries_utf16`. Sentences too short to benefit are parsed on the calling
+ * thread. Each chunk grows its boundaries on the worker thread that parses it, so with more than one thread the
+ * allocators are called from all of them and must be thread-safe.
+ *
+ * @param model Pointer to the budoux model to be used for parsing.
+ * @param sentence Pointer to the sentence to be parsed, as an array of UTF-16 code points.
+ * @param sentence_len Length of the sentence in code points.
+ * @param threads Number of threads to use, including the calling thread. 0 or 1 parses on the calling thread only.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the word boundaries, or NULL if parsing failed. It must be freed with
+ * `budouxc_boundaries_destroy`.
+ *
+ * @see budouxc_boundaries_destroy
+ */
+struct budouxc_boundaries *BUDOUXC_DECLSPEC budouxc_parse_boundaries_parallel_utf16(
+    struct budouxc *const model,
+    char16_t const *const sentence,
+    size_t const sentence_len,
+    size_t const threads,
+    char *error128);
+
+/**
+ * @brief Parses a long sentence on multiple threads and returns the word boundaries.
+ *
+ * The sentence is split into chunks that are parsed independently with the few characters around them, so the result
+ * is exactly the same as `budouxc_parse_boundaries_utf8`. Sentences too short to benefit are parsed on the calling
+ * thread. Each chunk grows its boundaries on the worker thread that parses it, so with more than one thread the
+ * allocators are called from all of them and must be thread-safe.
+ *
+ * @param model Pointer to the budoux model to be used for parsing.
+ * @param sentence Pointer to the sentence to be parsed, as a UTF-8 string.
+ * @param sentence_len Length of the sentence in bytes.
+ * @param threads Number of threads to use, including the calling thread. 0 or 1 parses on the calling thread only.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the byte indices of the word boundaries, or NULL if parsing failed. It must be freed with
+ * `budouxc_boundaries_destroy`.
+ *
+ * @see budouxc_boundaries_destroy
+ */
+struct budouxc_boundaries *BUDOUXC_DECLSPEC budouxc_parse_boundaries_parallel_utf8(
+    struct budouxc *const model,
+    char const *const sentence,
+    size_t const sentence_len,
+    size_t const threads,
+    char *error128);
+
+/**
+ * @brief Updates the word boundaries of a sentence after an edit.
+ *
+ * Only the few characters around the edit are parsed again, and the other boundaries are copied from `prev` with
+ * their indices shifted past the edit. The result is the same as parsing the edited sentence from scratch.
+ *
+ * @param model Pointer to the budoux model that was used to parse the sentence before the edit.
+ * @param prev Pointer to the word boundaries of the sentence before the edit.
+ * @param sentence Pointer to the sentence after the edit, as an array of UTF-32 code points.
+ * @param sentence_len Length of the sentence after the edit in code points.
+ * @param offset Index where the edit starts, in code points.
+ * @param removed_len Length of the text removed at `offset` from the sentence before the edit, in code points.
+ * @param inserted_len Length of the text inserted at `offset` into the sentence after the edit, in code points.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the word boundaries of the sentence after the edit, or NULL if parsing failed. `prev` is left
+ * untouched. The result must be freed with `budouxc_boundaries_destroy`.
+ *
+ * @see budouxc_boundaries_destroy
+ */
+struct budouxc_boundaries *BUDOUXC_DECLSPEC budouxc_update_boundaries_utf32(
+    struct budouxc *const model,
+    struct budouxc_boundaries const *const prev,
+    char32_t const *const sentence,
+    size_t const sentence_len,
+    size_t const offset,
+    size_t const removed_len,
+    size_t const inserted_len,
+    char *error128);
+
+/**
+ * @brief Updates the word boundaries of a sentence after an edit.
+ *
+ * Only the few characters around the edit are parsed again, and the other boundaries are copied from `prev` with
+ * their indices shifted past the edit. The result is the same as parsing the edited sentence from scratch.
+ *
+ * @param model Pointer to the budoux model that was used to parse the sentence before the edit.
+ * @param prev Pointer to the word boundaries of the sentence before the edit.
+ * @param sentence Pointer to the sentence after the edit, as an array of UTF-16 code points.
+ * @param sentence_len Length of the sentence after the edit in code points.
+ * @param offset Index where the edit starts, in code points.
+ * @param removed_len Length of the text removed at `offset` from the sentence before the edit, in code points.
+ * @param inserted_len Length of the text inserted at `offset` into the sentence after the edit, in code points.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the word boundaries of the sentence after the edit, or NULL if parsing failed. `prev` is left
+ * untouched. The result must be freed with `budouxc_boundaries_destroy`.
+ *
+ * @see budouxc_boundaries_destroy
+ */
+struct budouxc_boundaries *BUDOUXC_DECLSPEC budouxc_update_boundaries_utf16(
+    struct budouxc *const model,
+    struct budouxc_boundaries const *const prev,
+    char16_t const *const sentence,
+    size_t const sentence_len,
+    size_t const offset,
+    size_t const removed_len,
+    size_t const inserted_len,
+    char *error128);
+
+/**
+ * @brief Updates the word boundaries of a sentence after an edit.
+ *
+ * Only the few characters around the edit are parsed again, and the other boundaries are copied from `prev` with
+ * their indices shifted past the edit. The result is the same as parsing the edited sentence from scratch.
+ * `offset` and `offset + inserted_len` must not point into the middle of a character.
+ *
+ * @param model Pointer to the budoux model that was used to parse the sentence before the edit.
+ * @param prev Pointer to the word boundaries of the sentence before the edit.
+ * @param sentence Pointer to the sentence after the edit, as a UTF-8 string.
+ * @param sentence_len Length of the sentence after the edit in bytes.
+ * @param offset Index where the edit starts, in bytes.
+ * @param removed_len Length of the text removed at `offset` from the sentence before the edit, in bytes.
+ * @param inserted_len Length of the text inserted at `offset` into the sentence after the edit, in bytes.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the word boundaries of the sentence after the edit, or NULL if parsing failed. `prev` is left
+ * untouched. The result must be freed with `budouxc_boundaries_destroy`.
+ *
+ * @see budouxc_boundaries_destroy
+ */
+struct budouxc_boundaries *BUDOUXC_DECLSPEC budouxc_update_boundaries_utf8(
+    struct budouxc *const model,
+    struct budouxc_boundaries const *const prev,
+    char const *const sentence,
+    size_t const sentence_len,
+    size_t const offset,
+    size_t const removed_len,
+    size_t const inserted_len,
+    char *error128);
+
+/**
+ * @brief Push-style parser for text that arrives in chunks.
+ *
+ * A stream parses text of any length in constant memory. Boundaries are returned as soon as the characters after
+ * them have arrived, as offsets from the start of the stream, and are the same as parsing the whole text at once.
+ * All chunks of a stream must use the same encoding. A stream must not be used from multiple threads at the same time,
+ * but multiple streams can share a model.
+ */
+struct budouxc_stream;
+
+/**
+ * @brief Creates a stream for the given model.
+ *
+ * @param model Pointer to the budoux model to be used for parsing. It must outlive the stream.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the stream, or NULL if initialization failed.
+ *
+ * @see budouxc_stream_destroy
+ */
+struct budouxc_stream *BUDOUXC_DECLSPEC budouxc_stream_init(struct budouxc *const model, char *error128);
+
+/**
+ * @brief Destroys a stream and frees all associated memory.
+ *
+ * @param stream Pointer to the stream to be destroyed.
+ */
+void BUDOUXC_DECLSPEC budouxc_stream_destroy(struct budouxc_stream *const stream);
+
+/**
+ * @brief Adds the next chunk of a stream and returns the word boundaries decided by it.
+ *
+ * @param stream Pointer to the stream.
+ * @param chunk Pointer to the chunk, as an array of UTF-32 code points.
+ * @param chunk_len Length of the chunk in code points.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the word boundaries decided by this chunk, as code point offsets from the start of the stream, or
+ * NULL if parsing failed, in which case the stream starts over. It is owned by the stream and stays valid until the
+ * next call with the same stream or until the stream is destroyed.
+ */
+struct budouxc_boundaries const *BUDOUXC_DECLSPEC budouxc_stream_feed_utf32(struct budouxc_stream *const stream,
+                                                                            char32_t const *const chunk,
+                                                                            size_t const chunk_len,
+                                                                            char *error128);
+
+/**
+ * @brief Adds the next chunk of a stream and returns the word boundaries decided by it.
+ *
+ * @param stream Pointer to the stream.
+ * @param chunk Pointer to the chunk, as an array of UTF-16 code points.
+ * @param chunk_len Length of the chunk in code points.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the word boundaries decided by this chunk, as code point offsets from the start of the stream, or
+ * NULL if parsing failed, in which case the stream starts over. It is owned by the stream and stays valid until the
+ * next call with the same stream or until the stream is destroyed.
+ */
+struct budouxc_boundaries const *BUDOUXC_DECLSPEC budouxc_stream_feed_utf16(struct budouxc_stream *const stream,
+                                                                            char16_t const *const chunk,
+                                                                            size_t const chunk_len,
+                                                                            char *error128);
+
+/**
+ * @brief Adds the next chunk of a stream and returns the word boundaries decided by it.
+ * A character split between two chunks is kept until the rest of it arrives.
+ *
+ * @param stream Pointer to the stream.
+ * @param chunk Pointer to the chunk, as UTF-8 bytes.
+ * @param chunk_len Length of the chunk in bytes.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the word boundaries decided by this chunk, as byte offsets from the start of the stream, or
+ * NULL if parsing failed, in which case the stream starts over. It is owned by the stream and stays valid until the
+ * next call with the same stream or until the stream is destroyed.
+ */
+struct budouxc_boundaries const *BUDOUXC_DECLSPEC budouxc_stream_feed_utf8(struct budouxc_stream *const stream,
+                                                                           char const *const chunk,
+                                                                           size_t const chunk_len,
+                                                                           char *error128);
+
+/**
+ * @brief Ends a stream and returns the remaining word boundaries.
+ *
+ * The stream then starts over, so it can be used for the next text.
+ *
+ * @param stream Pointer to the stream.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the word boundaries not returned yet, or NULL if the stream ended in the middle of a character.
+ * It is owned by the stream and stays valid until the next call with the same stream or until the stream is
+ * destroyed.
+ */
+struct budouxc_boundaries const *BUDOUXC_DECLSPEC budouxc_stream_finish(struct budouxc_stream *const stream,
+                                                                        char *error128);
+
+/**
+ * @brief Word boundaries of a batch of sentences in CSR layout.
+ *
+ * The boundaries of sentence i are indices[offsets[i]] to indices[offsets[i + 1] - 1].
+ *
+ * indices: the indices of the word boundaries of all sentences
+ * offsets: n + 1 offsets into indices
+ * n: the number of sentences
+ */
+struct budouxc_batch {
+  size_t *indices;
+  size_t *offsets;
+  size_t n;
+};
+
+/**
+ * @brief Parses a batch of sentences and returns the word boundaries of all of them in a single allocation.
+ *
+ * @param model Pointer to the budoux model to be used for parsing.
+ * @param sentences Array of pointers to the sentences to be parsed, as arrays of UTF-32 code points.
+ * @param sentence_lens Array of the lengths of the sentences in code points.
+ * @param n Number of sentences.
+ * @param threads Number of threads to use, including the calling thread. 0 or 1 parses on the calling thread only.
+ * Idle threads steal sentences from busy ones, so sentences of very different lengths are spread evenly. With more than
+ * one thread, the allocators are called from all of them.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the boundaries of all sentences, or NULL if parsing any sentence failed. It is owned by the caller
+ * and must be freed with `budouxc_batch_destroy`.
+ *
+ * @see budouxc_batch_destroy
+ */
+struct budouxc_batch *BUDOUXC_DECLSPEC budouxc_parse_batch_utf32(struct budouxc *const model,
+                                                                 char32_t const *const *const sentences,
+                                                                 size_t const *const sentence_lens,
+                                                                 size_t const n,
+                                                                 size_t const threads,
+                                                                 char *error128);
+
+/**
+ * @brief Parses a batch of sentences and returns the word boundaries of all of them in a single allocation.
+ *
+ * @param model Pointer to the budoux model to be used for parsing.
+ * @param sentences Array of pointers to the sentences to be parsed, as arrays of UTF-16 code points.
+ * @param sentence_lens Array of the lengths of the sentences in code points.
+ * @param n Number of sentences.
+ * @param threads Number of threads to use, including the calling thread. 0 or 1 parses on the calling thread only.
+ * Idle threads steal sentences from busy ones, so sentences of very different lengths are spread evenly. With more than
+ * one thread, the allocators are called from all of them.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the boundaries of all sentences, or NULL if parsing any sentence failed. It is owned by the caller
+ * and must be freed with `budouxc_batch_destroy`.
+ *
+ * @see budouxc_batch_destroy
+ */
+struct budouxc_batch *BUDOUXC_DECLSPEC budouxc_parse_batch_utf16(struct budouxc *const model,
+                                                                 char16_t const *const *const sentences,
+                                                                 size_t const *const sentence_lens,
+                                                                 size_t const n,
+                                                                 size_t const threads,
+                                                                 char *error128);
+
+/**
+ * @brief Parses a batch of sentences and returns the word boundaries of all of them in a single allocation.
+ *
+ * @param model Pointer to the budoux model to be used for parsing.
+ * @param sentences Array of pointers to the sentences to be parsed, as UTF-8 strings.
+ * @param sentence_lens Array of the lengths of the sentences in bytes.
+ * @param n Number of sentences.
+ * @param threads Number of threads to use, including the calling thread. 0 or 1 parses on the calling thread only.
+ * Idle threads steal sentences from busy ones, so sentences of very different lengths are spread evenly. With more than
+ * one thread, the allocators are called from all of them.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Pointer to the byte indices of the boundaries of all sentences, or NULL if parsing any sentence failed. It is
+ * owned by the caller and must be freed with `budouxc_batch_destroy`.
+ *
+ * @see budouxc_batch_destroy
+ */
+struct budouxc_batch *BUDOUXC_DECLSPEC budouxc_parse_batch_utf8(struct budouxc *const model,
+                                                                char const *const *const sentences,
+                                                                size_t const *const sentence_lens,
+                                                                size_t const n,
+                                                                size_t const threads,
+                                                                char *error128);
+
+/**
+ * @brief Frees the word boundaries returned by `budouxc_parse_batch_xxx`.
+ *
+ * @param model Pointer to the budoux model that was used for parsing.
+ * @param batch Pointer to the word boundaries to be freed.
+ *
+ * @see budouxc_parse_batch_utf8
+ * @see budouxc_parse_batch_utf16
+ * @see budouxc_parse_batch_utf32
+ */
+void BUDOUXC_DECLSPEC budouxc_batch_destroy(struct budouxc *const model, struct budouxc_batch *const batch);
+
 /**
  * @brief Parses a sentence and returns the word boundaries.
  *
@@ -190,3 +1020,329 @@ bool BUDOUXC_DECLSPEC budouxc_parse_boundaries_callback(struct budouxc *const mo
                                                         char32_t (*get_char)(void *userdata),
                                                         bool (*add_boundary)(size_t const boundary, void *userdata),
                                                         void *userdata);
+
+/**
+ * @brief Parses a sentence read in blocks and returns the word boundaries in batches.
+ *
+ * Unlike `budouxc_parse_boundaries_callback`, callbacks are called once per block rather than once per character, and
+ * U+0000 is an ordinary character. The boundaries are the same as `budouxc_parse_boundaries_utf32` for the
+ * concatenated blocks.
+ *
+ * @param model Pointer to the budoux model to be used for parsing.
+ * @param get_chars Callback function that returns the next block of the input sentence and stores its length in
+ * `len`. The block is owned by the caller and only needs to stay valid until the next call. A length of 0 ends the
+ * sentence.
+ * @param add_boundaries Callback function that adds `n` boundaries at the specified positions in the sentence.
+ * @param userdata Pointer to user-defined data that will be passed to the get_chars/add_boundaries callback.
+ * @return Returns true if the parsing was successful. If add_boundaries returns false, it is considered an abort and
+ * the function returns false. There are no other failure conditions.
+ */
+bool BUDOUXC_DECLSPEC budouxc_parse_boundaries_callback_block(
+    struct budouxc *const model,
+    char32_t const *(*get_chars)(size_t *const len, void *userdata),
+    bool (*add_boundaries)(size_t const *const boundaries, size_t const n, void *userdata),
+    void *userdata);
+
+/**
+ * @brief Parses a sentence and writes it with a separator inserted at every word boundary into a caller-provided
+ * buffer.
+ *
+ * @param model Pointer to the budoux model to be used for parsing.
+ * @param sentence Pointer to the sentence to be parsed, as an array of UTF-32 code points.
+ * @param sentence_len Length of the sentence in code points.
+ * @param separator Pointer to the separator, in the same encoding as the sentence.
+ * @param separator_len Length of the separator in code points.
+ * @param out Pointer to the buffer to store the separated sentence in, or NULL to only compute the required length.
+ * The output is not null-terminated.
+ * @param out_len Length of the buffer in code points. If it is too short, only the beginning of the output is written.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Length of the whole separated sentence in code points, which may be greater than `out_len`, or SIZE_MAX if
+ * parsing failed.
+ */
+size_t BUDOUXC_DECLSPEC budouxc_separate_utf32(struct budouxc *const model,
+                                               char32_t const *const sentence,
+                                               size_t const sentence_len,
+                                               char32_t const *const separator,
+                                               size_t const separator_len,
+                                               char32_t *const out,
+                                               size_t const out_len,
+                                               char *error128);
+
+/**
+ * @brief Parses a sentence and passes it with a separator inserted at every word boundary to a callback.
+ *
+ * @param model Pointer to the budoux model to be used for parsing.
+ * @param sentence Pointer to the sentence to be parsed, as an array of UTF-32 code points.
+ * @param sentence_len Length of the sentence in code points.
+ * @param separator Pointer to the separator, in the same encoding as the sentence.
+ * @param separator_len Length of the separator in code points.
+ * @param write Callback function that receives the next `len` code points of the separated sentence. Returning false
+ * aborts parsing.
+ * @param userdata Pointer to user-defined data that will be passed to the write callback.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Returns true if successful, or false if parsing failed or was aborted.
+ */
+bool BUDOUXC_DECLSPEC budouxc_separate_utf32_callback(struct budouxc *const model,
+                                                      char32_t const *const sentence,
+                                                      size_t const sentence_len,
+                                                      char32_t const *const separator,
+                                                      size_t const separator_len,
+                                                      bool (*write)(char32_t const *data, size_t len, void *userdata),
+                                                      void *userdata,
+                                                      char *error128);
+
+/**
+ * @brief Parses a sentence and writes it with a separator inserted at every word boundary into a caller-provided
+ * buffer.
+ *
+ * @param model Pointer to the budoux model to be used for parsing.
+ * @param sentence Pointer to the sentence to be parsed, as an array of UTF-16 code points.
+ * @param sentence_len Length of the sentence in code points.
+ * @param separator Pointer to the separator, in the same encoding as the sentence.
+ * @param separator_len Length of the separator in code points.
+ * @param out Pointer to the buffer to store the separated sentence in, or NULL to only compute the required length.
+ * The output is not null-terminated.
+ * @param out_len Length of the buffer in code points. If it is too short, only the beginning of the output is written.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Length of the whole separated sentence in code points, which may be greater than `out_len`, or SIZE_MAX if
+ * parsing failed.
+ */
+size_t BUDOUXC_DECLSPEC budouxc_separate_utf16(struct budouxc *const model,
+                                               char16_t const *const sentence,
+                                               size_t const sentence_len,
+                                               char16_t const *const separator,
+                                               size_t const separator_len,
+                                               char16_t *const out,
+                                               size_t const out_len,
+                                               char *error128);
+
+/**
+ * @brief Parses a sentence and passes it with a separator inserted at every word boundary to a callback.
+ *
+ * @param model Pointer to the budoux model to be used for parsing.
+ * @param sentence Pointer to the sentence to be parsed, as an array of UTF-16 code points.
+ * @param sentence_len Length of the sentence in code points.
+ * @param separator Pointer to the separator, in the same encoding as the sentence.
+ * @param separator_len Length of the separator in code points.
+ * @param write Callback function that receives the next `len` code points of the separated sentence. Returning false
+ * aborts parsing.
+ * @param userdata Pointer to user-defined data that will be passed to the write callback.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Returns true if successful, or false if parsing failed or was aborted.
+ */
+bool BUDOUXC_DECLSPEC budouxc_separate_utf16_callback(struct budouxc *const model,
+                                                      char16_t const *const sentence,
+                                                      size_t const sentence_len,
+                                                      char16_t const *const separator,
+                                                      size_t const separator_len,
+                                                      bool (*write)(char16_t const *data, size_t len, void *userdata),
+                                                      void *userdata,
+                                                      char *error128);
+
+/**
+ * @brief Parses a sentence and writes it with a separator inserted at every word boundary into a caller-provided
+ * buffer.
+ *
+ * @param model Pointer to the budoux model to be used for parsing.
+ * @param sentence Pointer to the sentence to be parsed, as a UTF-8 string.
+ * @param sentence_len Length of the sentence in bytes.
+ * @param separator Pointer to the separator, in the same encoding as the sentence.
+ * @param separator_len Length of the separator in bytes.
+ * @param out Pointer to the buffer to store the separated sentence in, or NULL to only compute the required length.
+ * The output is not null-terminated.
+ * @param out_len Length of the buffer in bytes. If it is too short, only the beginning of the output is written.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Length of the whole separated sentence in bytes, which may be greater than `out_len`, or SIZE_MAX if
+ * parsing failed.
+ */
+size_t BUDOUXC_DECLSPEC budouxc_separate_utf8(struct budouxc *const model,
+                                              char const *const sentence,
+                                              size_t const sentence_len,
+                                              char const *const separator,
+                                              size_t const separator_len,
+                                              char *const out,
+                                              size_t const out_len,
+                                              char *error128);
+
+/**
+ * @brief Parses a sentence and passes it with a separator inserted at every word boundary to a callback.
+ *
+ * @param model Pointer to the budoux model to be used for parsing.
+ * @param sentence Pointer to the sentence to be parsed, as a UTF-8 string.
+ * @param sentence_len Length of the sentence in bytes.
+ * @param separator Pointer to the separator, in the same encoding as the sentence.
+ * @param separator_len Length of the separator in bytes.
+ * @param write Callback function that receives the next `len` bytes of the separated sentence. Returning false
+ * aborts parsing.
+ * @param userdata Pointer to user-defined data that will be passed to the write callback.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Returns true if successful, or false if parsing failed or was aborted.
+ */
+bool BUDOUXC_DECLSPEC budouxc_separate_utf8_callback(struct budouxc *const model,
+                                                     char const *const sentence,
+                                                     size_t const sentence_len,
+                                                     char const *const separator,
+                                                     size_t const separator_len,
+                                                     bool (*write)(char const *data, size_t len, void *userdata),
+                                                     void *userdata,
+                                                     char *error128);
+
+/**
+ * @brief Growable output buffer.
+ *
+ * Output is appended at `len`, and the buffer is grown with the allocators of the model as needed. A zero-initialized
+ * buffer is empty, and setting `len` to 0 reuses the allocated memory for the next output.
+ *
+ * ptr: the output, which is not null-terminated
+ * len: the length of the output in bytes
+ * cap: the allocated size of ptr in bytes
+ */
+struct budouxc_buffer {
+  char *ptr;
+  size_t len;
+  size_t cap;
+};
+
+/**
+ * @brief Frees the memory of a buffer and makes it empty.
+ *
+ * @param model Pointer to the budoux model whose allocators grew the buffer.
+ * @param buffer Pointer to the buffer.
+ */
+void BUDOUXC_DECLSPEC budouxc_buffer_destroy(struct budouxc *const model, struct budouxc_buffer *const buffer);
+
+/**
+ * @brief Inserts a separator at the word boundaries of the text in an HTML document.
+ *
+ * The document is processed in a single pass. Tags, attributes, comments and the content of script, style, textarea,
+ * title and template elements are copied as is. The text of inline elements is parsed as part of the surrounding
+ * sentence, and block-level elements such as `p`, `div`, `li` and `br` end it. Character references are parsed as the
+ * character they refer to and are never split.
+ *
+ * @param model Pointer to the budoux model to be used for parsing.
+ * @param html Pointer to the HTML document as a UTF-8 string.
+ * @param html_len Length of the HTML document in bytes.
+ * @param separator Pointer to the separator to be inserted, such as `<wbr>` or U+200B in UTF-8.
+ * @param separator_len Length of the separator in bytes.
+ * @param out Pointer to the buffer to which the annotated document is appended.
+ * @param error128 Pointer to a buffer of at least 128 bytes to store error messages in case of failure.
+ * @return Returns true if successful. On failure, `out` may contain part of the output.
+ *
+ * @see budouxc_buffer_destroy
+ */
+bool BUDOUXC_DECLSPEC budouxc_annotate_html(struct budouxc *const model,
+                                            char const *const html,
+                                            size_t const html_len,
+                                            char const *const separator,
+                                            size_t const separator_len,
+                                            struct budouxc_buffer *const out,
+                                            char *error128);
+
+/**
+ * @brief Phases of model initialization timed by instrumentation.
+ *
+ * `budouxc_init` reads the JSON once, building the unigram, bigram and trigram maps from their weight objects and
+ * summing the weights as it goes, and then freezes the maps into lookup tables. The JSON parse is the time spent
+ * outside of the weight objects, and `budouxc_init_phase_sum` is not recorded since summing is part of building the
+ * maps.
+ * `budouxc_init_binary` and `budouxc_init_mmap`, and so the embedded models, only load a binary model.
+ */
+enum budouxc_init_phase {
+  budouxc_init_phase_json_parse,
+  budouxc_init_phase_build_unigram,
+  budouxc_init_phase_build_bigram,
+  budouxc_init_phase_build_trigram,
+  budouxc_init_phase_sum,
+  budouxc_init_phase_freeze,
+  budouxc_init_phase_load_binary,
+  budouxc_init_phases,
+};
+
+/**
+ * @brief Parse entry points timed by instrumentation.
+ *
+ * The `_into` and `budouxc_parser_parse_xxx` variants are counted with `budouxc_parse_boundaries_xxx`. A parallel call
+ * too short to be split is counted with its single-threaded counterpart.
+ */
+enum budouxc_entry_point {
+  budouxc_entry_point_utf8,
+  budouxc_entry_point_utf16,
+  budouxc_entry_point_utf32,
+  budouxc_entry_point_callback,
+  budouxc_entry_point_callback_block,
+  budouxc_entry_point_parallel_utf8,
+  budouxc_entry_point_parallel_utf16,
+  budouxc_entry_point_parallel_utf32,
+  budouxc_entry_points,
+};
+
+/**
+ * @brief Number of buckets in `budouxc_histogram`.
+ */
+#define BUDOUXC_HISTOGRAM_BUCKETS 48
+
+/**
+ * @brief Histogram with power of two buckets.
+ *
+ * `buckets[0]` counts the value 0 and `buckets[i]` counts the values from 2^(i-1) to 2^i - 1. The last bucket also
+ * counts larger values.
+ */
+struct budouxc_histogram {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t buckets[BUDOUXC_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * @brief Instrumentation results collected since the start of the process or the last reset.
+ *
+ * `init_phases` and `latency` are in nanoseconds. `cost` is the latency of each call divided by the number of code
+ * points it parsed, in picoseconds. A UTF-16 surrogate pair counts as two code points, as it is parsed as two
+ * characters.
+ */
+struct budouxc_instrument_snapshot {
+  struct budouxc_histogram init_phases[budouxc_init_phases];
+  struct budouxc_histogram latency[budouxc_entry_points];
+  struct budouxc_histogram cost[budouxc_entry_points];
+};
+
+/**
+ * @brief Callbacks receiving every instrumentation measurement as it is made.
+ *
+ * The callbacks are called on the thread that made the measurement, so they must be thread-safe when the library is
+ * used from several threads. Either of them can be NULL.
+ */
+struct budouxc_instrument_sink {
+  void (*init_phase)(enum budouxc_init_phase const phase, uint64_t const nanoseconds, void *userdata);
+  void (*parse)(enum budouxc_entry_point const entry_point,
+                uint64_t const nanoseconds,
+                size_t const code_points,
+                void *userdata);
+  void *userdata;
+};
+
+/**
+ * @brief Registers the callbacks receiving instrumentation measurements.
+ *
+ * Instrumentation is only available when budoux-c is built with `BUDOUXC_INSTRUMENT`. Only successful calls are
+ * measured, and the time spent in callbacks passed to the entry points is included.
+ * The sink must not be changed while other threads are using the library.
+ *
+ * @param sink Pointer to the callbacks, which are copied. If NULL, the current sink is removed.
+ * @return true if successful, false if budoux-c was built without instrumentation.
+ *
+ * @see budouxc_instrument_snapshot
+ */
+bool BUDOUXC_DECLSPEC budouxc_instrument_set_sink(struct budouxc_instrument_sink const *const sink);
+
+/**
+ * @brief Copies the instrumentation histograms of the whole process.
+ *
+ * Other threads may keep recording while the histograms are copied, so a snapshot can be slightly inconsistent with
+ * itself, but no measurement is lost or counted twice across resets.
+ *
+ * @param snapshot Pointer to the struct to fill.
+ * @param reset If true, the histograms are cleared as they are copied.
+ * @return true if successful, false if snapshot is NULL or budoux-c was built without instrumentation.
+ */
+bool BUDOUXC_DECLSPEC budouxc_instrument_snapshot(struct budouxc_instrument_snapshot *const snapshot, bool const reset);
@@ -0,0 +1,127 @@
+#include "budoux-c.h"
+#include "tools.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool host_is_big_endian(void) {
+  uint16_t const v = 1;
+  uint8_t b[sizeof(v)];
+  memcpy(b, &v, sizeof(v));
+  return b[0] == 0;
+}
+
+// Each word is printed so that the target, with the given byte order, lays it out as the bytes of the binary model.
+static bool write_c_source(
+    FILE *const out, char const *const symbol, uint8_t const *const binary, size_t const size, bool const big_endian) {
+  fprintf(out, "// Generated by budouxc_compile. Do not edit.\n\n");
+  fprintf(out, "#include <stddef.h>\n#include <stdint.h>\n\n");
+  fprintf(out, "extern uint64_t const %s[];\nextern size_t const %s_len;\n\n", symbol, symbol);
+  fprintf(out, "uint64_t const %s[] = {\n", symbol);
+  for (size_t i = 0, n = (size + sizeof(uint64_t) - 1) / sizeof(uint64_t); i < n; ++i) {
+    uint64_t word = 0;
+    for (size_t j = 0; j < sizeof(uint64_t); ++j) {
+      uint64_t const b = binary[i * sizeof(uint64_t) + j];
+      word |= big_endian ? b << (56 - j * 8) : b << (j * 8);
+    }
+    fprintf(out, "%s0x%016llxULL,%s", i % 4 ? " " : "    ", (unsigned long long)word, i % 4 == 3 ? "\n" : "");
+  }
+  fprintf(out, "\n};\n\nsize_t const %s_len = %zu;\n", symbol, size);
+  return !ferror(out);
+}
+
+int main(int argc, char *argv[]) {
+  char const *symbol = NULL;
+  bool compact = false;
+  bool big_endian = host_is_big_endian();
+  for (;;) {
+    if (argc >= 3 && strcmp(argv[1], "-c") == 0) {
+      symbol = argv[2];
+      argv += 2;
+      argc -= 2;
+    } else if (argc >= 3 && strcmp(argv[1], "-e") == 0 &&
+               (strcmp(argv[2], "big") == 0 || strcmp(argv[2], "little") == 0)) {
+      big_endian = strcmp(argv[2], "big") == 0;
+      argv += 2;
+      argc -= 2;
+    } else if (argc >= 2 && strcmp(argv[1], "-q") == 0) {
+      compact = true;
+      argv += 1;
+      argc -= 1;
+    } else {
+      break;
+    }
+  }
+  if (argc != 3) {
+    fprintf(stderr, "usage: budouxc_compile [-c <symbol>] [-e big|little] [-q] <model.json> <output>\n");
+    fprintf(stderr, "  -c <symbol>    write a C source that defines the binary model as <symbol>\n");
+    fprintf(stderr, "  -e big|little  write the model for a machine of this byte order instead of this one\n");
+    fprintf(stderr, "  -q             write a compact model with 16-bit weights\n");
+    return 1;
+  }
+
+  int ret = 1;
+  char error[128] = {0};
+  char *json = NULL;
+  struct budouxc *model = NULL;
+  uint8_t *binary = NULL;
+  FILE *out = NULL;
+
+  size_t json_len = 0;
+  json = read_file(argv[1], &json_len);
+  if (!json) {
+    fprintf(stderr, "failed to read %s\n", argv[1]);
+    goto cleanup;
+  }
+  model = budouxc_init(NULL, json, json_len, error);
+  if (!model) {
+    fprintf(stderr, "budouxc_init failed: %s\n", error);
+    goto cleanup;
+  }
+  if (compact) {
+    struct budouxc *const source = model;
+    model = budouxc_init_compact(NULL, source, error);
+    budouxc_destroy(source);
+    if (!model) {
+      fprintf(stderr, "budouxc_init_compact failed: %s\n", error);
+      goto cleanup;
+    }
+  }
+
+  size_t const size = budouxc_write_binary(model, NULL, 0);
+  // The binary model is made of 8-byte words, so it can be emitted as an aligned uint64_t array.
+  binary = calloc((size + sizeof(uint64_t) - 1) / sizeof(uint64_t), sizeof(uint64_t));
+  if (!binary) {
+    fprintf(stderr, "out of memory\n");
+    goto cleanup;
+  }
+  if (big_endian == host_is_big_endian()) {
+    budouxc_write_binary(model, binary, size);
+  } else {
+    budouxc_write_binary_swapped(model, binary, size);
+  }
+
+  out = open_file(argv[2], symbol ? "w" : "wb", stdout);
+  if (!out) {
+    fprintf(stderr, "failed to open %s\n", argv[2]);
+    goto cleanup;
+  }
+  if (symbol ? !write_c_source(out, symbol, binary, size, big_endian) : fwrite(binary, 1, size, out) != size) {
+    fprintf(stderr, "failed to write %s\n", argv[2]);
+    goto cleanup;
+  }
+  ret = 0;
+
+cleanup:
+  if (out && out != stdout) {
+    if (fclose(out) != 0) {
+      ret = 1;
+    }
+  }
+  free(binary);
+  budouxc_destroy(model);
+  free(json);
+  return ret;
+}
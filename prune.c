@@ -0,0 +1,247 @@
+#include "budoux-c.h"
+#include "tools.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct delta {
+  size_t sentences;
+  size_t changed;
+  size_t boundaries;
+  size_t missing;
+  size_t extra;
+};
+
+// Counts the boundaries of a that are not in b. Both lists are sorted.
+static size_t count_missing(struct budouxc_boundaries const *const a, struct budouxc_boundaries const *const b) {
+  size_t missing = 0;
+  for (size_t i = 0, j = 0; i < a->n; ++i) {
+    while (j < b->n && b->indices[j] < a->indices[i]) {
+      ++j;
+    }
+    if (j == b->n || b->indices[j] != a->indices[i]) {
+      ++missing;
+    }
+  }
+  return missing;
+}
+
+// Parses every non-empty line of the corpus with both models and counts the boundaries that differ.
+static bool compare(struct budouxc *const reference,
+                    struct budouxc *const model,
+                    char const *const corpus,
+                    size_t const corpus_len,
+                    struct delta *const d,
+                    char *const error) {
+  *d = (struct delta){0};
+  for (size_t pos = 0; pos < corpus_len;) {
+    char const *const nl = memchr(corpus + pos, '\n', corpus_len - pos);
+    size_t const end = nl ? (size_t)(nl - corpus) : corpus_len;
+    size_t const len = end > pos && corpus[end - 1] == '\r' ? end - pos - 1 : end - pos;
+    char const *const line = corpus + pos;
+    pos = end + 1;
+    if (!len) {
+      continue;
+    }
+    struct budouxc_boundaries *const want = budouxc_parse_boundaries_utf8(reference, line, len, error);
+    if (!want) {
+      return false;
+    }
+    struct budouxc_boundaries *const got = budouxc_parse_boundaries_utf8(model, line, len, error);
+    if (!got) {
+      budouxc_boundaries_destroy(reference, want);
+      return false;
+    }
+    size_t const missing = count_missing(want, got);
+    size_t const extra = count_missing(got, want);
+    ++d->sentences;
+    if (missing || extra) {
+      ++d->changed;
+    }
+    d->boundaries += want->n;
+    d->missing += missing;
+    d->extra += extra;
+    budouxc_boundaries_destroy(model, got);
+    budouxc_boundaries_destroy(reference, want);
+  }
+  return true;
+}
+
+static struct budouxc *
+build(struct budouxc *const reference, int32_t const threshold, bool const compact, char *const error) {
+  struct budouxc *const pruned = budouxc_init_pruned(NULL, reference, threshold, error);
+  if (!pruned || !compact) {
+    return pruned;
+  }
+  struct budouxc *const model = budouxc_init_compact(NULL, pruned, error);
+  budouxc_destroy(pruned);
+  return model;
+}
+
+// Finds the smallest threshold that fits the model in target bytes. The size never grows with the threshold.
+static bool find_threshold(struct budouxc *const reference,
+                           size_t const target,
+                           bool const compact,
+                           int32_t *const threshold,
+                           char *const error) {
+  int32_t lo = 0;
+  int32_t hi = INT32_MAX;
+  while (lo < hi) {
+    int32_t const mid = lo + (hi - lo) / 2;
+    struct budouxc *const model = build(reference, mid, compact, error);
+    if (!model) {
+      return false;
+    }
+    size_t const bytes = budouxc_model_bytes(model);
+    budouxc_destroy(model);
+    if (bytes <= target) {
+      hi = mid;
+    } else {
+      lo = mid + 1;
+    }
+  }
+  struct budouxc *const model = build(reference, lo, compact, error);
+  if (!model) {
+    return false;
+  }
+  size_t const bytes = budouxc_model_bytes(model);
+  budouxc_destroy(model);
+  if (bytes > target) {
+    sprintf(error, "The model cannot be smaller than %zu bytes", bytes);
+    return false;
+  }
+  *threshold = lo;
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  char const *threshold_arg = NULL;
+  char const *size_arg = NULL;
+  bool compact = false;
+  for (;;) {
+    if (argc >= 3 && strcmp(argv[1], "-t") == 0) {
+      threshold_arg = argv[2];
+      argv += 2;
+      argc -= 2;
+    } else if (argc >= 3 && strcmp(argv[1], "-s") == 0) {
+      size_arg = argv[2];
+      argv += 2;
+      argc -= 2;
+    } else if (argc >= 2 && strcmp(argv[1], "-q") == 0) {
+      compact = true;
+      argv += 1;
+      argc -= 1;
+    } else {
+      break;
+    }
+  }
+  if (argc != 4 || !threshold_arg == !size_arg) {
+    fprintf(stderr, "usage: budouxc_prune (-t <threshold> | -s <bytes>) [-q] <model.json> <corpus.txt> <output>\n");
+    fprintf(stderr, "  -t <threshold>  remove n-grams whose weights are all smaller than <threshold>\n");
+    fprintf(stderr, "  -s <bytes>      use the smallest threshold that fits the model in <bytes>\n");
+    fprintf(stderr, "  -q              write a compact model with 16-bit weights\n");
+    fprintf(stderr, "The corpus is UTF-8 text with one sentence per line. The output is a binary model.\n");
+    return 1;
+  }
+
+  int ret = 1;
+  char error[128] = {0};
+  char *json = NULL;
+  char *corpus = NULL;
+  struct budouxc *reference = NULL;
+  struct budouxc *model = NULL;
+  uint64_t *binary = NULL;
+  FILE *out = NULL;
+
+  size_t json_len = 0;
+  json = read_file(argv[1], &json_len);
+  if (!json) {
+    fprintf(stderr, "failed to read %s\n", argv[1]);
+    goto cleanup;
+  }
+  size_t corpus_len = 0;
+  corpus = read_file(argv[2], &corpus_len);
+  if (!corpus) {
+    fprintf(stderr, "failed to read %s\n", argv[2]);
+    goto cleanup;
+  }
+  reference = budouxc_init(NULL, json, json_len, error);
+  if (!reference) {
+    fprintf(stderr, "budouxc_init failed: %s\n", error);
+    goto cleanup;
+  }
+
+  int32_t threshold = 0;
+  if (threshold_arg) {
+    char *end = NULL;
+    long long const v = strtoll(threshold_arg, &end, 10);
+    if (*end != '\0' || v < 0 || v > INT32_MAX) {
+      fprintf(stderr, "invalid threshold: %s\n", threshold_arg);
+      goto cleanup;
+    }
+    threshold = (int32_t)v;
+  } else {
+    char *end = NULL;
+    unsigned long long const v = strtoull(size_arg, &end, 10);
+    if (*end != '\0' || (unsigned long long)(size_t)v != v) {
+      fprintf(stderr, "invalid size: %s\n", size_arg);
+      goto cleanup;
+    }
+    if (!find_threshold(reference, (size_t)v, compact, &threshold, error)) {
+      fprintf(stderr, "failed to find a threshold: %s\n", error);
+      goto cleanup;
+    }
+  }
+  model = build(reference, threshold, compact, error);
+  if (!model) {
+    fprintf(stderr, "failed to prune the model: %s\n", error);
+    goto cleanup;
+  }
+
+  struct delta d;
+  if (!compare(reference, model, corpus, corpus_len, &d, error)) {
+    fprintf(stderr, "failed to parse the corpus: %s\n", error);
+    goto cleanup;
+  }
+  size_t const got = d.boundaries - d.missing + d.extra;
+  size_t const common = d.boundaries - d.missing;
+  fprintf(stderr, "threshold: %ld\n", (long)threshold);
+  fprintf(stderr, "bytes: %zu -> %zu\n", budouxc_model_bytes(reference), budouxc_model_bytes(model));
+  fprintf(stderr, "sentences: %zu, changed: %zu\n", d.sentences, d.changed);
+  fprintf(stderr, "boundaries: %zu, missing: %zu, extra: %zu\n", d.boundaries, d.missing, d.extra);
+  fprintf(stderr, "f1: %.4f\n", d.boundaries + got ? 2.0 * (double)common / (double)(d.boundaries + got) : 1.0);
+
+  size_t const size = budouxc_write_binary(model, NULL, 0);
+  // The binary model is made of 8-byte words, so it is kept in an aligned buffer.
+  binary = calloc((size + sizeof(uint64_t) - 1) / sizeof(uint64_t), sizeof(uint64_t));
+  if (!binary) {
+    fprintf(stderr, "out of memory\n");
+    goto cleanup;
+  }
+  budouxc_write_binary(model, binary, size);
+  out = open_file(argv[3], "wb", stdout);
+  if (!out) {
+    fprintf(stderr, "failed to open %s\n", argv[3]);
+    goto cleanup;
+  }
+  if (fwrite(binary, 1, size, out) != size) {
+    fprintf(stderr, "failed to write %s\n", argv[3]);
+    goto cleanup;
+  }
+  ret = 0;
+
+cleanup:
+  if (out && out != stdout) {
+    if (fclose(out) != 0) {
+      ret = 1;
+    }
+  }
+  free(binary);
+  budouxc_destroy(model);
+  budouxc_destroy(reference);
+  free(corpus);
+  free(json);
+  return ret;
+}
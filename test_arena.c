@@ -0,0 +1,129 @@
+#include "budoux-c.h"
+#include "test_helpers.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char const sentence[] = "私はその人を常に先生と呼んでいた。";
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  char error[128] = {0};
+  bool ok = false;
+  struct counter counter = {0};
+  struct budouxc_allocators const allocators = {
+      .fn_realloc = counting_realloc,
+      .fn_free = counting_free,
+      .user_data = &counter,
+  };
+  struct budouxc *model = NULL;
+  struct budouxc *defaults = NULL;
+  struct budouxc_boundaries *want = NULL;
+  struct budouxc_batch *batch = NULL;
+  char32_t *text = NULL;
+  struct budouxc_boundaries *text_want = NULL;
+  struct budouxc_boundaries *text_got = NULL;
+
+  model = budouxc_init(&allocators, model_json, strlen(model_json), error);
+  if (!model) {
+    printf("budouxc_init failed: %s\n", error);
+    goto cleanup;
+  }
+  size_t const model_bytes = atomic_load(&counter.current);
+  want = budouxc_parse_boundaries_utf8(model, sentence, strlen(sentence), error);
+  if (!want || want->n == 0) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+
+  // Allocators without functions use the default ones.
+  struct budouxc_allocators const no_functions = {0};
+  defaults = budouxc_init(&no_functions, model_json, strlen(model_json), error);
+  if (!defaults) {
+    printf("budouxc_init failed with the default functions: %s\n", error);
+    goto cleanup;
+  }
+
+  // The work lists of the batch parser come from a scratch arena that is released with the batch.
+  char const *const sentences[] = {sentence, sentence, sentence};
+  size_t const sentence_lens[] = {strlen(sentence), strlen(sentence), strlen(sentence)};
+  batch = budouxc_parse_batch_utf8(model, sentences, sentence_lens, 3, 2, error);
+  if (!batch) {
+    printf("budouxc_parse_batch_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+  for (size_t i = 0; i < 3; ++i) {
+    struct budouxc_boundaries const b = {
+        .indices = batch->indices + batch->offsets[i],
+        .n = batch->offsets[i + 1] - batch->offsets[i],
+    };
+    if (!same_boundaries(want, &b)) {
+      printf("boundary mismatch in sentence #%zu of the batch\n", i);
+      goto cleanup;
+    }
+  }
+  budouxc_batch_destroy(model, batch);
+  batch = NULL;
+
+  // Long enough to be split into chunks. The chunk cuts are released before the call returns.
+  size_t const sentence32_len = 17;
+  size_t const text_len = sentence32_len * 16384;
+  text = malloc(text_len * sizeof(char32_t));
+  if (!text) {
+    printf("out of memory\n");
+    goto cleanup;
+  }
+  for (size_t i = 0; i < text_len; i += sentence32_len) {
+    memcpy(text + i, U"私はその人を常に先生と呼んでいた。", sentence32_len * sizeof(char32_t));
+  }
+  text_want = budouxc_parse_boundaries_utf32(model, text, text_len, error);
+  if (!text_want) {
+    printf("budouxc_parse_boundaries_utf32 failed: %s\n", error);
+    goto cleanup;
+  }
+  text_got = budouxc_parse_boundaries_parallel_utf32(model, text, text_len, 4, error);
+  if (!text_got) {
+    printf("budouxc_parse_boundaries_parallel_utf32 failed: %s\n", error);
+    goto cleanup;
+  }
+  if (!same_boundaries(text_want, text_got)) {
+    printf("boundary mismatch in parallel parsing\n");
+    goto cleanup;
+  }
+  budouxc_boundaries_destroy(model, text_got);
+  text_got = NULL;
+  budouxc_boundaries_destroy(model, text_want);
+  text_want = NULL;
+  budouxc_boundaries_destroy(model, want);
+  want = NULL;
+  if (atomic_load(&counter.current) != model_bytes) {
+    printf("scratch memory left after parsing: %zu bytes\n", atomic_load(&counter.current) - model_bytes);
+    goto cleanup;
+  }
+  ok = true;
+
+cleanup:
+  if (text_got) {
+    budouxc_boundaries_destroy(model, text_got);
+  }
+  if (text_want) {
+    budouxc_boundaries_destroy(model, text_want);
+  }
+  free(text);
+  budouxc_batch_destroy(model, batch);
+  if (want) {
+    budouxc_boundaries_destroy(model, want);
+  }
+  budouxc_destroy(defaults);
+  budouxc_destroy(model);
+  if (ok && atomic_load(&counter.current) != 0) {
+    printf("memory leaked: %zu bytes\n", atomic_load(&counter.current));
+    ok = false;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,95 @@
+#include "budoux-c.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static char const *const sentences[] = {
+    "私はその人を常に先生と呼んでいた。",
+    "だからここでもただ先生と書くだけで本名は打ち明けない。",
+    "あ",
+    "これは世間を憚かる遠慮というよりも、その方が私にとって自然だからである。",
+    "私はその人の記憶を呼び起すごとに、すぐ「先生」といいたくなる。",
+    "筆を執っても心持は同じ事である。",
+    "よそよそしい頭文字などはとても使う気にならない。",
+};
+
+#define SENTENCES (sizeof(sentences) / sizeof(sentences[0]))
+
+static bool check_batch(struct budouxc *const model, size_t const threads) {
+  char error[128] = {0};
+  bool ok = false;
+  size_t lens[SENTENCES];
+  for (size_t i = 0; i < SENTENCES; ++i) {
+    lens[i] = strlen(sentences[i]);
+  }
+  struct budouxc_batch *batch = budouxc_parse_batch_utf8(model, sentences, lens, SENTENCES, threads, error);
+  if (!batch) {
+    printf("budouxc_parse_batch_utf8 failed with %zu threads: %s\n", threads, error);
+    goto cleanup;
+  }
+  if (batch->n != SENTENCES || batch->offsets[0] != 0) {
+    printf("unexpected batch layout with %zu threads\n", threads);
+    goto cleanup;
+  }
+  for (size_t i = 0; i < SENTENCES; ++i) {
+    struct budouxc_boundaries *golden = budouxc_parse_boundaries_utf8(model, sentences[i], lens[i], error);
+    if (!golden) {
+      printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+      goto cleanup;
+    }
+    size_t const n = batch->offsets[i + 1] - batch->offsets[i];
+    size_t const *const indices = batch->indices + batch->offsets[i];
+    bool const same = golden->n == n && (n == 0 || memcmp(golden->indices, indices, n * sizeof(size_t)) == 0);
+    budouxc_boundaries_destroy(model, golden);
+    if (!same) {
+      printf("boundary mismatch in sentence #%zu with %zu threads\n", i, threads);
+      goto cleanup;
+    }
+  }
+  ok = true;
+
+cleanup:
+  if (batch) {
+    budouxc_batch_destroy(model, batch);
+  }
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  char error[128] = {0};
+  bool ok = false;
+  struct budouxc *model = NULL;
+
+  model = budouxc_init_embedded_ja(NULL, error);
+  if (!model) {
+    printf("budouxc_init_embedded_ja failed: %s\n", error);
+    goto cleanup;
+  }
+  if (!check_batch(model, 1) || !check_batch(model, 4) || !check_batch(model, 64)) {
+    goto cleanup;
+  }
+
+  // A broken sentence fails the whole batch and is named in the error.
+  char const *const broken[] = {sentences[0], "\xff", sentences[1]};
+  size_t const broken_lens[] = {strlen(sentences[0]), 1, strlen(sentences[1])};
+  struct budouxc_batch *const batch = budouxc_parse_batch_utf8(model, broken, broken_lens, 3, 2, error);
+  if (batch) {
+    printf("budouxc_parse_batch_utf8 accepted broken input\n");
+    budouxc_batch_destroy(model, batch);
+    goto cleanup;
+  }
+  if (!strstr(error, "#1")) {
+    printf("unexpected error: %s\n", error);
+    goto cleanup;
+  }
+  ok = true;
+
+cleanup:
+  budouxc_destroy(model);
+  return ok ? 0 : 1;
+}
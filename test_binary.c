@@ -0,0 +1,138 @@
+#include "budoux-c.h"
+#include "test_helpers.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char const sentence[] = "私はその人を常に先生と呼んでいた。\n"
+                               "だからここでもただ先生と書くだけで本名は打ち明けない。\n"
+                               "これは世間を憚かる遠慮というよりも、その方が私にとって自然だからである。";
+
+static bool expect_failure(void const *const data, size_t const len, char const *const what) {
+  char error[128] = {0};
+  struct budouxc *const model = budouxc_init_binary(NULL, data, len, error);
+  if (model) {
+    printf("budouxc_init_binary accepted %s\n", what);
+    budouxc_destroy(model);
+    return false;
+  }
+  printf("%s: %s\n", what, error);
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  char error[128] = {0};
+  bool ok = false;
+  struct budouxc *model = NULL;
+  struct budouxc *loaded = NULL;
+  struct budouxc_boundaries *golden = NULL;
+  struct budouxc_boundaries *boundaries = NULL;
+  uint64_t *binary = NULL;
+
+  model = budouxc_init_embedded_ja(NULL, error);
+  if (!model) {
+    printf("budouxc_init_embedded_ja failed: %s\n", error);
+    goto cleanup;
+  }
+  golden = budouxc_parse_boundaries_utf8(model, sentence, strlen(sentence), error);
+  if (!golden) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+
+  size_t const size = budouxc_write_binary(model, NULL, 0);
+  // Allocate one extra word so that a misaligned copy can be tested.
+  binary = malloc(size + sizeof(uint64_t));
+  if (!binary) {
+    printf("out of memory\n");
+    goto cleanup;
+  }
+  if (budouxc_write_binary(model, binary, size) != size) {
+    printf("budouxc_write_binary returned inconsistent size\n");
+    goto cleanup;
+  }
+
+  loaded = budouxc_init_binary(NULL, binary, size, error);
+  if (!loaded) {
+    printf("budouxc_init_binary failed: %s\n", error);
+    goto cleanup;
+  }
+  boundaries = budouxc_parse_boundaries_utf8(loaded, sentence, strlen(sentence), error);
+  if (!boundaries) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+  if (!same_boundaries(golden, boundaries)) {
+    goto cleanup;
+  }
+  budouxc_boundaries_destroy(loaded, boundaries);
+  boundaries = NULL;
+  budouxc_destroy(loaded);
+  loaded = NULL;
+
+  // A model written for the other byte order has the same size, and this machine refuses it.
+  void *const swapped = malloc(size);
+  if (!swapped) {
+    printf("out of memory\n");
+    goto cleanup;
+  }
+  bool const swapped_rejected = budouxc_write_binary_swapped(model, swapped, size) == size &&
+                                memcmp(swapped, binary, size) != 0 &&
+                                expect_failure(swapped, size, "model in the other byte order");
+  free(swapped);
+  if (!swapped_rejected) {
+    printf("budouxc_write_binary_swapped failed\n");
+    goto cleanup;
+  }
+
+  if (!expect_failure(binary, size - 1, "truncated model")) {
+    goto cleanup;
+  }
+  memmove((char *)binary + 1, binary, size);
+  if (!expect_failure((char *)binary + 1, size, "misaligned model")) {
+    goto cleanup;
+  }
+  memmove(binary, (char *)binary + 1, size);
+  // The unigram table is described 48 bytes into the header by its offset and its size as a power of two. With no
+  // empty slot left in it, looking up a missing key would never end.
+  uint64_t table_offset = 0;
+  uint32_t table_bits = 0;
+  memcpy(&table_offset, (char *)binary + 48, sizeof(table_offset));
+  memcpy(&table_bits, (char *)binary + 56, sizeof(table_bits));
+  uint64_t *const keys = malloc(sizeof(uint64_t) << table_bits);
+  if (!keys) {
+    printf("out of memory\n");
+    goto cleanup;
+  }
+  memcpy(keys, (char *)binary + table_offset, sizeof(uint64_t) << table_bits);
+  memset((char *)binary + table_offset, 0, sizeof(uint64_t) << table_bits);
+  bool const full_rejected = expect_failure(binary, size, "full table");
+  memcpy((char *)binary + table_offset, keys, sizeof(uint64_t) << table_bits);
+  free(keys);
+  if (!full_rejected) {
+    goto cleanup;
+  }
+  ((char *)binary)[0] = 'X';
+  if (!expect_failure(binary, size, "broken magic")) {
+    goto cleanup;
+  }
+  ok = true;
+
+cleanup:
+  if (boundaries) {
+    budouxc_boundaries_destroy(loaded, boundaries);
+  }
+  budouxc_destroy(loaded);
+  if (golden) {
+    budouxc_boundaries_destroy(model, golden);
+  }
+  budouxc_destroy(model);
+  free(binary);
+  return ok ? 0 : 1;
+}
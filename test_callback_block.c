@@ -0,0 +1,103 @@
+#include "budoux-c.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static char32_t const sentence[] = U"私はその人を常に先生と呼んでいた。\n"
+                                   U"だからここでもただ先生と書くだけで本名は打ち明けない。\n"
+                                   U"これは世間を憚かる遠慮というよりも、その方が私にとって自然だからである。";
+
+#define SENTENCE_LEN (sizeof(sentence) / sizeof(sentence[0]) - 1)
+
+struct context {
+  size_t block_size;
+  size_t nch;
+  size_t nb;
+  size_t flushes;
+  size_t max_flushes;
+  struct budouxc_boundaries *golden;
+  bool correct;
+};
+
+static char32_t const *get_chars(size_t *const len, void *userdata) {
+  struct context *const c = userdata;
+  size_t const rest = SENTENCE_LEN - c->nch;
+  *len = rest < c->block_size ? rest : c->block_size;
+  char32_t const *const block = sentence + c->nch;
+  c->nch += *len;
+  return block;
+}
+
+static bool add_boundaries(size_t const *const boundaries, size_t const n, void *userdata) {
+  struct context *const c = userdata;
+  for (size_t i = 0; i < n; ++i) {
+    size_t const b = c->nb++;
+    if (b >= c->golden->n || boundaries[i] != c->golden->indices[b]) {
+      c->correct = false;
+      printf("boundary mismatch at %zu with %zu character blocks\n", b, c->block_size);
+      return false;
+    }
+  }
+  return ++c->flushes < c->max_flushes;
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  char error[128] = {0};
+  bool ok = false;
+  struct budouxc *model = NULL;
+  struct budouxc_boundaries *golden = NULL;
+
+  model = budouxc_init_embedded_ja(NULL, error);
+  if (!model) {
+    printf("budouxc_init_embedded_ja failed: %s\n", error);
+    goto cleanup;
+  }
+  golden = budouxc_parse_boundaries_utf32(model, sentence, SENTENCE_LEN, error);
+  if (!golden) {
+    printf("budouxc_parse_boundaries_utf32 failed: %s\n", error);
+    goto cleanup;
+  }
+
+  for (size_t block_size = 1; block_size <= 7; ++block_size) {
+    struct context c = {
+        .block_size = block_size,
+        .max_flushes = SIZE_MAX,
+        .golden = golden,
+        .correct = true,
+    };
+    if (!budouxc_parse_boundaries_callback_block(model, get_chars, add_boundaries, &c) || !c.correct) {
+      printf("budouxc_parse_boundaries_callback_block failed with %zu character blocks\n", block_size);
+      goto cleanup;
+    }
+    if (c.nb != golden->n) {
+      printf("number of boundaries mismatch\n");
+      printf("  expected: %zu, got: %zu\n", golden->n, c.nb);
+      goto cleanup;
+    }
+  }
+
+  // Returning false from add_boundaries aborts parsing.
+  struct context c = {
+      .block_size = 4,
+      .max_flushes = 1,
+      .golden = golden,
+      .correct = true,
+  };
+  if (budouxc_parse_boundaries_callback_block(model, get_chars, add_boundaries, &c)) {
+    printf("budouxc_parse_boundaries_callback_block did not abort\n");
+    goto cleanup;
+  }
+  ok = true;
+
+cleanup:
+  if (golden) {
+    budouxc_boundaries_destroy(model, golden);
+  }
+  budouxc_destroy(model);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,247 @@
+#include "budoux-c.h"
+#include "test_helpers.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char const sentence[] = "私はその人を常に先生と呼んでいた。\n"
+                               "だからここでもただ先生と書くだけで本名は打ち明けない。\n"
+                               "これは世間を憚かる遠慮というよりも、その方が私にとって自然だからである。";
+
+// Traditional Chinese text, where the last line is one of the few whose boundaries the compact model changes.
+static char const *const zh_hant_sentences[] = {
+    "今天早上下了一場小雨，街道上的行人比平時少了許多。",
+    "我在路邊的小店裡買了一杯熱茶，坐在窗前看著外面的風景。",
+    "城市的節奏很快，但偶爾停下來，也能發現生活中許多美好的細節。",
+    "在許比多殭梸生厍風厎亯發一人擁今景了生了。小。天活外彐呣比早嶕偶",
+};
+
+static bool same_model_boundaries(struct budouxc *const golden_model, struct budouxc *const model, char *const error) {
+  bool ok = false;
+  struct budouxc_boundaries *golden = NULL;
+  struct budouxc_boundaries *b = NULL;
+  golden = budouxc_parse_boundaries_utf8(golden_model, sentence, strlen(sentence), error);
+  if (!golden) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+  b = budouxc_parse_boundaries_utf8(model, sentence, strlen(sentence), error);
+  if (!b) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+  ok = same_boundaries(golden, b);
+
+cleanup:
+  if (b) {
+    budouxc_boundaries_destroy(model, b);
+  }
+  if (golden) {
+    budouxc_boundaries_destroy(golden_model, golden);
+  }
+  return ok;
+}
+
+static bool contains(struct budouxc_boundaries const *const b, size_t const index) {
+  for (size_t i = 0; i < b->n; ++i) {
+    if (b->indices[i] == index) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Returns whether every boundary of a is also one of b.
+static bool subset(struct budouxc_boundaries const *const a, struct budouxc_boundaries const *const b) {
+  for (size_t i = 0; i < a->n; ++i) {
+    if (!contains(b, a->indices[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Loads a copy of source whose threshold is moved up by delta. A boundary is where the score is above half of the sum
+// of all weights, which is stored 12 bytes into the header of a binary model.
+static struct budouxc *
+shifted_model(struct budouxc const *const source, int32_t const delta, uint64_t **const binary, char *const error) {
+  size_t const size = budouxc_write_binary(source, NULL, 0);
+  *binary = malloc(size);
+  if (!*binary) {
+    strcpy(error, "out of memory");
+    return NULL;
+  }
+  budouxc_write_binary(source, *binary, size);
+  int32_t sum;
+  memcpy(&sum, (char *)*binary + 12, sizeof(sum));
+  sum += delta * 2;
+  memcpy((char *)*binary + 12, &sum, sizeof(sum));
+  return budouxc_init_binary(NULL, *binary, size, error);
+}
+
+// Checks the bound documented by budouxc_init_compact on a model that has to be rounded: a boundary may only differ
+// where the score is within 13 * 2^(s-1) of the threshold. So every boundary of the source model with the threshold
+// moved up by the bound must be kept, and every boundary of the compact model must be one of the source model with the
+// threshold moved down by it.
+static bool within_bound(struct budouxc *const source, char *const error) {
+  bool ok = false;
+  struct budouxc *compact = NULL;
+  struct budouxc *above = NULL;
+  struct budouxc *below = NULL;
+  uint64_t *compact_binary = NULL;
+  uint64_t *above_binary = NULL;
+  uint64_t *below_binary = NULL;
+  struct budouxc_boundaries *upper = NULL;
+  struct budouxc_boundaries *b = NULL;
+  struct budouxc_boundaries *lower = NULL;
+
+  compact = budouxc_init_compact(NULL, source, error);
+  if (!compact) {
+    printf("budouxc_init_compact failed: %s\n", error);
+    goto cleanup;
+  }
+  // The tables are described 24 bytes apart from 48 bytes into the header, each with its value shift s at byte 20.
+  size_t const size = budouxc_write_binary(compact, NULL, 0);
+  compact_binary = malloc(size);
+  if (!compact_binary) {
+    printf("out of memory\n");
+    goto cleanup;
+  }
+  budouxc_write_binary(compact, compact_binary, size);
+  uint32_t shift = 0;
+  for (size_t i = 0; i < 3; ++i) {
+    uint32_t s;
+    memcpy(&s, (char *)compact_binary + 48 + 24 * i + 20, sizeof(s));
+    shift = s > shift ? s : shift;
+  }
+  if (shift == 0) {
+    printf("the model was expected to be rounded\n");
+    goto cleanup;
+  }
+  int32_t const bound = 13 << (shift - 1);
+  above = shifted_model(source, bound, &above_binary, error);
+  below = shifted_model(source, -bound, &below_binary, error);
+  if (!above || !below) {
+    printf("shifted_model failed: %s\n", error);
+    goto cleanup;
+  }
+
+  for (size_t i = 0; i < sizeof(zh_hant_sentences) / sizeof(zh_hant_sentences[0]); ++i) {
+    char const *const s = zh_hant_sentences[i];
+    upper = budouxc_parse_boundaries_utf8(above, s, strlen(s), error);
+    b = budouxc_parse_boundaries_utf8(compact, s, strlen(s), error);
+    lower = budouxc_parse_boundaries_utf8(below, s, strlen(s), error);
+    if (!upper || !b || !lower) {
+      printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+      goto cleanup;
+    }
+    if (!subset(upper, b) || !subset(b, lower)) {
+      printf("boundaries of sentence #%zu differ by more than %d\n", i, bound);
+      goto cleanup;
+    }
+    budouxc_boundaries_destroy(below, lower);
+    lower = NULL;
+    budouxc_boundaries_destroy(compact, b);
+    b = NULL;
+    budouxc_boundaries_destroy(above, upper);
+    upper = NULL;
+  }
+  ok = true;
+
+cleanup:
+  if (lower) {
+    budouxc_boundaries_destroy(below, lower);
+  }
+  if (b) {
+    budouxc_boundaries_destroy(compact, b);
+  }
+  if (upper) {
+    budouxc_boundaries_destroy(above, upper);
+  }
+  budouxc_destroy(below);
+  budouxc_destroy(above);
+  budouxc_destroy(compact);
+  free(below_binary);
+  free(above_binary);
+  free(compact_binary);
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  char error[128] = {0};
+  bool ok = false;
+  struct budouxc *model = NULL;
+  struct budouxc *compact = NULL;
+  struct budouxc *loaded = NULL;
+  struct budouxc *zh_hant = NULL;
+  uint64_t *binary = NULL;
+
+  model = budouxc_init_embedded_ja(NULL, error);
+  if (!model) {
+    printf("budouxc_init_embedded_ja failed: %s\n", error);
+    goto cleanup;
+  }
+  compact = budouxc_init_compact(NULL, model, error);
+  if (!compact) {
+    printf("budouxc_init_compact failed: %s\n", error);
+    goto cleanup;
+  }
+  // The Japanese model fits in 16-bit weights without scaling, so nothing may change but the size.
+  if (!same_model_boundaries(model, compact, error)) {
+    goto cleanup;
+  }
+  if (budouxc_model_bytes(compact) >= budouxc_model_bytes(model) / 2) {
+    printf("compact model is too large: %zu bytes, source: %zu bytes\n",
+           budouxc_model_bytes(compact),
+           budouxc_model_bytes(model));
+    goto cleanup;
+  }
+
+  // A compact model is written and loaded like any other binary model.
+  size_t const size = budouxc_write_binary(compact, NULL, 0);
+  binary = malloc(size);
+  if (!binary) {
+    printf("out of memory\n");
+    goto cleanup;
+  }
+  budouxc_write_binary(compact, binary, size);
+  loaded = budouxc_init_binary(NULL, binary, size, error);
+  if (!loaded) {
+    printf("budouxc_init_binary failed: %s\n", error);
+    goto cleanup;
+  }
+  if (!same_model_boundaries(model, loaded, error)) {
+    goto cleanup;
+  }
+
+  zh_hant = budouxc_init_embedded_zh_hant(NULL, error);
+  if (!zh_hant) {
+    printf("budouxc_init_embedded_zh_hant failed: %s\n", error);
+    goto cleanup;
+  }
+  if (!within_bound(zh_hant, error)) {
+    goto cleanup;
+  }
+
+  struct budouxc *const twice = budouxc_init_compact(NULL, compact, error);
+  if (twice) {
+    printf("budouxc_init_compact accepted a compact model\n");
+    budouxc_destroy(twice);
+    goto cleanup;
+  }
+  ok = true;
+
+cleanup:
+  budouxc_destroy(zh_hant);
+  budouxc_destroy(loaded);
+  free(binary);
+  budouxc_destroy(compact);
+  budouxc_destroy(model);
+  return ok ? 0 : 1;
+}
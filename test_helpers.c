@@ -0,0 +1,63 @@
+#include "test_helpers.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+char const model_json[] = "{\"UW1\":{\"私\":120,\"常\":-40},\"UW2\":{\"は\":-300},\"UW3\":{\"そ\":450,\"先\":380},"
+                          "\"UW4\":{\"を\":-800,\"と\":-650},\"UW5\":{\"人\":90},\"UW6\":{\"。\":-70},"
+                          "\"BW1\":{\"はそ\":900},\"BW2\":{\"その\":-500,\"先生\":-900},\"BW3\":{\"を常\":700},"
+                          "\"TW1\":{\"私はそ\":300},\"TW2\":{\"人を常\":200},\"TW3\":{\"呼んで\":-600},"
+                          "\"TW4\":{\"でいた\":-400}}";
+
+#define HEADER_SIZE sizeof(max_align_t)
+
+void *counting_realloc(void *ptr, size_t const size, void *user_data) {
+  struct counter *const c = user_data;
+  unsigned char *block = ptr ? (unsigned char *)ptr - HEADER_SIZE : NULL;
+  size_t old = 0;
+  if (block) {
+    memcpy(&old, block, sizeof(old));
+  }
+  block = realloc(block, size + HEADER_SIZE);
+  if (!block) {
+    return NULL;
+  }
+  memcpy(block, &size, sizeof(size));
+  atomic_fetch_add(&c->allocations, 1);
+  size_t const current = atomic_fetch_add(&c->current, size - old) + size - old;
+  size_t peak = atomic_load(&c->peak);
+  while (current > peak && !atomic_compare_exchange_weak(&c->peak, &peak, current)) {
+  }
+  return block + HEADER_SIZE;
+}
+
+void counting_free(void *ptr, void *user_data) {
+  struct counter *const c = user_data;
+  if (!ptr) {
+    return;
+  }
+  unsigned char *const block = (unsigned char *)ptr - HEADER_SIZE;
+  size_t size = 0;
+  memcpy(&size, block, sizeof(size));
+  atomic_fetch_sub(&c->current, size);
+  free(block);
+}
+
+void counter_reset_peak(struct counter *const c) { atomic_store(&c->peak, atomic_load(&c->current)); }
+
+bool same_boundaries(struct budouxc_boundaries const *const golden, struct budouxc_boundaries const *const b) {
+  if (golden->n != b->n) {
+    printf("number of boundaries mismatch\n");
+    printf("  expected: %zu, got: %zu\n", golden->n, b->n);
+    return false;
+  }
+  for (size_t i = 0; i < b->n; ++i) {
+    if (golden->indices[i] != b->indices[i]) {
+      printf("boundary mismatch at %zu\n", i);
+      printf("  expected: %zu, got: %zu\n", golden->indices[i], b->indices[i]);
+      return false;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include "budoux-c.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Helpers shared by the tests and the benchmark.
+
+// A small Japanese model in JSON, with weights in every table.
+extern char const model_json[];
+
+// Memory allocated through counting_realloc and counting_free. They are called from the worker threads of the batch
+// and parallel functions, so the counts are atomic.
+struct counter {
+  atomic_size_t allocations;
+  atomic_size_t current;
+  atomic_size_t peak;
+};
+
+// Allocators that count into the struct counter passed as user_data. Every block is prefixed with its size, so that
+// frees can be counted too.
+void *counting_realloc(void *ptr, size_t const size, void *user_data);
+void counting_free(void *ptr, void *user_data);
+
+// Starts measuring the peak from the current usage.
+void counter_reset_peak(struct counter *const c);
+
+// Returns whether b has the same boundaries as golden, and prints the first difference if not.
+bool same_boundaries(struct budouxc_boundaries const *const golden, struct budouxc_boundaries const *const b);
@@ -0,0 +1,115 @@
+#include "budoux-c.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+static char const separator[] = "\xe2\x80\x8b";
+
+static char const sentence[] = "私はその人を常に先生と呼んでいた。";
+
+// The same sentence split by inline elements must be segmented as if the elements were not there.
+static char const inline_html[] = "<p>私は<b>その人を</b>常に<a href=\"x\">先生と</a>呼んでいた。</p>";
+
+// Nothing outside of text nodes is segmented.
+static char const skipped_html[] = "<!DOCTYPE html><html><head><title>私はその人を常に先生と</title>"
+                                   "<style>p::after{content:\"私はその人を\"}</style></head>"
+                                   "<body><!-- 私はその人を常に先生と --><p data-x=\"私はその人を常に先生と\" title='>私はその人を'></p>"
+                                   "<script>var s = \"</p>私はその人を常に先生と\";</script></body></html>";
+
+static size_t remove_tags(char *const dest, char const *const src, size_t const len) {
+  size_t n = 0;
+  bool in_tag = false;
+  for (size_t i = 0; i < len; ++i) {
+    if (src[i] == '<') {
+      in_tag = true;
+    } else if (src[i] == '>') {
+      in_tag = false;
+    } else if (!in_tag) {
+      dest[n++] = src[i];
+    }
+  }
+  return n;
+}
+
+static bool annotate(struct budouxc *const model,
+                     char const *const html,
+                     struct budouxc_buffer *const out,
+                     char *const error) {
+  out->len = 0;
+  if (!budouxc_annotate_html(model, html, strlen(html), separator, strlen(separator), out, error)) {
+    printf("budouxc_annotate_html failed: %s\n", error);
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  char error[128] = {0};
+  bool ok = false;
+  struct budouxc *model = NULL;
+  struct budouxc_boundaries *boundaries = NULL;
+  struct budouxc_buffer out = {0};
+  char expected[256];
+  size_t expected_len = 0;
+  char got[256];
+
+  model = budouxc_init_embedded_ja(NULL, error);
+  if (!model) {
+    printf("budouxc_init_embedded_ja failed: %s\n", error);
+    goto cleanup;
+  }
+
+  // Plain text gets a separator at every boundary.
+  boundaries = budouxc_parse_boundaries_utf8(model, sentence, strlen(sentence), error);
+  if (!boundaries) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+  for (size_t i = 0, prev = 0; i <= boundaries->n; ++i) {
+    size_t const end = i < boundaries->n ? boundaries->indices[i] : strlen(sentence);
+    memcpy(expected + expected_len, sentence + prev, end - prev);
+    expected_len += end - prev;
+    if (i < boundaries->n) {
+      memcpy(expected + expected_len, separator, strlen(separator));
+      expected_len += strlen(separator);
+    }
+    prev = end;
+  }
+  if (!annotate(model, sentence, &out, error)) {
+    goto cleanup;
+  }
+  if (out.len != expected_len || memcmp(out.ptr, expected, expected_len) != 0) {
+    printf("unexpected output: %.*s\n", (int)out.len, out.ptr);
+    goto cleanup;
+  }
+
+  if (!annotate(model, inline_html, &out, error)) {
+    goto cleanup;
+  }
+  size_t const got_len = remove_tags(got, out.ptr, out.len);
+  if (got_len != expected_len || memcmp(got, expected, expected_len) != 0) {
+    printf("unexpected output: %.*s\n", (int)out.len, out.ptr);
+    goto cleanup;
+  }
+
+  if (!annotate(model, skipped_html, &out, error)) {
+    goto cleanup;
+  }
+  if (out.len != strlen(skipped_html) || memcmp(out.ptr, skipped_html, out.len) != 0) {
+    printf("unexpected output: %.*s\n", (int)out.len, out.ptr);
+    goto cleanup;
+  }
+  ok = true;
+
+cleanup:
+  budouxc_buffer_destroy(model, &out);
+  if (boundaries) {
+    budouxc_boundaries_destroy(model, boundaries);
+  }
+  budouxc_destroy(model);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+#include "budoux-c.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static char const sentence[] = "私はその人を常に先生と呼んでいた。";
+static char32_t const sentence32[] = U"私はその人を常に先生と呼んでいた。";
+
+#define SENTENCE_LEN (sizeof(sentence32) / sizeof(sentence32[0]) - 1)
+
+struct events {
+  size_t init_phases[budouxc_init_phases];
+  size_t parses[budouxc_entry_points];
+  size_t code_points[budouxc_entry_points];
+};
+
+static void on_init_phase(enum budouxc_init_phase const phase, uint64_t const nanoseconds, void *userdata) {
+  (void)nanoseconds;
+  struct events *const e = userdata;
+  ++e->init_phases[phase];
+}
+
+static void on_parse(enum budouxc_entry_point const entry_point,
+                     uint64_t const nanoseconds,
+                     size_t const code_points,
+                     void *userdata) {
+  (void)nanoseconds;
+  struct events *const e = userdata;
+  ++e->parses[entry_point];
+  e->code_points[entry_point] += code_points;
+}
+
+static bool add_boundaries(size_t const *const boundaries, size_t const n, void *userdata) {
+  (void)boundaries;
+  (void)n;
+  (void)userdata;
+  return true;
+}
+
+static char32_t const *get_chars(size_t *const len, void *userdata) {
+  bool *const done = userdata;
+  *len = *done ? 0 : SENTENCE_LEN;
+  *done = true;
+  return sentence32;
+}
+
+static uint64_t bucket_total(struct budouxc_histogram const *const h) {
+  uint64_t n = 0;
+  for (size_t i = 0; i < BUDOUXC_HISTOGRAM_BUCKETS; ++i) {
+    n += h->buckets[i];
+  }
+  return n;
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  char error[128] = {0};
+  bool ok = false;
+  struct budouxc *model = NULL;
+  struct budouxc_boundaries *boundaries = NULL;
+  struct events e = {0};
+  struct budouxc_instrument_snapshot snapshot;
+
+  struct budouxc_instrument_sink const sink = {
+      .init_phase = on_init_phase,
+      .parse = on_parse,
+      .userdata = &e,
+  };
+  bool const enabled = budouxc_instrument_set_sink(&sink);
+  if (budouxc_instrument_snapshot(&snapshot, true) != enabled) {
+    printf("budouxc_instrument_snapshot and budouxc_instrument_set_sink disagree\n");
+    goto cleanup;
+  }
+
+  model = budouxc_init_embedded_ja(NULL, error);
+  if (!model) {
+    printf("budouxc_init_embedded_ja failed: %s\n", error);
+    goto cleanup;
+  }
+  boundaries = budouxc_parse_boundaries_utf8(model, sentence, strlen(sentence), error);
+  if (!boundaries) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+  size_t indices[32];
+  if (budouxc_parse_boundaries_utf32_into(model, sentence32, SENTENCE_LEN, indices, 32, error) != boundaries->n) {
+    printf("budouxc_parse_boundaries_utf32_into failed: %s\n", error);
+    goto cleanup;
+  }
+  bool done = false;
+  if (!budouxc_parse_boundaries_callback_block(model, get_chars, add_boundaries, &done)) {
+    printf("budouxc_parse_boundaries_callback_block failed\n");
+    goto cleanup;
+  }
+
+  if (!enabled) {
+    // Without instrumentation, nothing may be recorded.
+    if (e.init_phases[budouxc_init_phase_load_binary] || e.parses[budouxc_entry_point_utf8]) {
+      printf("measurements were recorded without instrumentation\n");
+      goto cleanup;
+    }
+    ok = true;
+    goto cleanup;
+  }
+
+  // UTF-8 input is counted in code points, not bytes.
+  if (e.init_phases[budouxc_init_phase_load_binary] != 1 || e.parses[budouxc_entry_point_utf8] != 1 ||
+      e.code_points[budouxc_entry_point_utf8] != SENTENCE_LEN || e.parses[budouxc_entry_point_utf32] != 1 ||
+      e.code_points[budouxc_entry_point_utf32] != SENTENCE_LEN ||
+      e.parses[budouxc_entry_point_callback_block] != 1 ||
+      e.code_points[budouxc_entry_point_callback_block] != SENTENCE_LEN) {
+    printf("unexpected sink events\n");
+    goto cleanup;
+  }
+  if (!budouxc_instrument_snapshot(&snapshot, true)) {
+    printf("budouxc_instrument_snapshot failed\n");
+    goto cleanup;
+  }
+  if (snapshot.init_phases[budouxc_init_phase_load_binary].count != 1 ||
+      snapshot.latency[budouxc_entry_point_utf8].count != 1 || snapshot.cost[budouxc_entry_point_utf8].count != 1 ||
+      bucket_total(&snapshot.latency[budouxc_entry_point_utf8]) != 1 ||
+      snapshot.latency[budouxc_entry_point_utf16].count != 0) {
+    printf("unexpected snapshot\n");
+    goto cleanup;
+  }
+
+  // A reset snapshot starts over, and a removed sink is no longer called.
+  budouxc_instrument_set_sink(NULL);
+  size_t const parses = e.parses[budouxc_entry_point_utf32];
+  if (budouxc_parse_boundaries_utf32_into(model, sentence32, SENTENCE_LEN, indices, 32, error) == SIZE_MAX) {
+    printf("budouxc_parse_boundaries_utf32_into failed: %s\n", error);
+    goto cleanup;
+  }
+  if (!budouxc_instrument_snapshot(&snapshot, false)) {
+    printf("budouxc_instrument_snapshot failed\n");
+    goto cleanup;
+  }
+  if (e.parses[budouxc_entry_point_utf32] != parses || snapshot.latency[budouxc_entry_point_utf32].count != 1 ||
+      snapshot.latency[budouxc_entry_point_utf8].count != 0) {
+    printf("unexpected snapshot after reset\n");
+    goto cleanup;
+  }
+  ok = true;
+
+cleanup:
+  budouxc_instrument_set_sink(NULL);
+  if (boundaries) {
+    budouxc_boundaries_destroy(model, boundaries);
+  }
+  budouxc_destroy(model);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+#include "budoux-c.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define WEIGHTS                                                                                                        \
+  "\"UW1\":{\"私\":120,\"常\":-40},\"UW2\":{\"は\":-300},\"UW3\":{\"そ\":450,\"先\":380},"                                  \
+  "\"UW4\":{\"を\":-800,\"と\":-650},\"UW5\":{\"人\":90},\"UW6\":{\"。\":-70},"                                            \
+  "\"BW1\":{\"はそ\":900},\"BW2\":{\"その\":-500,\"先生\":-900},\"BW3\":{\"を常\":700},"                                       \
+  "\"TW1\":{\"私はそ\":300},\"TW2\":{\"人を常\":200},\"TW3\":{\"呼んで\":-600}"
+
+static char const model_json[] = "{" WEIGHTS ",\"TW4\":{\"でいた\":-400}}";
+
+// The same model with escapes, whitespace, a key given twice and values that are not part of the model.
+static char const escaped_json[] = "{\n"
+                                   "  \"version\": [1, 2.5e-3, {\"a\": [true, false, null]},\n"
+                                   "              \"\\\"\\\\\\/\\b\\f\\n\"],\n"
+                                   "  " WEIGHTS ",\n"
+                                   "  \"TW4\": {\"\\u3067\\u3044\\u305F\": -100, \"でいた\": -400},\n"
+                                   "  \"\\u0054W5\": {\"\\ud83d\\ude00\": 1.5},\n"
+                                   "  \"UW7\": -0\n"
+                                   "}\n";
+
+static char const sentence[] = "私はその人を常に先生と呼んでいた。";
+
+struct invalid {
+  char const *json;
+  char const *error;
+};
+
+static struct invalid const invalid_models[] = {
+    {"[]", "JSON root is not an object"},
+    {"   ", "1:4: Unexpected end of JSON"},
+    {"{\"UW1\":[]}", "JSON key UW1 is not an object"},
+    {"{\"UW1\":{},\"UW1\":{}}", "Duplicate key UW1"},
+    {"{\"UW1\":{}}", "Missing key UW2"},
+    {"{\"UW1\":{\"a\":1.5}}", "Invalid JSON structure"},
+    {"{\"UW1\":{\"a\":\"1\"}}", "Invalid JSON structure"},
+    {"{\"UW1\":{\"a\":9223372036854775808}}", "Invalid JSON structure"},
+    {"{\"UW1\":{\"abcd\":1}}", "Failed to convert to codepoint(s): abcd"},
+    {"{\"UW1\":{\"\":1}}", "Failed to convert to codepoint(s): "},
+    {"{\"UW1\":{\"\\ud800\":1}}", "Failed to convert to codepoint(s): \\ud800"},
+    {"{\"UW1\":{\"a\":1,}}", "1:15: Unexpected `}`"},
+    {"{\"UW1\":{}} x", "1:12: Unexpected `x`"},
+    {"{\n  \"X\": tru\n}", "2:11: Unexpected byte 0x0a"},
+    {"{\"UW1\":{\"a", "1:11: Unexpected end of JSON"},
+    {"{\"X\":\"\\x\"}", "1:8: Unexpected `x`"},
+    {"{\"X\":01}", "1:7: Unexpected `1`"},
+    {"{\"X\":"
+     "[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[["
+     "[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[",
+     "1:69: Too deeply nested"},
+};
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  char error[128] = {0};
+  bool ok = false;
+  struct budouxc *model = NULL;
+  struct budouxc *escaped = NULL;
+  struct budouxc *parallel = NULL;
+  struct budouxc_boundaries *want = NULL;
+  struct budouxc_boundaries *got = NULL;
+  struct budouxc_boundaries *parallel_got = NULL;
+
+  model = budouxc_init(NULL, model_json, strlen(model_json), error);
+  if (!model) {
+    printf("budouxc_init failed: %s\n", error);
+    goto cleanup;
+  }
+  escaped = budouxc_init(NULL, escaped_json, strlen(escaped_json), error);
+  if (!escaped) {
+    printf("budouxc_init failed with escapes: %s\n", error);
+    goto cleanup;
+  }
+  want = budouxc_parse_boundaries_utf8(model, sentence, strlen(sentence), error);
+  if (!want) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+  got = budouxc_parse_boundaries_utf8(escaped, sentence, strlen(sentence), error);
+  if (!got) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+  if (want->n == 0 || want->n != got->n || memcmp(want->indices, got->indices, want->n * sizeof(size_t)) != 0) {
+    printf("boundary mismatch\n");
+    goto cleanup;
+  }
+  // A weight given twice only counts once in the sum.
+  struct budouxc_model_stats want_stats;
+  struct budouxc_model_stats got_stats;
+  if (!budouxc_model_stats(model, &want_stats) || !budouxc_model_stats(escaped, &got_stats)) {
+    printf("budouxc_model_stats failed\n");
+    goto cleanup;
+  }
+  if (want_stats.sum != got_stats.sum) {
+    printf("unexpected sum: %d, expected: %d\n", (int)got_stats.sum, (int)want_stats.sum);
+    goto cleanup;
+  }
+
+  // Building the maps on multiple threads makes the same model.
+  parallel = budouxc_init_parallel(NULL, escaped_json, strlen(escaped_json), 4, error);
+  if (!parallel) {
+    printf("budouxc_init_parallel failed: %s\n", error);
+    goto cleanup;
+  }
+  struct budouxc_model_stats parallel_stats;
+  if (!budouxc_model_stats(parallel, &parallel_stats)) {
+    printf("budouxc_model_stats failed\n");
+    goto cleanup;
+  }
+  if (parallel_stats.sum != want_stats.sum || parallel_stats.bytes != want_stats.bytes ||
+      memcmp(parallel_stats.weights, want_stats.weights, sizeof(want_stats.weights)) != 0) {
+    printf("budouxc_init_parallel made a different model\n");
+    goto cleanup;
+  }
+  parallel_got = budouxc_parse_boundaries_utf8(parallel, sentence, strlen(sentence), error);
+  if (!parallel_got) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+  if (want->n != parallel_got->n || memcmp(want->indices, parallel_got->indices, want->n * sizeof(size_t)) != 0) {
+    printf("boundary mismatch with budouxc_init_parallel\n");
+    goto cleanup;
+  }
+
+  for (size_t i = 0; i < sizeof(invalid_models) / sizeof(invalid_models[0]); ++i) {
+    struct invalid const *const t = &invalid_models[i];
+    for (size_t threads = 1; threads <= 4; threads += 3) {
+      error[0] = '\0';
+      struct budouxc *const m = budouxc_init_parallel(NULL, t->json, strlen(t->json), threads, error);
+      if (m) {
+        printf("budouxc_init_parallel accepted invalid model #%zu with %zu threads\n", i, threads);
+        budouxc_destroy(m);
+        goto cleanup;
+      }
+      if (strcmp(error, t->error) != 0) {
+        printf("invalid model #%zu with %zu threads: unexpected error: %s, expected: %s\n",
+               i,
+               threads,
+               error,
+               t->error);
+        goto cleanup;
+      }
+    }
+  }
+  ok = true;
+
+cleanup:
+  if (parallel_got) {
+    budouxc_boundaries_destroy(parallel, parallel_got);
+  }
+  if (got) {
+    budouxc_boundaries_destroy(escaped, got);
+  }
+  if (want) {
+    budouxc_boundaries_destroy(model, want);
+  }
+  budouxc_destroy(parallel);
+  budouxc_destroy(escaped);
+  budouxc_destroy(model);
+  return ok ? 0 : 1;
+}
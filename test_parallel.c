@@ -0,0 +1,145 @@
+#include "budoux-c.h"
+#include "test_helpers.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char const *const sentences[] = {
+    "私はその人を常に先生と呼んでいた。",
+    "だからここでもただ先生と書くだけで本名は打ち明けない。",
+    "これは世間を憚かる遠慮というよりも、その方が私にとって自然だからである。",
+    "Lorem ipsum dolor sit amet. ",
+    "よそよそしい頭文字などはとても使う気にならない。\n",
+};
+
+#define SENTENCES (sizeof(sentences) / sizeof(sentences[0]))
+
+// A scheduler that runs each task when it is joined, which works on WASI too.
+struct deferred_task {
+  void (*fn)(void *arg);
+  void *arg;
+};
+
+static struct deferred_task tasks[8];
+static size_t tasks_spawned;
+
+static void *deferred_spawn(void (*fn)(void *arg), void *arg, void *userdata) {
+  (void)userdata;
+  if (tasks_spawned == sizeof(tasks) / sizeof(tasks[0])) {
+    return NULL;
+  }
+  struct deferred_task *const t = &tasks[tasks_spawned++];
+  t->fn = fn;
+  t->arg = arg;
+  return t;
+}
+
+static void deferred_join(void *task, void *userdata) {
+  (void)userdata;
+  struct deferred_task const *const t = task;
+  t->fn(t->arg);
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  char error[128] = {0};
+  bool ok = false;
+  struct budouxc *model = NULL;
+  struct budouxc_boundaries *golden = NULL;
+  struct budouxc_boundaries *b = NULL;
+  char *doc = NULL;
+  size_t doc_len = 0;
+
+  // Build a document long enough to be split, mixing sentences so that chunks are cut in every kind of place.
+  size_t const doc_cap = 1024 * 1024;
+  doc = malloc(doc_cap);
+  if (!doc) {
+    printf("out of memory\n");
+    goto cleanup;
+  }
+  for (size_t i = 0;; ++i) {
+    char const *const s = sentences[(i * 7 + i / 3) % SENTENCES];
+    size_t const len = strlen(s);
+    if (doc_len + len > doc_cap) {
+      break;
+    }
+    memcpy(doc + doc_len, s, len);
+    doc_len += len;
+  }
+
+  model = budouxc_init_embedded_ja(NULL, error);
+  if (!model) {
+    printf("budouxc_init_embedded_ja failed: %s\n", error);
+    goto cleanup;
+  }
+  golden = budouxc_parse_boundaries_utf8(model, doc, doc_len, error);
+  if (!golden) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+  size_t const threads[] = {1, 2, 3, 8};
+  for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); ++i) {
+    b = budouxc_parse_boundaries_parallel_utf8(model, doc, doc_len, threads[i], error);
+    if (!b) {
+      printf("budouxc_parse_boundaries_parallel_utf8 failed with %zu threads: %s\n", threads[i], error);
+      goto cleanup;
+    }
+    if (!same_boundaries(golden, b)) {
+      printf("  with %zu threads\n", threads[i]);
+      goto cleanup;
+    }
+    budouxc_boundaries_destroy(model, b);
+    b = NULL;
+  }
+
+  // Workers are started by the registered hooks.
+  if (budouxc_set_thread_hooks(&(struct budouxc_thread_hooks){.spawn = deferred_spawn})) {
+    printf("budouxc_set_thread_hooks accepted spawn without join\n");
+    goto cleanup;
+  }
+  if (!budouxc_set_thread_hooks(&(struct budouxc_thread_hooks){.spawn = deferred_spawn, .join = deferred_join})) {
+    printf("budouxc_set_thread_hooks failed\n");
+    goto cleanup;
+  }
+  b = budouxc_parse_boundaries_parallel_utf8(model, doc, doc_len, 4, error);
+  budouxc_set_thread_hooks(NULL);
+  if (!b) {
+    printf("budouxc_parse_boundaries_parallel_utf8 failed with thread hooks: %s\n", error);
+    goto cleanup;
+  }
+  if (tasks_spawned != 3) {
+    printf("%zu tasks spawned, expected: 3\n", tasks_spawned);
+    goto cleanup;
+  }
+  if (!same_boundaries(golden, b)) {
+    printf("  with thread hooks\n");
+    goto cleanup;
+  }
+  budouxc_boundaries_destroy(model, b);
+  b = NULL;
+
+  // Broken input anywhere in the document fails the whole parse.
+  doc[doc_len / 2] = '\xff';
+  b = budouxc_parse_boundaries_parallel_utf8(model, doc, doc_len, 4, error);
+  if (b) {
+    printf("budouxc_parse_boundaries_parallel_utf8 accepted broken input\n");
+    goto cleanup;
+  }
+  ok = true;
+
+cleanup:
+  if (b) {
+    budouxc_boundaries_destroy(model, b);
+  }
+  if (golden) {
+    budouxc_boundaries_destroy(model, golden);
+  }
+  budouxc_destroy(model);
+  free(doc);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+#include "budoux-c.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static char const sentence[] = "私はその人を常に先生と呼んでいた。\n"
+                               "だからここでもただ先生と書くだけで本名は打ち明けない。\n"
+                               "これは世間を憚かる遠慮というよりも、その方が私にとって自然だからである。";
+
+static bool same_indices(struct budouxc_boundaries const *const golden, size_t const *const indices, size_t const n) {
+  if (golden->n != n) {
+    printf("number of boundaries mismatch\n");
+    printf("  expected: %zu, got: %zu\n", golden->n, n);
+    return false;
+  }
+  for (size_t i = 0; i < n; ++i) {
+    if (golden->indices[i] != indices[i]) {
+      printf("boundary mismatch at %zu\n", i);
+      printf("  expected: %zu, got: %zu\n", golden->indices[i], indices[i]);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  char error[128] = {0};
+  bool ok = false;
+  struct budouxc *model = NULL;
+  struct budouxc_parser *parser = NULL;
+  struct budouxc_boundaries *golden = NULL;
+
+  model = budouxc_init_embedded_ja(NULL, error);
+  if (!model) {
+    printf("budouxc_init_embedded_ja failed: %s\n", error);
+    goto cleanup;
+  }
+  golden = budouxc_parse_boundaries_utf8(model, sentence, strlen(sentence), error);
+  if (!golden) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+
+  // The required size is reported without a buffer, and a short buffer receives the leading boundaries.
+  size_t indices[64];
+  size_t const n = budouxc_parse_boundaries_utf8_into(model, sentence, strlen(sentence), NULL, 0, error);
+  if (n == SIZE_MAX) {
+    printf("budouxc_parse_boundaries_utf8_into failed: %s\n", error);
+    goto cleanup;
+  }
+  if (n != golden->n || n < 2 || n > sizeof(indices) / sizeof(indices[0])) {
+    printf("unexpected number of boundaries: %zu\n", n);
+    goto cleanup;
+  }
+  indices[1] = SIZE_MAX;
+  if (budouxc_parse_boundaries_utf8_into(model, sentence, strlen(sentence), indices, 1, error) != n ||
+      indices[0] != golden->indices[0] || indices[1] != SIZE_MAX) {
+    printf("budouxc_parse_boundaries_utf8_into wrote past the end of the buffer\n");
+    goto cleanup;
+  }
+  if (budouxc_parse_boundaries_utf8_into(model, sentence, strlen(sentence), indices, n, error) != n ||
+      !same_indices(golden, indices, n)) {
+    goto cleanup;
+  }
+  if (budouxc_parse_boundaries_utf8_into(model, "\xff", 1, indices, n, error) != SIZE_MAX) {
+    printf("budouxc_parse_boundaries_utf8_into accepted broken input\n");
+    goto cleanup;
+  }
+
+  // A parser returns the same result every time while reusing its buffer.
+  parser = budouxc_parser_init(model, error);
+  if (!parser) {
+    printf("budouxc_parser_init failed: %s\n", error);
+    goto cleanup;
+  }
+  for (int i = 0; i < 3; ++i) {
+    struct budouxc_boundaries const *const b = budouxc_parser_parse_utf8(parser, sentence, strlen(sentence), error);
+    if (!b) {
+      printf("budouxc_parser_parse_utf8 failed: %s\n", error);
+      goto cleanup;
+    }
+    if (!same_indices(golden, b->indices, b->n)) {
+      goto cleanup;
+    }
+  }
+  struct budouxc_boundaries const *const empty = budouxc_parser_parse_utf8(parser, "a", 1, error);
+  if (!empty || empty->n != 0) {
+    printf("budouxc_parser_parse_utf8 found a boundary in a single character\n");
+    goto cleanup;
+  }
+  ok = true;
+
+cleanup:
+  budouxc_parser_destroy(parser);
+  if (golden) {
+    budouxc_boundaries_destroy(model, golden);
+  }
+  budouxc_destroy(model);
+  return ok ? 0 : 1;
+}
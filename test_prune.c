@@ -0,0 +1,94 @@
+#include "budoux-c.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static char const sentence[] = "私はその人を常に先生と呼んでいた。\n"
+                               "だからここでもただ先生と書くだけで本名は打ち明けない。\n"
+                               "これは世間を憚かる遠慮というよりも、その方が私にとって自然だからである。";
+
+static struct budouxc_boundaries *parse(struct budouxc *const model, char *const error) {
+  struct budouxc_boundaries *const b = budouxc_parse_boundaries_utf8(model, sentence, strlen(sentence), error);
+  if (!b) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+  }
+  return b;
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  char error[128] = {0};
+  bool ok = false;
+  struct budouxc *model = NULL;
+  struct budouxc *pruned = NULL;
+  struct budouxc *empty = NULL;
+  struct budouxc_boundaries *golden = NULL;
+  // All models use the default allocators, so any of them can destroy the boundaries of another.
+  struct budouxc_boundaries *b = NULL;
+
+  model = budouxc_init_embedded_ja(NULL, error);
+  if (!model) {
+    printf("budouxc_init_embedded_ja failed: %s\n", error);
+    goto cleanup;
+  }
+  golden = parse(model, error);
+  if (!golden) {
+    goto cleanup;
+  }
+
+  // A threshold of 0 keeps everything.
+  pruned = budouxc_init_pruned(NULL, model, 0, error);
+  if (!pruned) {
+    printf("budouxc_init_pruned failed: %s\n", error);
+    goto cleanup;
+  }
+  if (budouxc_model_bytes(pruned) != budouxc_model_bytes(model)) {
+    printf("unexpected size: %zu, expected: %zu\n", budouxc_model_bytes(pruned), budouxc_model_bytes(model));
+    goto cleanup;
+  }
+  b = parse(pruned, error);
+  if (!b) {
+    goto cleanup;
+  }
+  if (b->n != golden->n || memcmp(b->indices, golden->indices, b->n * sizeof(size_t)) != 0) {
+    printf("boundary mismatch\n");
+    goto cleanup;
+  }
+
+  // Without any n-gram every position scores 0, which is below the threshold of the Japanese model.
+  empty = budouxc_init_pruned(NULL, model, INT32_MAX, error);
+  if (!empty) {
+    printf("budouxc_init_pruned failed: %s\n", error);
+    goto cleanup;
+  }
+  if (budouxc_model_bytes(empty) >= budouxc_model_bytes(model) / 2) {
+    printf("pruned model is too large: %zu bytes\n", budouxc_model_bytes(empty));
+    goto cleanup;
+  }
+  budouxc_boundaries_destroy(model, b);
+  b = parse(empty, error);
+  if (!b) {
+    goto cleanup;
+  }
+  if (b->n != 0) {
+    printf("unexpected boundaries: %zu\n", b->n);
+    goto cleanup;
+  }
+  ok = true;
+
+cleanup:
+  if (b) {
+    budouxc_boundaries_destroy(model, b);
+  }
+  if (golden) {
+    budouxc_boundaries_destroy(model, golden);
+  }
+  budouxc_destroy(empty);
+  budouxc_destroy(pruned);
+  budouxc_destroy(model);
+  return ok ? 0 : 1;
+}
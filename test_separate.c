@@ -0,0 +1,105 @@
+#include "budoux-c.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static char const sentence[] = "私はその人を常に先生と呼んでいた。\n"
+                               "だからここでもただ先生と書くだけで本名は打ち明けない。";
+
+static char16_t const sentence16[] = u"私はその人を常に先生と呼んでいた。\n"
+                                     u"だからここでもただ先生と書くだけで本名は打ち明けない。";
+
+struct sink {
+  char buf[512];
+  size_t len;
+};
+
+static bool write_output(char const *const data, size_t const len, void *userdata) {
+  struct sink *const s = userdata;
+  if (s->len + len > sizeof(s->buf)) {
+    return false;
+  }
+  memcpy(s->buf + s->len, data, len);
+  s->len += len;
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  char error[128] = {0};
+  bool ok = false;
+  struct budouxc *model = NULL;
+  struct budouxc_boundaries *boundaries = NULL;
+  char expected[512];
+  size_t expected_len = 0;
+  char out[512];
+
+  model = budouxc_init_embedded_ja(NULL, error);
+  if (!model) {
+    printf("budouxc_init_embedded_ja failed: %s\n", error);
+    goto cleanup;
+  }
+  boundaries = budouxc_parse_boundaries_utf8(model, sentence, strlen(sentence), error);
+  if (!boundaries) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+  for (size_t i = 0, prev = 0; i <= boundaries->n; ++i) {
+    size_t const end = i < boundaries->n ? boundaries->indices[i] : strlen(sentence);
+    memcpy(expected + expected_len, sentence + prev, end - prev);
+    expected_len += end - prev;
+    if (i < boundaries->n) {
+      expected[expected_len++] = '|';
+    }
+    prev = end;
+  }
+
+  // The required length is reported without a buffer, and a short buffer receives the beginning of the output.
+  size_t const n = budouxc_separate_utf8(model, sentence, strlen(sentence), "|", 1, NULL, 0, error);
+  if (n != expected_len) {
+    printf("unexpected length: %zu, expected: %zu\n", n, expected_len);
+    goto cleanup;
+  }
+  out[10] = '\0';
+  if (budouxc_separate_utf8(model, sentence, strlen(sentence), "|", 1, out, 10, error) != n ||
+      memcmp(out, expected, 10) != 0 || out[10] != '\0') {
+    printf("budouxc_separate_utf8 wrote an unexpected output into a short buffer\n");
+    goto cleanup;
+  }
+  if (budouxc_separate_utf8(model, sentence, strlen(sentence), "|", 1, out, sizeof(out), error) != n ||
+      memcmp(out, expected, n) != 0) {
+    printf("unexpected output: %.*s\n", (int)n, out);
+    goto cleanup;
+  }
+
+  struct sink s = {0};
+  if (!budouxc_separate_utf8_callback(model, sentence, strlen(sentence), "|", 1, write_output, &s, error)) {
+    printf("budouxc_separate_utf8_callback failed: %s\n", error);
+    goto cleanup;
+  }
+  if (s.len != n || memcmp(s.buf, expected, n) != 0) {
+    printf("unexpected output: %.*s\n", (int)s.len, s.buf);
+    goto cleanup;
+  }
+
+  // UTF-16 output has the same number of separators.
+  char16_t out16[256];
+  size_t const len16 = sizeof(sentence16) / sizeof(sentence16[0]) - 1;
+  size_t const n16 = budouxc_separate_utf16(model, sentence16, len16, u"|", 1, out16, 256, error);
+  if (n16 != len16 + boundaries->n) {
+    printf("unexpected length: %zu, expected: %zu\n", n16, len16 + boundaries->n);
+    goto cleanup;
+  }
+  ok = true;
+
+cleanup:
+  if (boundaries) {
+    budouxc_boundaries_destroy(model, boundaries);
+  }
+  budouxc_destroy(model);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#include "budoux-c.h"
+#include "test_helpers.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static char const sentence[] = "私はその人を常に先生と呼んでいた。";
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  char error[128] = {0};
+  bool ok = false;
+  struct counter counter = {0};
+  struct budouxc_allocators const allocators = {
+      .fn_realloc = counting_realloc,
+      .fn_free = counting_free,
+      .user_data = &counter,
+  };
+  struct budouxc *first = NULL;
+  struct budouxc *second = NULL;
+  struct budouxc *other = NULL;
+  struct budouxc *ja = NULL;
+  struct budouxc *ja2 = NULL;
+  struct budouxc *zh = NULL;
+  struct budouxc_boundaries *boundaries = NULL;
+
+  first = budouxc_acquire(&allocators, model_json, strlen(model_json), error);
+  if (!first) {
+    printf("budouxc_acquire failed: %s\n", error);
+    goto cleanup;
+  }
+  // The same JSON gives the same model without loading it again.
+  size_t const allocations = atomic_load(&counter.allocations);
+  second = budouxc_acquire(&allocators, model_json, strlen(model_json), error);
+  if (second != first || atomic_load(&counter.allocations) != allocations) {
+    printf("budouxc_acquire loaded the same model again\n");
+    goto cleanup;
+  }
+  // Any difference in the JSON makes a different model, even if the weights are the same.
+  char spaced[1024];
+  size_t const json_len = strlen(model_json);
+  memcpy(spaced, model_json, json_len);
+  spaced[json_len] = ' ';
+  other = budouxc_acquire(&allocators, spaced, json_len + 1, error);
+  if (!other || other == first) {
+    printf("budouxc_acquire did not load a different JSON: %s\n", error);
+    goto cleanup;
+  }
+  budouxc_destroy(other);
+  other = NULL;
+
+  // Releasing one reference keeps the model for the other.
+  budouxc_destroy(first);
+  first = NULL;
+  boundaries = budouxc_parse_boundaries_utf8(second, sentence, strlen(sentence), error);
+  if (!boundaries || boundaries->n == 0) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+  budouxc_boundaries_destroy(second, boundaries);
+  boundaries = NULL;
+  budouxc_destroy(second);
+  second = NULL;
+  if (atomic_load(&counter.current) != 0) {
+    printf("memory left after the last reference was released: %zu bytes\n", atomic_load(&counter.current));
+    goto cleanup;
+  }
+  // Once freed, the model is loaded again.
+  size_t const released_allocations = atomic_load(&counter.allocations);
+  first = budouxc_acquire(&allocators, model_json, strlen(model_json), error);
+  if (!first || atomic_load(&counter.allocations) == released_allocations) {
+    printf("budouxc_acquire did not load the released model again: %s\n", error);
+    goto cleanup;
+  }
+
+  ja = budouxc_acquire_embedded_ja(NULL, error);
+  if (!ja) {
+    printf("budouxc_acquire_embedded_ja failed: %s\n", error);
+    goto cleanup;
+  }
+  ja2 = budouxc_acquire_embedded_ja(NULL, error);
+  zh = budouxc_acquire_embedded_zh_hans(NULL, error);
+  if (ja2 != ja || !zh || zh == ja || zh == first) {
+    printf("unexpected embedded models\n");
+    goto cleanup;
+  }
+  ok = true;
+
+cleanup:
+  if (boundaries) {
+    budouxc_boundaries_destroy(second, boundaries);
+  }
+  budouxc_destroy(zh);
+  budouxc_destroy(ja2);
+  budouxc_destroy(ja);
+  budouxc_destroy(other);
+  budouxc_destroy(second);
+  budouxc_destroy(first);
+  if (ok && atomic_load(&counter.current) != 0) {
+    printf("memory leaked: %zu bytes\n", atomic_load(&counter.current));
+    ok = false;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+#include "budoux-c.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static char const sentence[] = "私はその人を常に先生と呼んでいた。\n"
+                               "だからここでもただ先生と書くだけで本名は打ち明けない。";
+
+static bool check_tables(struct budouxc_model_stats const *const stats, double const max_load_factor) {
+  for (size_t i = 0; i < 3; ++i) {
+    struct budouxc_table_stats const *const t = &stats->tables[i];
+    if (!t->entries || t->entries > t->capacity || t->load_factor > max_load_factor) {
+      printf("table %zu: unexpected load: %zu / %zu\n", i, t->entries, t->capacity);
+      return false;
+    }
+    size_t n = 0;
+    for (size_t j = 0; j < BUDOUXC_PROBE_LENGTHS; ++j) {
+      n += t->probe_lengths[j];
+    }
+    if (n != t->entries) {
+      printf("table %zu: probe lengths count %zu entries, expected: %zu\n", i, n, t->entries);
+      return false;
+    }
+    // Every hit takes at least one probe, and a miss probes at least as far as the hit it would have been.
+    if (t->average_probes < 1.0 || t->average_miss_probes < 1.0) {
+      printf("table %zu: unexpected probes: %f, %f\n", i, t->average_probes, t->average_miss_probes);
+      return false;
+    }
+  }
+  size_t weights = 0;
+  for (size_t i = 0; i < BUDOUXC_FEATURES; ++i) {
+    weights += stats->weights[i];
+  }
+  if (!weights) {
+    printf("no weights\n");
+    return false;
+  }
+  if (stats->base_score != -(double)stats->sum / 2.0) {
+    printf("unexpected base score: %f, sum: %d\n", stats->base_score, (int)stats->sum);
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  char error[128] = {0};
+  bool ok = false;
+  struct budouxc *model = NULL;
+  struct budouxc *compact = NULL;
+  struct budouxc_boundaries *boundaries = NULL;
+  struct budouxc_model_stats stats;
+
+  model = budouxc_init_embedded_ja(NULL, error);
+  if (!model) {
+    printf("budouxc_init_embedded_ja failed: %s\n", error);
+    goto cleanup;
+  }
+  if (budouxc_model_stats(NULL, &stats) || budouxc_model_stats(model, NULL)) {
+    printf("budouxc_model_stats accepted NULL\n");
+    goto cleanup;
+  }
+  if (!budouxc_model_stats(model, &stats)) {
+    printf("budouxc_model_stats failed\n");
+    goto cleanup;
+  }
+  if (stats.compact || stats.bytes != budouxc_model_bytes(model) || !stats.characters ||
+      !check_tables(&stats, 0.5)) {
+    goto cleanup;
+  }
+
+  compact = budouxc_init_compact(NULL, model, error);
+  if (!compact) {
+    printf("budouxc_init_compact failed: %s\n", error);
+    goto cleanup;
+  }
+  struct budouxc_model_stats compact_stats;
+  if (!budouxc_model_stats(compact, &compact_stats)) {
+    printf("budouxc_model_stats failed\n");
+    goto cleanup;
+  }
+  if (!compact_stats.compact || compact_stats.bytes != budouxc_model_bytes(compact) ||
+      !check_tables(&compact_stats, 0.75)) {
+    goto cleanup;
+  }
+  // The weights fit in 16 bits without scaling, so the same n-grams and weights are kept.
+  for (size_t i = 0; i < 3; ++i) {
+    if (compact_stats.tables[i].entries != stats.tables[i].entries) {
+      printf("table %zu: entries mismatch\n", i);
+      goto cleanup;
+    }
+  }
+  if (memcmp(compact_stats.weights, stats.weights, sizeof(stats.weights)) != 0) {
+    printf("weights mismatch\n");
+    goto cleanup;
+  }
+
+  // Lookups are only counted when the library is built to count them.
+  boundaries = budouxc_parse_boundaries_utf8(model, sentence, strlen(sentence), error);
+  if (!boundaries) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+  struct budouxc_model_stats after;
+  if (!budouxc_model_stats(model, &after)) {
+    printf("budouxc_model_stats failed\n");
+    goto cleanup;
+  }
+  for (size_t i = 0; i < 3; ++i) {
+    uint64_t const before_lookups = stats.tables[i].hits + stats.tables[i].misses;
+    uint64_t const after_lookups = after.tables[i].hits + after.tables[i].misses;
+    if (after.counting ? after_lookups <= before_lookups : after_lookups != 0) {
+      printf("table %zu: unexpected lookups: %llu\n", i, (unsigned long long)after_lookups);
+      goto cleanup;
+    }
+  }
+  ok = true;
+
+cleanup:
+  if (boundaries) {
+    budouxc_boundaries_destroy(model, boundaries);
+  }
+  budouxc_destroy(compact);
+  budouxc_destroy(model);
+  return ok ? 0 : 1;
+}
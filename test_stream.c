@@ -0,0 +1,96 @@
+#include "budoux-c.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static char const sentence[] = "私はその人を常に先生と呼んでいた。\n"
+                               "だからここでもただ先生と書くだけで本名は打ち明けない。\n"
+                               "これは世間を憚かる遠慮というよりも、その方が私にとって自然だからである。";
+
+static bool append(size_t *const indices, size_t *const n, struct budouxc_boundaries const *const b) {
+  if (*n + b->n > 64) {
+    printf("too many boundaries\n");
+    return false;
+  }
+  for (size_t i = 0; i < b->n; ++i) {
+    indices[(*n)++] = b->indices[i];
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  char error[128] = {0};
+  bool ok = false;
+  struct budouxc *model = NULL;
+  struct budouxc_stream *stream = NULL;
+  struct budouxc_boundaries *golden = NULL;
+
+  model = budouxc_init_embedded_ja(NULL, error);
+  if (!model) {
+    printf("budouxc_init_embedded_ja failed: %s\n", error);
+    goto cleanup;
+  }
+  golden = budouxc_parse_boundaries_utf8(model, sentence, strlen(sentence), error);
+  if (!golden) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+  stream = budouxc_stream_init(model, error);
+  if (!stream) {
+    printf("budouxc_stream_init failed: %s\n", error);
+    goto cleanup;
+  }
+
+  // Chunks of every size up to 7 bytes split characters in every possible place.
+  for (size_t chunk_size = 1; chunk_size <= 7; ++chunk_size) {
+    size_t indices[64];
+    size_t n = 0;
+    for (size_t pos = 0; pos < strlen(sentence); pos += chunk_size) {
+      size_t const len = strlen(sentence) - pos < chunk_size ? strlen(sentence) - pos : chunk_size;
+      struct budouxc_boundaries const *const b = budouxc_stream_feed_utf8(stream, sentence + pos, len, error);
+      if (!b) {
+        printf("budouxc_stream_feed_utf8 failed: %s\n", error);
+        goto cleanup;
+      }
+      if (!append(indices, &n, b)) {
+        goto cleanup;
+      }
+    }
+    struct budouxc_boundaries const *const b = budouxc_stream_finish(stream, error);
+    if (!b) {
+      printf("budouxc_stream_finish failed: %s\n", error);
+      goto cleanup;
+    }
+    if (!append(indices, &n, b)) {
+      goto cleanup;
+    }
+    if (n != golden->n || memcmp(indices, golden->indices, n * sizeof(size_t)) != 0) {
+      printf("boundary mismatch with %zu byte chunks\n", chunk_size);
+      goto cleanup;
+    }
+  }
+
+  // A stream that ends in the middle of a character is broken.
+  if (!budouxc_stream_feed_utf8(stream, sentence, 4, error)) {
+    printf("budouxc_stream_feed_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+  if (budouxc_stream_finish(stream, error)) {
+    printf("budouxc_stream_finish accepted a partial character\n");
+    goto cleanup;
+  }
+  ok = true;
+
+cleanup:
+  budouxc_stream_destroy(stream);
+  if (golden) {
+    budouxc_boundaries_destroy(model, golden);
+  }
+  budouxc_destroy(model);
+  return ok ? 0 : 1;
+}
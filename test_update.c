@@ -0,0 +1,97 @@
+#include "budoux-c.h"
+#include "test_helpers.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+static char const sentence[] = "私はその人を常に先生と呼んでいた。だからここでもただ先生と書くだけで本名は打ち明けない。";
+
+struct edit {
+  size_t offset;
+  size_t removed_len;
+  char const *inserted;
+};
+
+// Byte offsets into the text, where each edit is applied to the result of the previous one. SIZE_MAX edits the end.
+static struct edit const edits[] = {
+    {0, 0, "昔、"},
+    {12, 3, "あの"},
+    {33, 0, "いつも"},
+    {0, 6, ""},
+    {SIZE_MAX, 3, "と思う。"},
+};
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  char error[128] = {0};
+  bool ok = false;
+  struct budouxc *model = NULL;
+  struct budouxc_boundaries *prev = NULL;
+  struct budouxc_boundaries *golden = NULL;
+  char text[256];
+  size_t text_len = strlen(sentence);
+  memcpy(text, sentence, text_len);
+
+  model = budouxc_init_embedded_ja(NULL, error);
+  if (!model) {
+    printf("budouxc_init_embedded_ja failed: %s\n", error);
+    goto cleanup;
+  }
+  prev = budouxc_parse_boundaries_utf8(model, text, text_len, error);
+  if (!prev) {
+    printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+    goto cleanup;
+  }
+  for (size_t i = 0; i < sizeof(edits) / sizeof(edits[0]); ++i) {
+    struct edit const *const e = &edits[i];
+    size_t const inserted_len = strlen(e->inserted);
+    size_t const offset = e->offset == SIZE_MAX ? text_len - e->removed_len : e->offset;
+    memmove(text + offset + inserted_len, text + offset + e->removed_len, text_len - offset - e->removed_len);
+    memcpy(text + offset, e->inserted, inserted_len);
+    text_len = text_len - e->removed_len + inserted_len;
+
+    struct budouxc_boundaries *const next =
+        budouxc_update_boundaries_utf8(model, prev, text, text_len, offset, e->removed_len, inserted_len, error);
+    if (!next) {
+      printf("budouxc_update_boundaries_utf8 failed at edit #%zu: %s\n", i, error);
+      goto cleanup;
+    }
+    budouxc_boundaries_destroy(model, prev);
+    prev = next;
+
+    golden = budouxc_parse_boundaries_utf8(model, text, text_len, error);
+    if (!golden) {
+      printf("budouxc_parse_boundaries_utf8 failed: %s\n", error);
+      goto cleanup;
+    }
+    if (!same_boundaries(golden, prev)) {
+      printf("  at edit #%zu\n", i);
+      goto cleanup;
+    }
+    budouxc_boundaries_destroy(model, golden);
+    golden = NULL;
+  }
+
+  // An edit must not start in the middle of a character.
+  struct budouxc_boundaries *const broken = budouxc_update_boundaries_utf8(model, prev, text, text_len, 1, 0, 0, error);
+  if (broken) {
+    printf("budouxc_update_boundaries_utf8 accepted an offset inside a character\n");
+    budouxc_boundaries_destroy(model, broken);
+    goto cleanup;
+  }
+  ok = true;
+
+cleanup:
+  if (golden) {
+    budouxc_boundaries_destroy(model, golden);
+  }
+  if (prev) {
+    budouxc_boundaries_destroy(model, prev);
+  }
+  budouxc_destroy(model);
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+#include "budoux-c.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TEXT_LEN 4096
+
+// Runs of each sequence length, so that the decoder takes full blocks, partial blocks and single code points.
+static char32_t const alphabets[][8] = {
+    {U'a', U'b', U' ', U'1', U'.', U'z', U'Q', U'\n'},
+    {U'д', U'ж', U'я', U'ü', U'ß', U'é', U'ω', U'ق'},
+    {U'私', U'は', U'そ', U'の', U'先', U'生', U'。', U'ー'},
+    {U'ก', U'ข', U'ค', U'ง', U'ะ', U'า', U'ิ', U'่'},
+    {U'😀', U'𠮷', U'🎉', U'𩸽', U'😀', U'𠮷', U'🎉', U'𩸽'},
+};
+
+static char const *const invalid_sequences[] = {
+    "\xe0\x80\x80",     // overlong 3-byte
+    "\xed\xa0\x80",     // surrogate
+    "\xc0\x80",         // overlong 2-byte
+    "\xc1\xbf",         // overlong 2-byte
+    "\xe3\x81",         // truncated
+    "\x80",             // lone continuation byte
+    "\xe3\x41\x81",     // ASCII in place of a continuation byte
+    "\xf5\x80\x80\x80", // beyond U+10FFFF
+    "\xf0\x8f\xbf\xbf", // overlong 4-byte
+};
+
+static uint32_t rng_state = 1;
+
+static uint32_t rng(void) {
+  rng_state = rng_state * 1103515245 + 12345;
+  return rng_state >> 16;
+}
+
+static size_t encode(char *const dest, char32_t const ch) {
+  uint8_t *const p = (uint8_t *)dest;
+  if (ch < 0x80) {
+    p[0] = (uint8_t)ch;
+    return 1;
+  }
+  if (ch < 0x800) {
+    p[0] = (uint8_t)(0xc0 | (ch >> 6));
+    p[1] = (uint8_t)(0x80 | (ch & 0x3f));
+    return 2;
+  }
+  if (ch < 0x10000) {
+    p[0] = (uint8_t)(0xe0 | (ch >> 12));
+    p[1] = (uint8_t)(0x80 | ((ch >> 6) & 0x3f));
+    p[2] = (uint8_t)(0x80 | (ch & 0x3f));
+    return 3;
+  }
+  p[0] = (uint8_t)(0xf0 | (ch >> 18));
+  p[1] = (uint8_t)(0x80 | ((ch >> 12) & 0x3f));
+  p[2] = (uint8_t)(0x80 | ((ch >> 6) & 0x3f));
+  p[3] = (uint8_t)(0x80 | (ch & 0x3f));
+  return 4;
+}
+
+static char32_t text32[TEXT_LEN];
+static size_t offsets[TEXT_LEN];
+static char text8[TEXT_LEN * 4 + 16];
+
+int main(int argc, char *argv[]) {
+  (void)argc;
+  (void)argv;
+
+  char error[128] = {0};
+  bool ok = false;
+  struct budouxc *model = NULL;
+  struct budouxc_boundaries *want = NULL;
+  struct budouxc_boundaries *got = NULL;
+
+  model = budouxc_init_embedded_ja(NULL, error);
+  if (!model) {
+    printf("budouxc_init_embedded_ja failed: %s\n", error);
+    goto cleanup;
+  }
+
+  for (size_t round = 0; round < 16; ++round) {
+    // Early rounds use long runs of one alphabet, later rounds switch alphabets more often.
+    size_t const max_run = round < 8 ? 200 : 8;
+    size_t len8 = 0;
+    size_t n = 0;
+    while (n < TEXT_LEN) {
+      char32_t const *const alphabet = alphabets[rng() % (sizeof(alphabets) / sizeof(alphabets[0]))];
+      size_t const run = 1 + rng() % max_run;
+      for (size_t i = 0; i < run && n < TEXT_LEN; ++i) {
+        text32[n] = alphabet[rng() % 8];
+        offsets[n] = len8;
+        len8 += encode(text8 + len8, text32[n]);
+        ++n;
+      }
+    }
+    want = budouxc_parse_boundaries_utf32(model, text32, TEXT_LEN, error);
+    if (!want) {
+      printf("budouxc_parse_boundaries_utf32 failed: %s\n", error);
+      goto cleanup;
+    }
+    got = budouxc_parse_boundaries_utf8(model, text8, len8, error);
+    if (!got) {
+      printf("round %zu: budouxc_parse_boundaries_utf8 failed: %s\n", round, error);
+      goto cleanup;
+    }
+    if (want->n == 0 || want->n != got->n) {
+      printf("round %zu: %zu boundaries, expected: %zu\n", round, got->n, want->n);
+      goto cleanup;
+    }
+    for (size_t i = 0; i < want->n; ++i) {
+      if (got->indices[i] != offsets[want->indices[i]]) {
+        printf("round %zu: boundary #%zu at byte %zu, expected: %zu\n",
+               round,
+               i,
+               got->indices[i],
+               offsets[want->indices[i]]);
+        goto cleanup;
+      }
+    }
+    budouxc_boundaries_destroy(model, got);
+    got = NULL;
+    budouxc_boundaries_destroy(model, want);
+    want = NULL;
+  }
+
+  // An invalid sequence is rejected wherever it falls in a block of each alphabet.
+  for (size_t a = 0; a < sizeof(alphabets) / sizeof(alphabets[0]); ++a) {
+    for (size_t s = 0; s < sizeof(invalid_sequences) / sizeof(invalid_sequences[0]); ++s) {
+      for (size_t prefix = 0; prefix < 40; ++prefix) {
+        size_t len8 = 0;
+        for (size_t i = 0; i < prefix; ++i) {
+          len8 += encode(text8 + len8, alphabets[a][i % 8]);
+        }
+        size_t const bad_len = strlen(invalid_sequences[s]);
+        memcpy(text8 + len8, invalid_sequences[s], bad_len);
+        len8 += bad_len;
+        // Also test the sequence at the very end of the input.
+        size_t const suffix = prefix % 2 ? 0 : 40;
+        for (size_t i = 0; i < suffix; ++i) {
+          len8 += encode(text8 + len8, alphabets[a][i % 8]);
+        }
+        got = budouxc_parse_boundaries_utf8(model, text8, len8, error);
+        if (got) {
+          printf("invalid sequence #%zu after %zu code points of alphabet #%zu was accepted\n", s, prefix, a);
+          goto cleanup;
+        }
+      }
+    }
+  }
+  ok = true;
+
+cleanup:
+  if (got) {
+    budouxc_boundaries_destroy(model, got);
+  }
+  if (want) {
+    budouxc_boundaries_destroy(model, want);
+  }
+  budouxc_destroy(model);
+  return ok ? 0 : 1;
+}
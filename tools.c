@@ -0,0 +1,88 @@
+#include "tools.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#  include <fcntl.h>
+#  include <io.h>
+#endif
+
+FILE *open_file(char const *const path, char const *const mode, FILE *const std) {
+  if (strcmp(path, "-") != 0) {
+    return fopen(path, mode);
+  }
+#ifdef _WIN32
+  _setmode(_fileno(std), _O_BINARY);
+#endif
+  return std;
+}
+
+char *read_file(char const *const path, size_t *const len) {
+  FILE *const f = open_file(path, "rb", stdin);
+  if (!f) {
+    return NULL;
+  }
+  char *buf = NULL;
+  size_t cap = 0;
+  size_t n = 0;
+  for (;;) {
+    if (n == cap) {
+      size_t const newcap = cap ? cap * 2 : 65536;
+      char *const newbuf = realloc(buf, newcap);
+      if (!newbuf) {
+        free(buf);
+        buf = NULL;
+        goto cleanup;
+      }
+      buf = newbuf;
+      cap = newcap;
+    }
+    size_t const read = fread(buf + n, 1, cap - n, f);
+    if (read == 0) {
+      break;
+    }
+    n += read;
+  }
+  if (ferror(f)) {
+    free(buf);
+    buf = NULL;
+    goto cleanup;
+  }
+  *len = n;
+cleanup:
+  if (f != stdin) {
+    fclose(f);
+  }
+  return buf;
+}
+
+size_t decode_utf8(unsigned char const *const s, size_t const len, char32_t *const ch) {
+  // The smallest code point that needs each sequence length, to reject overlong forms.
+  static char32_t const min[5] = {0, 0, 0x80, 0x800, 0x10000};
+  size_t n = 0;
+  if (s[0] < 0x80) {
+    n = 1;
+  } else if ((s[0] & 0xe0) == 0xc0) {
+    n = 2;
+  } else if ((s[0] & 0xf0) == 0xe0) {
+    n = 3;
+  } else if ((s[0] & 0xf8) == 0xf0) {
+    n = 4;
+  }
+  if (!n || n > len) {
+    return 0;
+  }
+  char32_t v = (char32_t)(n == 1 ? s[0] : s[0] & (0x7f >> n));
+  for (size_t i = 1; i < n; ++i) {
+    if ((s[i] & 0xc0) != 0x80) {
+      return 0;
+    }
+    v = (v << 6) | (s[i] & 0x3f);
+  }
+  if (v < min[n] || v > 0x10ffff || (v >= 0xd800 && v < 0xe000)) {
+    return 0;
+  }
+  *ch = v;
+  return n;
+}
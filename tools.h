@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdio.h>
+#include <uchar.h>
+
+// Helpers shared by the command line tools.
+
+// Opens path with mode. "-" can be used as a path to read from stdin or write to stdout, given as std, so that the
+// tools can be run under a WASI runtime without granting directory access.
+FILE *open_file(char const *const path, char const *const mode, FILE *const std);
+
+// Reads the whole file at path, or stdin for "-", into a buffer that the caller must free. Returns NULL on failure.
+char *read_file(char const *const path, size_t *const len);
+
+// Decodes the UTF-8 sequence at the start of s into *ch. Returns its length, or 0 if it is truncated, overlong, a
+// surrogate or beyond U+10FFFF.
+size_t decode_utf8(unsigned char const *const s, size_t const len, char32_t *const ch);